@@ -0,0 +1,277 @@
+/*
+ * User-space companion of ku_copy_bench.c: drives the kernel's
+ * copy_to_user/copy_from_user paths through system calls, so it runs
+ * without root, kernel headers or insmod.
+ *
+ *   memfd  pread copies page cache to user (copy_to_user), pwrite
+ *          copies user to page cache (copy_from_user)
+ *   pipe   read and write on a pipe sized to hold the largest buffer
+ *   vm     process_vm_readv/process_vm_writev on this process itself
+ *
+ * Every result includes the system call around the copy, which
+ * dominates the small sizes.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+static const unsigned int buf_size = 256 * 1024; /* 256KB buffer */
+
+static unsigned long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* The rate counts the bytes copied, iterations * size, which is below the
+ * budget when size doesn't divide it. */
+static void report(const char *name, unsigned int size, unsigned long long ns,
+                   unsigned long long iterations) {
+  unsigned long long bytes = iterations * size;
+  if (ns == 0)
+    ns = 1;
+  printf("%-14s %8u bytes: %10llu ns (%10llu iters) %14llu bytes/s\n", name,
+         size, ns, iterations, (unsigned long long)(bytes * 1e9 / ns));
+}
+
+static int bench_memfd(char *umem, unsigned long long total_bytes) {
+  int retval = 0;
+  unsigned long long start, end;
+  unsigned int size;
+  unsigned long long iterations;
+  int fd = memfd_create("ku_copy_user", 0);
+  if (fd < 0) {
+    perror("memfd_create");
+    return -1;
+  }
+  /* Populate the page cache so that pwrite never allocates. */
+  if (pwrite(fd, umem, buf_size, 0) != (ssize_t)buf_size) {
+    perror("pwrite");
+    retval = -1;
+    goto cleanup;
+  }
+
+  for (size = 8; size <= buf_size; size = (size << 1)) {
+    iterations = total_bytes / size;
+    start = now_ns();
+    for (unsigned long long i = 0; i < iterations; i++) {
+      if (pread(fd, umem, size, 0) != (ssize_t)size) {
+        fprintf(stderr, "pread did partial copy\n");
+        retval = -1;
+        goto cleanup;
+      }
+    }
+    end = now_ns();
+    report("pread", size, end - start, iterations);
+
+    start = now_ns();
+    for (unsigned long long i = 0; i < iterations; i++) {
+      if (pwrite(fd, umem, size, 0) != (ssize_t)size) {
+        fprintf(stderr, "pwrite did partial copy\n");
+        retval = -1;
+        goto cleanup;
+      }
+    }
+    end = now_ns();
+    report("pwrite", size, end - start, iterations);
+  }
+
+cleanup:
+  close(fd);
+  return retval;
+}
+
+/*
+ * A pipe can't take more than its capacity without a reader, so the
+ * copies go in batches that fill it: the writes of a batch are timed as
+ * pipe_write (copy_from_user), the reads that drain it as pipe_read
+ * (copy_to_user).
+ */
+static int bench_pipe(char *umem, char *peer, unsigned long long total_bytes) {
+  int retval = 0;
+  unsigned long long write_ns, read_ns, start;
+  unsigned int size;
+  unsigned long long iterations, batch;
+  int p[2];
+  if (pipe(p) != 0) {
+    perror("pipe");
+    return -1;
+  }
+  if (fcntl(p[1], F_SETPIPE_SZ, buf_size) < 0)
+    perror("F_SETPIPE_SZ");
+  int capacity = fcntl(p[1], F_GETPIPE_SZ);
+  if (capacity < 0) {
+    perror("F_GETPIPE_SZ");
+    retval = -1;
+    goto cleanup;
+  }
+
+  for (size = 8; size <= buf_size; size = (size << 1)) {
+    if (size > (unsigned int)capacity) {
+      fprintf(stderr, "pipe holds %d bytes, skipping %u\n", capacity, size);
+      break;
+    }
+    iterations = total_bytes / size;
+    batch = capacity / size;
+    write_ns = read_ns = 0;
+    for (unsigned long long done = 0; done < iterations; done += batch) {
+      unsigned long long n =
+          iterations - done < batch ? iterations - done : batch;
+      start = now_ns();
+      for (unsigned long long i = 0; i < n; i++) {
+        if (write(p[1], umem, size) != (ssize_t)size) {
+          fprintf(stderr, "pipe write did partial copy\n");
+          retval = -1;
+          goto cleanup;
+        }
+      }
+      write_ns += now_ns() - start;
+      start = now_ns();
+      for (unsigned long long i = 0; i < n; i++) {
+        if (read(p[0], peer, size) != (ssize_t)size) {
+          fprintf(stderr, "pipe read did partial copy\n");
+          retval = -1;
+          goto cleanup;
+        }
+      }
+      read_ns += now_ns() - start;
+    }
+    report("pipe_read", size, read_ns, iterations);
+    report("pipe_write", size, write_ns, iterations);
+  }
+
+cleanup:
+  close(p[0]);
+  close(p[1]);
+  return retval;
+}
+
+/*
+ * process_vm_readv copies the "remote" buffer into the local one with
+ * copy_to_user, process_vm_writev the other way with copy_from_user. The
+ * remote process is this one, which needs no ptrace permission.
+ */
+static int bench_vm(char *umem, char *peer, unsigned long long total_bytes) {
+  unsigned long long start, end;
+  unsigned int size;
+  unsigned long long iterations;
+  pid_t pid = getpid();
+
+  for (size = 8; size <= buf_size; size = (size << 1)) {
+    struct iovec local = {.iov_base = umem, .iov_len = size};
+    struct iovec remote = {.iov_base = peer, .iov_len = size};
+    iterations = total_bytes / size;
+    start = now_ns();
+    for (unsigned long long i = 0; i < iterations; i++) {
+      if (process_vm_readv(pid, &local, 1, &remote, 1, 0) != (ssize_t)size) {
+        perror("process_vm_readv");
+        return -1;
+      }
+    }
+    end = now_ns();
+    report("vm_readv", size, end - start, iterations);
+
+    start = now_ns();
+    for (unsigned long long i = 0; i < iterations; i++) {
+      if (process_vm_writev(pid, &local, 1, &remote, 1, 0) != (ssize_t)size) {
+        perror("process_vm_writev");
+        return -1;
+      }
+    }
+    end = now_ns();
+    report("vm_writev", size, end - start, iterations);
+  }
+  return 0;
+}
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [-m memfd|pipe|vm] [-b bytes]\n"
+          "  -m  run one method instead of all three\n"
+          "  -b  bytes copied per size and direction, with an optional\n"
+          "      K, M or G suffix (default 1G)\n",
+          prog);
+}
+
+int main(int argc, char **argv) {
+  int retval = 0;
+  const char *method = NULL;
+  unsigned long long total_bytes = (1024ULL * 1024 * 1024); /* 1GB */
+  char *umem = MAP_FAILED, *peer = MAP_FAILED;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:b:h")) != -1) {
+    switch (opt) {
+    case 'm':
+      method = optarg;
+      break;
+    case 'b': {
+      char *end;
+      errno = 0;
+      total_bytes = strtoull(optarg, &end, 0);
+      switch (*end) {
+      case 'G':
+        total_bytes <<= 10; /* fall through */
+      case 'M':
+        total_bytes <<= 10; /* fall through */
+      case 'K':
+        total_bytes <<= 10;
+        end++;
+        break;
+      }
+      if (errno != 0 || *end != '\0' || total_bytes < buf_size) {
+        fprintf(stderr, "%s: -b takes a byte count of at least %u\n", argv[0],
+                buf_size);
+        return 1;
+      }
+      break;
+    }
+    default:
+      usage(argv[0]);
+      return opt == 'h' ? 0 : 1;
+    }
+  }
+  if (method != NULL && strcmp(method, "memfd") != 0 &&
+      strcmp(method, "pipe") != 0 && strcmp(method, "vm") != 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  umem = mmap(NULL, buf_size, PROT_READ | PROT_WRITE,
+              MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  peer = mmap(NULL, buf_size, PROT_READ | PROT_WRITE,
+              MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (umem == MAP_FAILED || peer == MAP_FAILED) {
+    perror("mmap");
+    retval = 1;
+    goto cleanup;
+  }
+  memset(umem, 0x55, buf_size);
+  memset(peer, 0x55, buf_size);
+
+  printf("Kernel-User memory copy microbenchmark starts.\n");
+  if ((method == NULL || strcmp(method, "memfd") == 0) &&
+      bench_memfd(umem, total_bytes) != 0)
+    retval = 1;
+  if ((method == NULL || strcmp(method, "pipe") == 0) &&
+      bench_pipe(umem, peer, total_bytes) != 0)
+    retval = 1;
+  if ((method == NULL || strcmp(method, "vm") == 0) &&
+      bench_vm(umem, peer, total_bytes) != 0)
+    retval = 1;
+  printf("Kernel-User memory copy microbenchmark ends.\n");
+
+cleanup:
+  if (umem != MAP_FAILED)
+    munmap(umem, buf_size);
+  if (peer != MAP_FAILED)
+    munmap(peer, buf_size);
+  return retval;
+}
@@ -0,0 +1,220 @@
+#include "buffer.h"
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <linux/mempolicy.h>
+#include <sstream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+constexpr size_t small_page = 4096;
+constexpr size_t thp_size = 2 << 20; // PMD size on x86-64 and arm64 4K
+
+size_t round_up(size_t v, size_t to) { return (v + to - 1) / to * to; }
+
+// Hugepagesize from /proc/meminfo, the size MAP_HUGETLB gets by default.
+size_t hugetlb_page_size() {
+  std::ifstream in("/proc/meminfo");
+  std::string key;
+  size_t kb;
+  while (in >> key) {
+    if (key == "Hugepagesize:" && in >> kb)
+      return kb * 1024;
+    in.ignore(256, '\n');
+  }
+  return thp_size;
+}
+
+// Nodes listed in a sysfs node list such as "0-1,3".
+std::vector<int> read_node_list(const char *path) {
+  std::vector<int> nodes;
+  std::ifstream in(path);
+  std::string range;
+  while (std::getline(in, range, ',')) {
+    int first, last;
+    char dash;
+    std::istringstream rs(range);
+    if (!(rs >> first))
+      continue;
+    last = first;
+    if (rs >> dash >> last && dash != '-')
+      last = first;
+    for (int n = first; n <= last; ++n)
+      nodes.push_back(n);
+  }
+  return nodes;
+}
+
+int current_node() {
+  unsigned cpu = 0, node = 0;
+  if (syscall(SYS_getcpu, &cpu, &node, nullptr) != 0)
+    return 0;
+  return static_cast<int>(node);
+}
+
+// The node numa asks for, -1 if there is no such node.
+int target_node(numa_kind numa) {
+  int local = current_node();
+  if (numa == numa_kind::local)
+    return local;
+  std::vector<int> nodes =
+      read_node_list("/sys/devices/system/node/has_memory");
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    if (nodes[i] != local)
+      continue;
+    for (size_t j = 1; j < nodes.size(); ++j)
+      if (nodes[(i + j) % nodes.size()] != local)
+        return nodes[(i + j) % nodes.size()];
+  }
+  return -1;
+}
+
+void bind_to_node(char *addr, size_t len, int node, const std::string &who) {
+  unsigned long mask[16] = {};
+  constexpr int bits = sizeof(unsigned long) * 8;
+  if (node >= bits * 16) {
+    std::cerr << who << ": NUMA node " << node << " out of range" << std::endl;
+    return;
+  }
+  mask[node / bits] = 1UL << (node % bits);
+  // The kernel drops the last bit of maxnode, hence the + 1.
+  if (syscall(SYS_mbind, addr, len, MPOL_BIND, mask, bits * 16 + 1,
+              MPOL_MF_STRICT | MPOL_MF_MOVE) != 0)
+    std::cerr << who << ": mbind to node " << node
+              << " failed: " << strerror(errno) << std::endl;
+}
+
+} // namespace
+
+buffer_pool::buffer_pool(const buffer_options &opts, size_t len,
+                         const std::string &who)
+    : slots_(opts.pool > 0 ? opts.pool : 1) {
+  stride_ = round_up(len > 0 ? len : 1, small_page);
+  bytes_ = stride_ * slots_;
+
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  // MAP_POPULATE would fault the pages in before mbind or madvise had a say.
+  bool late_populate = opts.populate && (opts.numa != numa_kind::none ||
+                                         opts.pages == page_kind::thp);
+  if (opts.populate && !late_populate)
+    flags |= MAP_POPULATE;
+
+  size_t align = small_page;
+  if (opts.pages == page_kind::hugetlb) {
+    flags |= MAP_HUGETLB;
+    bytes_ = round_up(bytes_, hugetlb_page_size());
+  } else if (opts.pages == page_kind::thp) {
+    bytes_ = round_up(bytes_, thp_size);
+    align = thp_size;
+  }
+
+  // Over-allocate by the alignment and trim, so that THP gets huge page
+  // aligned ranges to work with.
+  map_len_ = bytes_ + (align > small_page ? align : 0);
+  void *ptr = mmap(nullptr, map_len_, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (ptr == MAP_FAILED) {
+    std::cerr << who << ": mmap of " << map_len_ << " bytes failed: "
+              << strerror(errno);
+    if (opts.pages == page_kind::hugetlb)
+      std::cerr << " (are huge pages reserved in /proc/sys/vm/nr_hugepages?)";
+    std::cerr << std::endl;
+    exit(1);
+  }
+  map_ = static_cast<char *>(ptr);
+  base_ = reinterpret_cast<char *>(
+      round_up(reinterpret_cast<uintptr_t>(map_), align));
+
+  if (opts.pages == page_kind::thp &&
+      madvise(base_, bytes_, MADV_HUGEPAGE) != 0)
+    std::cerr << who << ": madvise(MADV_HUGEPAGE) failed: " << strerror(errno)
+              << std::endl;
+
+  if (opts.numa != numa_kind::none) {
+    int node = target_node(opts.numa);
+    if (node < 0)
+      std::cerr << who << ": No remote NUMA node with memory, buffers stay "
+                << "where first touch puts them" << std::endl;
+    else
+      bind_to_node(base_, bytes_, node, who);
+  }
+
+  if (late_populate)
+    for (size_t off = 0; off < bytes_; off += small_page)
+      base_[off] = 0;
+}
+
+buffer_pool::~buffer_pool() {
+  if (munmap(map_, map_len_) != 0) {
+    std::cerr << "munmap failed!" << std::endl;
+    exit(1);
+  }
+}
+
+void buffer_pool::fill(char c) {
+  for (int i = 0; i < slots_; ++i)
+    memset(slot(i), c, stride_);
+}
+
+bool buffer_options_default(const buffer_options &opts) {
+  buffer_options defaults;
+  return opts.pages == defaults.pages && opts.numa == defaults.numa &&
+         opts.populate == defaults.populate && opts.pool == defaults.pool;
+}
+
+std::vector<std::pair<std::string, std::string>>
+buffer_labels(const buffer_options &opts) {
+  return {{"pages", page_name(opts.pages)},
+          {"numa", numa_name(opts.numa)},
+          {"populate", opts.populate ? "on" : "off"},
+          {"pool", std::to_string(opts.pool)}};
+}
+
+const char *page_name(page_kind kind) {
+  switch (kind) {
+  case page_kind::thp:
+    return "thp";
+  case page_kind::hugetlb:
+    return "hugetlb";
+  case page_kind::normal:
+  default:
+    return "normal";
+  }
+}
+
+bool parse_pages(const char *name, page_kind &kind) {
+  for (page_kind k : {page_kind::normal, page_kind::thp, page_kind::hugetlb}) {
+    if (strcmp(name, page_name(k)) == 0) {
+      kind = k;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *numa_name(numa_kind kind) {
+  switch (kind) {
+  case numa_kind::local:
+    return "local";
+  case numa_kind::remote:
+    return "remote";
+  case numa_kind::none:
+  default:
+    return "none";
+  }
+}
+
+bool parse_numa(const char *name, numa_kind &kind) {
+  for (numa_kind k : {numa_kind::none, numa_kind::local, numa_kind::remote}) {
+    if (strcmp(name, numa_name(k)) == 0) {
+      kind = k;
+      return true;
+    }
+  }
+  return false;
+}
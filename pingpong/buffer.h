@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Page size backing the message buffers.
+enum class page_kind {
+  normal,  // base pages, whatever the THP policy makes of them
+  thp,     // 2 MB aligned and madvise(MADV_HUGEPAGE)
+  hugetlb, // MAP_HUGETLB from the reserved pool in /proc/sys/vm/nr_hugepages
+};
+
+// NUMA node the buffers are bound to with mbind(MPOL_BIND).
+enum class numa_kind {
+  none,   // first touch decides
+  local,  // the node of the CPU the thread runs on when mapping
+  remote, // the next node with memory after the local one
+};
+
+struct buffer_options {
+  page_kind pages = page_kind::normal;
+  numa_kind numa = numa_kind::none;
+  bool populate = false; // fault every page in before the timed loops
+  int pool = 1;          // buffers the transfers rotate over
+};
+
+// Message buffers of one thread: pool slots of the same length in a single
+// mapping, one page apart or more, so that io_uring can register all of
+// them at once. With more slots than fit in cache, every message is copied
+// from or into cold memory.
+class buffer_pool {
+public:
+  // Maps and places the buffers. Exits with a message if the mapping fails;
+  // placement requests the system can't honour only warn.
+  buffer_pool(const buffer_options &opts, size_t len, const std::string &who);
+  ~buffer_pool();
+  buffer_pool(const buffer_pool &) = delete;
+  buffer_pool &operator=(const buffer_pool &) = delete;
+
+  char *base() const { return base_; }
+  size_t bytes() const { return bytes_; } // whole mapping, for registration
+  size_t stride() const { return stride_; }
+  int slots() const { return slots_; }
+  char *slot(uint64_t i) const { return base_ + (i % slots_) * stride_; }
+
+  // Writes c into every slot.
+  void fill(char c);
+
+private:
+  char *map_ = nullptr; // what mmap returned, may start below base_
+  size_t map_len_ = 0;
+  char *base_ = nullptr;
+  size_t bytes_ = 0;
+  size_t stride_ = 0;
+  int slots_ = 1;
+};
+
+bool buffer_options_default(const buffer_options &opts);
+
+// Label columns describing opts, for run records.
+std::vector<std::pair<std::string, std::string>>
+buffer_labels(const buffer_options &opts);
+
+const char *page_name(page_kind kind);
+bool parse_pages(const char *name, page_kind &kind);
+const char *numa_name(numa_kind kind);
+bool parse_numa(const char *name, numa_kind &kind);
@@ -0,0 +1,76 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Index layout: [0, 2 * half) maps 1:1 onto values, after which each power of
+// two contributes `half` buckets. The largest shift is reached for values with
+// bit 63 set, so the table never needs to grow.
+static constexpr size_t bucket_count(int bits) {
+  return static_cast<size_t>(64 - bits) * (1ULL << bits) + (1ULL << bits);
+}
+
+latency_histogram::latency_histogram()
+    : counts_(bucket_count(sub_bucket_bits), 0) {}
+
+size_t latency_histogram::index_of(uint64_t value) {
+  if (value < 2 * sub_bucket_half)
+    return static_cast<size_t>(value);
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - sub_bucket_bits;
+  return static_cast<size_t>(shift) * sub_bucket_half +
+         static_cast<size_t>(value >> shift);
+}
+
+uint64_t latency_histogram::highest_equivalent(size_t index) {
+  if (index < 2 * sub_bucket_half)
+    return index;
+  size_t shift = index / sub_bucket_half - 1;
+  uint64_t sub = index % sub_bucket_half + sub_bucket_half;
+  return (sub << shift) + ((1ULL << shift) - 1);
+}
+
+void latency_histogram::record(uint64_t value) {
+  ++counts_[index_of(value)];
+  ++total_;
+  sum_ += value;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+}
+
+void latency_histogram::merge(const latency_histogram &other) {
+  for (size_t i = 0; i < counts_.size(); ++i)
+    counts_[i] += other.counts_[i];
+  total_ += other.total_;
+  sum_ += other.sum_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+}
+
+void latency_histogram::reset() {
+  std::fill(counts_.begin(), counts_.end(), 0);
+  total_ = 0;
+  sum_ = 0;
+  min_ = UINT64_MAX;
+  max_ = 0;
+}
+
+double latency_histogram::mean() const {
+  return total_ ? static_cast<double>(sum_ / total_) : 0.0;
+}
+
+uint64_t latency_histogram::percentile(double p) const {
+  if (total_ == 0)
+    return 0;
+  p = std::min(std::max(p, 0.0), 100.0);
+  uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100.0 * total_));
+  rank = std::max<uint64_t>(rank, 1);
+
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts_.size(); ++i) {
+    seen += counts_[i];
+    if (seen >= rank)
+      return std::min(highest_equivalent(i), max_);
+  }
+  return max_;
+}
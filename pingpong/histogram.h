@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Log-linear latency histogram in the spirit of HdrHistogram.
+//
+// Values below 2 * sub_bucket_half are recorded exactly. Above that, every
+// power-of-two range is split into sub_bucket_half linear buckets, so the
+// relative error of any reported value is bounded by 1 / sub_bucket_half
+// (~1.6%). Recording is O(1) and allocation free, which keeps it out of the
+// way of the timed loop.
+class latency_histogram {
+public:
+  latency_histogram();
+
+  void record(uint64_t value);
+  void merge(const latency_histogram &other);
+  void reset();
+
+  uint64_t count() const { return total_; }
+  uint64_t min() const { return total_ ? min_ : 0; }
+  uint64_t max() const { return max_; }
+  double mean() const;
+
+  // Returns the highest value equivalent to the bucket that contains the
+  // requested percentile (0..100], clamped to the recorded maximum.
+  uint64_t percentile(double p) const;
+
+private:
+  static constexpr int sub_bucket_bits = 6;
+  static constexpr uint64_t sub_bucket_half = 1ULL << sub_bucket_bits;
+
+  static size_t index_of(uint64_t value);
+  static uint64_t highest_equivalent(size_t index);
+
+  std::vector<uint64_t> counts_;
+  uint64_t total_ = 0;
+  uint64_t min_ = UINT64_MAX;
+  uint64_t max_ = 0;
+  long double sum_ = 0;
+};
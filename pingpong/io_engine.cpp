@@ -0,0 +1,799 @@
+#include "io_engine.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/errqueue.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+bool io_engine::send_repeated(const char *buf, size_t len, int count) {
+  for (int i = 0; i < count; ++i)
+    if (!send_all(slot(buf, i), len))
+      return false;
+  return true;
+}
+
+bool io_engine::recv_repeated(char *buf, size_t len, int count) {
+  for (int i = 0; i < count; ++i)
+    if (!recv_all(slot(buf, i), len))
+      return false;
+  return true;
+}
+
+namespace {
+
+// Today's behaviour: blocking writes/reads until the whole buffer went
+// through. write()/read() rather than send()/recv() so that pipes work too;
+// on a socket they are the same call.
+class blocking_engine : public io_engine {
+public:
+  blocking_engine(int rfd, int wfd) : rfd_(rfd), wfd_(wfd) {}
+
+  bool send_all(const char *buf, size_t len) override {
+    while (len > 0) {
+      ssize_t n = write(wfd_, buf, len);
+      ++syscalls_;
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      buf += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  bool recv_all(char *buf, size_t len) override {
+    while (len > 0) {
+      ssize_t n = read(rfd_, buf, len);
+      ++syscalls_;
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n == 0)
+        errno = 0;
+      if (n <= 0)
+        return false;
+      buf += n;
+      len -= n;
+    }
+    return true;
+  }
+
+protected:
+  int rfd_;
+  int wfd_;
+};
+
+// send(MSG_ZEROCOPY): the kernel pins the user pages instead of copying and
+// reports when it is done with them on the socket error queue. Completions
+// are reaped opportunistically after every send and waited for once too
+// many are outstanding or the socket runs out of option memory (ENOBUFS).
+class zerocopy_engine : public blocking_engine {
+public:
+  zerocopy_engine(int rfd, int wfd) : blocking_engine(rfd, wfd) {
+    int one = 1;
+    if (setsockopt(wfd_, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+      std::cerr << "zerocopy: setsockopt(SO_ZEROCOPY) failed: "
+                << strerror(errno) << std::endl;
+      exit(1);
+    }
+  }
+
+  bool send_all(const char *buf, size_t len) override {
+    while (len > 0) {
+      ssize_t n = send(wfd_, buf, len, MSG_ZEROCOPY);
+      ++syscalls_;
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno == ENOBUFS && issued_ > completed_) {
+          if (!reap(true))
+            return false;
+          continue;
+        }
+        return false;
+      }
+      ++issued_;
+      buf += n;
+      len -= n;
+      if (!reap(issued_ - completed_ > max_outstanding))
+        return false;
+    }
+    return true;
+  }
+
+  bool send_repeated(const char *buf, size_t len, int count) override {
+    if (!io_engine::send_repeated(buf, len, count))
+      return false;
+    // The run only counts once the kernel let go of every page.
+    while (completed_ < issued_)
+      if (!reap(true))
+        return false;
+    return true;
+  }
+
+  void print_stats(std::ostream &os) const override {
+    os << ", zerocopy " << completed_ << " completions (" << copied_
+       << " fell back to copying)";
+  }
+
+private:
+  static constexpr uint64_t max_outstanding = 256;
+
+  // Drains the error queue. With block set, first waits for POLLERR.
+  bool reap(bool block) {
+    if (block) {
+      struct pollfd pfd = {wfd_, 0, 0};
+      while (poll(&pfd, 1, -1) < 0) {
+        if (errno != EINTR)
+          return false;
+      }
+      ++syscalls_;
+    }
+    for (;;) {
+      char control[128];
+      struct msghdr msg = {};
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      if (recvmsg(wfd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+        ++syscalls_;
+        return errno == EAGAIN || errno == EINTR;
+      }
+      ++syscalls_;
+      for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr;
+           cm = CMSG_NXTHDR(&msg, cm)) {
+        auto *ee = reinterpret_cast<struct sock_extended_err *>(CMSG_DATA(cm));
+        if (ee->ee_errno != 0 || ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+          continue;
+        // [ee_info, ee_data] is an inclusive range of send call ids.
+        uint64_t n = ee->ee_data - ee->ee_info + 1;
+        completed_ += n;
+        if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+          copied_ += n;
+      }
+    }
+  }
+
+  uint64_t issued_ = 0;
+  uint64_t completed_ = 0;
+  uint64_t copied_ = 0;
+};
+
+// vmsplice() maps the user pages into a pipe without copying, splice() then
+// moves them on to the socket (or pipe). The payload is never modified, so the pages
+// may stay referenced by the pipe or socket after the call returns.
+class splice_engine : public blocking_engine {
+public:
+  splice_engine(int rfd, int wfd, size_t buf_len)
+      : blocking_engine(rfd, wfd) {
+    if (pipe2(pipe_, O_CLOEXEC) < 0) {
+      std::cerr << "splice: pipe2 failed: " << strerror(errno) << std::endl;
+      exit(1);
+    }
+    // Best effort: a bigger pipe means fewer vmsplice/splice rounds. The
+    // limit is fs.pipe-max-size for unprivileged users.
+    fcntl(pipe_[1], F_SETPIPE_SZ, static_cast<int>(std::min<size_t>(
+                                      buf_len, 1 << 20)));
+    pipe_size_ = fcntl(pipe_[1], F_GETPIPE_SZ);
+    if (pipe_size_ <= 0)
+      pipe_size_ = 65536;
+  }
+
+  ~splice_engine() override {
+    close(pipe_[0]);
+    close(pipe_[1]);
+  }
+
+  bool send_all(const char *buf, size_t len) override {
+    while (len > 0) {
+      struct iovec iov = {const_cast<char *>(buf),
+                          std::min(len, static_cast<size_t>(pipe_size_))};
+      ssize_t n = vmsplice(pipe_[1], &iov, 1, 0);
+      ++syscalls_;
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      for (ssize_t left = n; left > 0;) {
+        ssize_t m = splice(pipe_[0], nullptr, wfd_, nullptr, left,
+                           SPLICE_F_MOVE | (len > static_cast<size_t>(n)
+                                                ? SPLICE_F_MORE
+                                                : 0));
+        ++syscalls_;
+        if (m < 0) {
+          if (errno == EINTR)
+            continue;
+          return false;
+        }
+        left -= m;
+      }
+      buf += n;
+      len -= n;
+    }
+    return true;
+  }
+
+private:
+  int pipe_[2];
+  int pipe_size_;
+};
+
+// sendfile() from a memfd (tmpfs) that holds a copy of the payload, so the
+// kernel sends page cache pages instead of copying from user memory.
+class sendfile_engine : public blocking_engine {
+public:
+  sendfile_engine(int rfd, int wfd, const char *buf, size_t buf_len)
+      : blocking_engine(rfd, wfd), file_len_(buf_len) {
+    memfd_ = memfd_create("pingpong-tx", MFD_CLOEXEC);
+    if (memfd_ < 0) {
+      std::cerr << "sendfile: memfd_create failed: " << strerror(errno)
+                << std::endl;
+      exit(1);
+    }
+    size_t done = 0;
+    while (done < buf_len) {
+      ssize_t n = pwrite(memfd_, buf + done, buf_len - done, done);
+      if (n <= 0) {
+        std::cerr << "sendfile: Cannot fill memfd: " << strerror(errno)
+                  << std::endl;
+        exit(1);
+      }
+      done += n;
+    }
+  }
+
+  ~sendfile_engine() override { close(memfd_); }
+
+  // buf only provides the length; the bytes come from the memfd, which holds
+  // the same payload.
+  bool send_all(const char *, size_t len) override {
+    off_t off = 0;
+    len = std::min(len, file_len_);
+    while (len > 0) {
+      ssize_t n = sendfile(wfd_, memfd_, &off, len);
+      ++syscalls_;
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      len -= n;
+    }
+    return true;
+  }
+
+private:
+  int memfd_;
+  size_t file_len_;
+};
+
+// Non-blocking fds registered edge-triggered, the read side for EPOLLIN and
+// the write side for EPOLLOUT (one registration when both are the same
+// socket). Every transfer tries the syscall first and only sleeps in
+// epoll_wait after EAGAIN, so edges consumed while waiting for the other
+// direction are harmless.
+class epoll_engine : public io_engine {
+public:
+  epoll_engine(int rfd, int wfd) : rfd_(rfd), wfd_(wfd) {
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd_ < 0) {
+      std::cerr << "epoll: epoll_create1 failed: " << strerror(errno)
+                << std::endl;
+      exit(1);
+    }
+    if (rfd_ == wfd_) {
+      add(rfd_, EPOLLIN | EPOLLOUT);
+    } else {
+      add(rfd_, EPOLLIN);
+      add(wfd_, EPOLLOUT);
+    }
+  }
+
+  ~epoll_engine() override { close(epfd_); }
+
+  bool send_all(const char *buf, size_t len) override {
+    while (len > 0) {
+      ssize_t n = write(wfd_, buf, len);
+      ++syscalls_;
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN && wait_for(EPOLLOUT))
+          continue;
+        return false;
+      }
+      buf += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  bool recv_all(char *buf, size_t len) override {
+    while (len > 0) {
+      ssize_t n = read(rfd_, buf, len);
+      ++syscalls_;
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN && wait_for(EPOLLIN))
+          continue;
+        return false;
+      }
+      if (n == 0) {
+        errno = 0;
+        return false;
+      }
+      buf += n;
+      len -= n;
+    }
+    return true;
+  }
+
+private:
+  void add(int fd, uint32_t events) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+      std::cerr << "epoll: Cannot make fd non-blocking: " << strerror(errno)
+                << std::endl;
+      exit(1);
+    }
+    struct epoll_event ev = {};
+    ev.events = events | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) {
+      std::cerr << "epoll: epoll_ctl failed: " << strerror(errno)
+                << std::endl;
+      exit(1);
+    }
+  }
+
+  bool wait_for(uint32_t mask) {
+    for (;;) {
+      struct epoll_event ev;
+      int n = epoll_wait(epfd_, &ev, 1, -1);
+      ++syscalls_;
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      if (n == 1 && (ev.events & (mask | EPOLLERR | EPOLLHUP)))
+        return true;
+    }
+  }
+
+  int rfd_;
+  int wfd_;
+  int epfd_;
+};
+
+// Minimal raw-syscall io_uring, enough for a pipeline of socket transfers.
+//
+// Messages of the repeated transfers are kept uring_depth deep in flight and
+// submitted together with the wait for the first completion, so one
+// io_uring_enter covers a whole batch. Short completions are re-queued, so
+// the byte count stays exact even though messages may overlap.
+class uring_engine : public io_engine {
+public:
+  uring_engine(const engine_options &opts, int rfd, int wfd, char *buf,
+               size_t buf_len)
+      : opts_(opts), rfd_(rfd), wfd_(wfd),
+        sockets_(is_socket(rfd) && is_socket(wfd)) {
+    if (opts_.uring_multishot && !is_socket(rfd_)) {
+      std::cerr << "io_uring: Multishot receive needs a socket" << std::endl;
+      exit(1);
+    }
+    setup_ring(std::max(opts.uring_depth, 4u));
+    if (opts_.uring_fixed_buffers) {
+      struct iovec iov = {buf, buf_len};
+      if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS,
+                  &iov, 1) < 0) {
+        std::cerr << "io_uring: Buffer registration failed: "
+                  << strerror(errno) << std::endl;
+        exit(1);
+      }
+    }
+    if (opts_.uring_multishot)
+      setup_buffer_ring(buf_len);
+  }
+
+  ~uring_engine() override {
+    if (pbuf_ring_ != nullptr) {
+      munmap(pbuf_ring_, pbuf_ring_bytes_);
+      munmap(pbuf_mem_, pbuf_mem_bytes_);
+    }
+    munmap(sqes_, sqes_bytes_);
+    if (cq_ptr_ != sq_ptr_)
+      munmap(cq_ptr_, cq_bytes_);
+    munmap(sq_ptr_, sq_bytes_);
+    close(ring_fd_);
+  }
+
+  bool send_all(const char *buf, size_t len) override {
+    return transfer(true, const_cast<char *>(buf), len, 1);
+  }
+
+  bool recv_all(char *buf, size_t len) override {
+    if (opts_.uring_multishot)
+      return recv_multishot(len);
+    return transfer(false, buf, len, 1);
+  }
+
+  bool send_repeated(const char *buf, size_t len, int count) override {
+    return transfer(true, const_cast<char *>(buf), len, count);
+  }
+
+  bool recv_repeated(char *buf, size_t len, int count) override {
+    if (opts_.uring_multishot)
+      return recv_multishot(static_cast<uint64_t>(len) * count);
+    return transfer(false, buf, len, count);
+  }
+
+private:
+  static constexpr uint64_t multishot_tag = ~0ULL;
+  static constexpr unsigned pbuf_entries = 32;
+
+  static bool is_socket(int fd) {
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+  }
+
+  void *map_ring(size_t len, off_t offset) {
+    void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+    if (p == MAP_FAILED) {
+      std::cerr << "io_uring: Ring mmap failed: " << strerror(errno)
+                << std::endl;
+      exit(1);
+    }
+    return p;
+  }
+
+  void setup_ring(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring_fd_ = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring_fd_ < 0) {
+      std::cerr << "io_uring: io_uring_setup failed: " << strerror(errno)
+                << std::endl;
+      exit(1);
+    }
+
+    sq_bytes_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_bytes_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+      sq_bytes_ = cq_bytes_ = std::max(sq_bytes_, cq_bytes_);
+      sq_ptr_ = cq_ptr_ = map_ring(sq_bytes_, IORING_OFF_SQ_RING);
+    } else {
+      sq_ptr_ = map_ring(sq_bytes_, IORING_OFF_SQ_RING);
+      cq_ptr_ = map_ring(cq_bytes_, IORING_OFF_CQ_RING);
+    }
+    sqes_bytes_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = static_cast<struct io_uring_sqe *>(
+        map_ring(sqes_bytes_, IORING_OFF_SQES));
+
+    char *sq = static_cast<char *>(sq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    char *cq = static_cast<char *>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe *>(cq + p.cq_off.cqes);
+    sq_entries_ = p.sq_entries;
+    local_tail_ = *sq_tail_;
+  }
+
+  // Provided buffer ring for multishot recv. The payload lands in these
+  // buffers and is only counted, like every other receive path here.
+  void setup_buffer_ring(size_t buf_len) {
+    pbuf_size_ = std::min<size_t>(std::max<size_t>(buf_len, 4096),
+                                  uring_multishot_buffer_max);
+    pbuf_mem_bytes_ = pbuf_size_ * pbuf_entries;
+    pbuf_ring_bytes_ = pbuf_entries * sizeof(struct io_uring_buf);
+    pbuf_mem_ = static_cast<char *>(mmap(nullptr, pbuf_mem_bytes_,
+                                         PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    void *ring = mmap(nullptr, pbuf_ring_bytes_, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (pbuf_mem_ == MAP_FAILED || ring == MAP_FAILED) {
+      std::cerr << "io_uring: Provided buffer mmap failed: "
+                << strerror(errno) << std::endl;
+      exit(1);
+    }
+    pbuf_ring_ = static_cast<struct io_uring_buf_ring *>(ring);
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(pbuf_ring_);
+    reg.ring_entries = pbuf_entries;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_PBUF_RING,
+                &reg, 1) < 0) {
+      std::cerr << "io_uring: Buffer ring registration failed: "
+                << strerror(errno) << std::endl;
+      exit(1);
+    }
+    for (unsigned bid = 0; bid < pbuf_entries; ++bid)
+      recycle(bid);
+  }
+
+  void recycle(unsigned bid) {
+    // The uapi flex array is not at offset 0 when compiled as C++, so index
+    // the ring as a plain io_uring_buf array; the tail overlays bufs[0].resv.
+    struct io_uring_buf *bufs =
+        reinterpret_cast<struct io_uring_buf *>(pbuf_ring_);
+    struct io_uring_buf *b = &bufs[pbuf_tail_ & (pbuf_entries - 1)];
+    b->addr = reinterpret_cast<uint64_t>(pbuf_mem_ + bid * pbuf_size_);
+    b->len = pbuf_size_;
+    b->bid = bid;
+    ++pbuf_tail_;
+    __atomic_store_n(&pbuf_ring_->tail, pbuf_tail_, __ATOMIC_RELEASE);
+  }
+
+  struct io_uring_sqe *get_sqe() {
+    unsigned idx = local_tail_ & sq_mask_;
+    struct io_uring_sqe *sqe = &sqes_[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[idx] = idx;
+    ++local_tail_;
+    return sqe;
+  }
+
+  // Publishes pending SQEs and waits for at least wait_nr completions.
+  bool submit_and_wait(unsigned wait_nr) {
+    __atomic_store_n(sq_tail_, local_tail_, __ATOMIC_RELEASE);
+    for (;;) {
+      unsigned to_submit =
+          local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+      unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+      long ret = syscall(__NR_io_uring_enter, ring_fd_, to_submit, wait_nr,
+                         flags, nullptr, 0);
+      ++syscalls_;
+      if (ret >= 0)
+        return true;
+      if (errno != EINTR)
+        return false;
+    }
+  }
+
+  bool cq_empty() const {
+    return *cq_head_ == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  }
+
+  template <typename F> void reap(F &&on_cqe) {
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head)
+      on_cqe(cqes_[head & cq_mask_]);
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+  }
+
+  void prep(struct io_uring_sqe *sqe, bool is_send, char *p, uint32_t n) {
+    sqe->fd = is_send ? wfd_ : rfd_;
+    sqe->addr = reinterpret_cast<uint64_t>(p);
+    sqe->len = n;
+    sqe->user_data = n;
+    if (opts_.uring_fixed_buffers) {
+      sqe->opcode = is_send ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+      sqe->off = static_cast<uint64_t>(-1);
+      sqe->buf_index = 0;
+    } else if (sockets_) {
+      sqe->opcode = is_send ? IORING_OP_SEND : IORING_OP_RECV;
+      sqe->msg_flags = MSG_WAITALL;
+    } else {
+      sqe->opcode = is_send ? IORING_OP_WRITE : IORING_OP_READ;
+      sqe->off = static_cast<uint64_t>(-1);
+    }
+  }
+
+  // Moves count * len bytes. Message i goes to/from slot(buf, i), which
+  // is buf itself unless set_rotation spread the messages over several
+  // buffers; within a message the requests cover consecutive offsets.
+  bool transfer(bool is_send, char *buf, size_t len, int count) {
+    uint64_t total = static_cast<uint64_t>(len) * count;
+    uint64_t issued = 0, done = 0;
+    unsigned inflight = 0;
+    unsigned depth = std::min(opts_.uring_depth, sq_entries_);
+    int error = 0;
+    bool failed = false;
+
+    while ((done < total && !failed) || inflight > 0) {
+      while (!failed && inflight < depth && issued < total) {
+        // Requests never span two messages, so each one stays inside the
+        // slot of its message.
+        uint64_t off = issued % len;
+        uint64_t n = std::min<uint64_t>(len - off, total - issued);
+        char *p = slot(buf, issued / len) + off;
+        prep(get_sqe(), is_send, p, static_cast<uint32_t>(n));
+        issued += n;
+        ++inflight;
+      }
+      if (!submit_and_wait(1)) {
+        error = errno;
+        break;
+      }
+      reap([&](const struct io_uring_cqe &cqe) {
+        if (cqe.user_data == multishot_tag) {
+          on_multishot_cqe(cqe);
+          return;
+        }
+        --inflight;
+        uint64_t asked = cqe.user_data;
+        if (cqe.res < 0 && (cqe.res == -EINTR || cqe.res == -EAGAIN)) {
+          issued -= asked;
+        } else if (cqe.res < 0) {
+          failed = true;
+          error = -cqe.res;
+        } else if (cqe.res == 0 && !is_send) {
+          failed = true;
+          error = 0;
+        } else {
+          done += cqe.res;
+          issued -= asked - cqe.res;
+        }
+      });
+    }
+    errno = error;
+    return !failed && done == total;
+  }
+
+  void arm_multishot() {
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = rfd_;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = multishot_tag;
+    armed_ = true;
+  }
+
+  // Accounts one completion of the multishot receive. It may be reaped while
+  // waiting for a send, so bytes are banked until recv_multishot asks.
+  void on_multishot_cqe(const struct io_uring_cqe &cqe) {
+    if (!(cqe.flags & IORING_CQE_F_MORE))
+      armed_ = false;
+    if (cqe.flags & IORING_CQE_F_BUFFER)
+      recycle(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    if (cqe.res == -ENOBUFS)
+      return; // ran dry before we recycled, just re-arm
+    if (cqe.res <= 0) {
+      closed_ = true;
+      close_error_ = -cqe.res;
+      return;
+    }
+    ms_bytes_ += cqe.res;
+  }
+
+  // Consumes total bytes from the multishot receive. Whatever arrived past
+  // total stays banked for the next call.
+  bool recv_multishot(uint64_t total) {
+    while (ms_bytes_ < total && !closed_) {
+      if (!armed_)
+        arm_multishot();
+      if (cq_empty() && !submit_and_wait(1))
+        return false;
+      reap([&](const struct io_uring_cqe &cqe) { on_multishot_cqe(cqe); });
+    }
+    if (ms_bytes_ < total) {
+      errno = close_error_;
+      return false;
+    }
+    ms_bytes_ -= total;
+    return true;
+  }
+
+  engine_options opts_;
+  int rfd_;
+  int wfd_;
+  bool sockets_; // SEND/RECV opcodes, READ/WRITE otherwise
+  int ring_fd_ = -1;
+
+  void *sq_ptr_ = nullptr, *cq_ptr_ = nullptr;
+  size_t sq_bytes_ = 0, cq_bytes_ = 0, sqes_bytes_ = 0;
+  unsigned *sq_head_, *sq_tail_, *sq_array_, *cq_head_, *cq_tail_;
+  unsigned sq_mask_, cq_mask_, sq_entries_;
+  unsigned local_tail_ = 0;
+  struct io_uring_sqe *sqes_ = nullptr;
+  struct io_uring_cqe *cqes_ = nullptr;
+
+  struct io_uring_buf_ring *pbuf_ring_ = nullptr;
+  char *pbuf_mem_ = nullptr;
+  size_t pbuf_size_ = 0, pbuf_mem_bytes_ = 0, pbuf_ring_bytes_ = 0;
+  uint16_t pbuf_tail_ = 0;
+  bool armed_ = false;
+  bool closed_ = false;
+  int close_error_ = 0;
+  uint64_t ms_bytes_ = 0;
+};
+
+} // namespace
+
+std::unique_ptr<io_engine> make_engine(const engine_options &opts, int rfd,
+                                       int wfd, char *buf, size_t buf_len) {
+  switch (opts.kind) {
+  case engine_kind::epoll:
+    return std::unique_ptr<io_engine>(new epoll_engine(rfd, wfd));
+  case engine_kind::io_uring:
+    return std::unique_ptr<io_engine>(
+        new uring_engine(opts, rfd, wfd, buf, buf_len));
+  case engine_kind::blocking:
+  default:
+    break;
+  }
+  switch (opts.tx) {
+  case tx_kind::zerocopy:
+    return std::unique_ptr<io_engine>(new zerocopy_engine(rfd, wfd));
+  case tx_kind::splice:
+    return std::unique_ptr<io_engine>(new splice_engine(rfd, wfd, buf_len));
+  case tx_kind::sendfile:
+    return std::unique_ptr<io_engine>(new sendfile_engine(rfd, wfd, buf, buf_len));
+  case tx_kind::copy:
+  default:
+    return std::unique_ptr<io_engine>(new blocking_engine(rfd, wfd));
+  }
+}
+
+const char *engine_name(engine_kind kind) {
+  switch (kind) {
+  case engine_kind::epoll:
+    return "epoll";
+  case engine_kind::io_uring:
+    return "io_uring";
+  case engine_kind::blocking:
+  default:
+    return "blocking";
+  }
+}
+
+bool parse_engine(const char *name, engine_kind &kind) {
+  for (engine_kind k :
+       {engine_kind::blocking, engine_kind::epoll, engine_kind::io_uring}) {
+    if (strcmp(name, engine_name(k)) == 0) {
+      kind = k;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *tx_name(tx_kind kind) {
+  switch (kind) {
+  case tx_kind::zerocopy:
+    return "zerocopy";
+  case tx_kind::splice:
+    return "splice";
+  case tx_kind::sendfile:
+    return "sendfile";
+  case tx_kind::copy:
+  default:
+    return "copy";
+  }
+}
+
+bool parse_tx(const char *name, tx_kind &kind) {
+  for (tx_kind k : {tx_kind::copy, tx_kind::zerocopy, tx_kind::splice,
+                    tx_kind::sendfile}) {
+    if (strcmp(name, tx_name(k)) == 0) {
+      kind = k;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+
+enum class engine_kind {
+  blocking, // blocking send/recv, one thread per socket
+  epoll,    // non-blocking socket, edge-triggered epoll wakeups
+  io_uring, // batched io_uring submissions
+};
+
+// How the blocking engine hands outgoing bytes to the kernel.
+enum class tx_kind {
+  copy,     // send() copies from the user buffer
+  zerocopy, // send(MSG_ZEROCOPY), completions reaped from the error queue
+  splice,   // vmsplice() the user pages into a pipe, splice() to the socket
+  sendfile, // sendfile() from a memfd holding the payload
+};
+
+struct engine_options {
+  engine_kind kind = engine_kind::blocking;
+  tx_kind tx = tx_kind::copy;
+  unsigned uring_depth = 8;         // requests kept in flight per batch
+  bool uring_fixed_buffers = false; // READ_FIXED/WRITE_FIXED on a
+                                    // registered buffer
+  bool uring_multishot = false;     // multishot recv into a provided
+                                    // buffer ring
+};
+
+// Largest provided buffer of the multishot receive. Each completion fills
+// at most one, so seqpacket records above this size would be truncated.
+constexpr size_t uring_multishot_buffer_max = 64 * 1024;
+
+// Moves bytes over one connection. All transfers follow the contract
+// of the original blocking helpers: true once every byte went through, false
+// on error (errno set) or orderly shutdown by the peer (errno == 0).
+class io_engine {
+public:
+  virtual ~io_engine() = default;
+
+  virtual bool send_all(const char *buf, size_t len) = 0;
+  virtual bool recv_all(char *buf, size_t len) = 0;
+
+  // Transfers count messages of len bytes, all from/into buf unless a
+  // rotation is set. Only the byte count matters, so engines that can batch
+  // are free to overlap messages.
+  virtual bool send_repeated(const char *buf, size_t len, int count);
+  virtual bool recv_repeated(char *buf, size_t len, int count);
+
+  // Makes the repeated transfers rotate over slots buffers stride bytes
+  // apart: message i goes through buf + (i % slots) * stride.
+  void set_rotation(size_t stride, int slots) {
+    stride_ = stride;
+    slots_ = slots > 0 ? slots : 1;
+  }
+
+  // System calls issued by this engine so far, to compare per-byte costs.
+  uint64_t syscalls() const { return syscalls_; }
+
+  // Appends engine specific counters to a result line.
+  virtual void print_stats(std::ostream &) const {}
+
+protected:
+  char *slot(const char *buf, uint64_t i) const {
+    return const_cast<char *>(buf) + (i % slots_) * stride_;
+  }
+
+  uint64_t syscalls_ = 0;
+  size_t stride_ = 0;
+  int slots_ = 1;
+};
+
+// Creates an engine that reads from rfd and writes to wfd, the same socket
+// for connected sockets or the two ends of a pipe pair. buf/buf_len is the
+// region the caller will transfer from and into; io_uring registers it when
+// fixed buffers are requested. Exits with a message if the engine can't be
+// set up.
+std::unique_ptr<io_engine> make_engine(const engine_options &opts, int rfd,
+                                       int wfd, char *buf, size_t buf_len);
+
+const char *engine_name(engine_kind kind);
+bool parse_engine(const char *name, engine_kind &kind);
+const char *tx_name(tx_kind kind);
+bool parse_tx(const char *name, tx_kind &kind);
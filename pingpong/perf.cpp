@@ -0,0 +1,111 @@
+#include "perf.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <mutex>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+struct perf_event_spec {
+  uint32_t type;
+  uint64_t config;
+  const char *name;
+};
+
+// Indexed by perf_metric.
+const perf_event_spec specs[perf_metric_count] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock"},
+};
+
+std::once_flag warned;
+
+// One counter per metric rather than a group, so that whatever the kernel
+// allows is still counted when some event is refused. User and kernel time
+// are both counted; the transfers under test are mostly syscalls.
+class thread_counters {
+public:
+  thread_counters() {
+    for (int i = 0; i < perf_metric_count; ++i) {
+      struct perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = specs[i].type;
+      attr.config = specs[i].config;
+      attr.read_format =
+          PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      attr.exclude_hv = 1;
+      fd_[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1,
+                       PERF_FLAG_FD_CLOEXEC);
+      if (fd_[i] < 0) {
+        int err = errno;
+        std::call_once(warned, [&] {
+          std::cerr << "perf_event_open(" << specs[i].name
+                    << ") failed: " << strerror(err)
+                    << "; reporting getrusage figures where counters are "
+                       "missing"
+                    << std::endl;
+        });
+      }
+    }
+  }
+
+  ~thread_counters() {
+    for (int fd : fd_)
+      if (fd >= 0)
+        close(fd);
+  }
+
+  perf_values read_all() const {
+    perf_values v;
+    for (int i = 0; i < perf_metric_count; ++i) {
+      uint64_t buf[3]; // value, time enabled, time running
+      if (fd_[i] < 0 || read(fd_[i], buf, sizeof(buf)) != sizeof(buf))
+        continue;
+      // Scale up if the PMU was multiplexed between events.
+      if (buf[2] > 0 && buf[2] < buf[1])
+        buf[0] = static_cast<uint64_t>(static_cast<double>(buf[0]) * buf[1] /
+                                       buf[2]);
+      v.value[i] = buf[0];
+      v.valid[i] = buf[2] > 0; // 0 if it never got a PMU slot
+    }
+    return v;
+  }
+
+private:
+  int fd_[perf_metric_count];
+};
+
+} // namespace
+
+perf_values operator-(const perf_values &after, const perf_values &before) {
+  perf_values d;
+  for (int i = 0; i < perf_metric_count; ++i) {
+    d.valid[i] = after.valid[i] && before.valid[i];
+    d.value[i] = d.valid[i] ? after.value[i] - before.value[i] : 0;
+  }
+  return d;
+}
+
+perf_values &operator+=(perf_values &a, const perf_values &b) {
+  bool a_empty = true;
+  for (int i = 0; i < perf_metric_count; ++i)
+    a_empty = a_empty && !a.valid[i] && a.value[i] == 0;
+  for (int i = 0; i < perf_metric_count; ++i) {
+    a.valid[i] = b.valid[i] && (a.valid[i] || a_empty);
+    a.value[i] = a.valid[i] ? a.value[i] + b.value[i] : 0;
+  }
+  return a;
+}
+
+perf_values thread_perf_now() {
+  static thread_local thread_counters counters;
+  return counters.read_all();
+}
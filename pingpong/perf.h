@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+
+enum class perf_metric {
+  cycles,
+  instructions,
+  cache_misses,
+  context_switches,
+  task_clock, // ns on the CPU
+};
+constexpr int perf_metric_count = 5;
+
+// One reading of the calling thread's counters. A metric is invalid when the
+// kernel refused to count it: no PMU in a VM, perf_event_paranoid, seccomp.
+struct perf_values {
+  uint64_t value[perf_metric_count] = {};
+  bool valid[perf_metric_count] = {};
+
+  uint64_t get(perf_metric m) const { return value[static_cast<int>(m)]; }
+  bool has(perf_metric m) const { return valid[static_cast<int>(m)]; }
+};
+
+// Difference of two readings; valid where both were.
+perf_values operator-(const perf_values &after, const perf_values &before);
+// Sum over threads; valid where both were, or where b was if a is still
+// default constructed.
+perf_values &operator+=(perf_values &a, const perf_values &b);
+
+// Counters of the calling thread. They are opened on the first call from each
+// thread, so take a reading before the part to be measured. The first
+// failure to open a counter is reported once on stderr.
+perf_values thread_perf_now();
@@ -1,36 +1,737 @@
+#include "buffer.h"
+#include "histogram.h"
+#include "io_engine.h"
+#include "perf.h"
+#include "report.h"
+#include "sockopt.h"
+#include "transport.h"
+
+#include <algorithm>
 #include <arpa/inet.h>
 #include <cerrno>
 #include <chrono>
+#include <cmath>
 #include <condition_variable>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <functional>
 #include <getopt.h>
 #include <iostream>
 #include <mutex>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
+#include <string>
 #include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <thread>
 #include <unistd.h>
+#include <vector>
 
 std::mutex mtx;
 std::condition_variable cv;
 bool server_ready = false;
 std::mutex cout_mutex;
 
-void server_thread(int port, int buffer_size, int num_iter, bool use_ipv6) {
-  int sock, conn;
-  struct sockaddr_in serv_addr4, cli_addr4;
-  struct sockaddr_in6 serv_addr6, cli_addr6;
+enum class bench_mode {
+  stream, // server streams buffers one way, client drains them
+  rr,     // client sends a request and waits for the reply each iteration
+};
+
+struct bench_config {
+  int port = 50007;
+  int buffer_size = 4096; // stream buffer / request size
+  int reply_size = 0;     // rr reply size, 0 means same as the request
+  int num_iter = 1000;
+  int warmup = 0;      // untimed iterations run before the measured ones
+  int connections = 1; // concurrent connections, one thread per side each
+  bool use_ipv6 = true;
+  transport_options transport;
+  socket_options sock;
+  buffer_options buffers; // placement of every thread's message buffers
+  bench_mode mode = bench_mode::stream;
+  engine_options engine;
+  // Connection i runs on server_cpus[i % size] and client_cpus[i % size].
+  std::vector<int> server_cpus{0};
+  std::vector<int> client_cpus{2};
+  // Message sizes measured in turn; {buffer_size} unless sweeping.
+  std::vector<int> sizes;
+  uint64_t sweep_bytes = 0; // if set, per-size byte budget instead of num_iter
+  bool reconnect = false;   // fresh connections and threads for every size
+  output_format format = output_format::text;
+  // Open loop rr: requests per second over all connections, 0 waits for
+  // every reply before sending the next request.
+  uint64_t rate = 0;
+  bool spin_pacing = false; // busy-wait for send times, not clock_nanosleep
+  bool quiet = false;       // no per-thread result lines
+  bool sock_labels = false; // socket options are record columns
+};
+
+// CPU time and context switches of the calling thread, to compare engines
+// and transmit paths, plus hardware counters where the kernel allows.
+struct thread_usage {
+  uint64_t user_ns = 0;
+  uint64_t sys_ns = 0;
+  long voluntary = 0;
+  long involuntary = 0;
+  perf_values perf;
+};
+
+// What one connection measured. Stream numbers come from the receiving side,
+// rr numbers from the requesting side. The server's CPU cost is kept along
+// with its own byte and message counts, which include rr warmup.
+struct conn_result {
+  uint64_t bytes = 0;
+  uint64_t messages = 0;
+  uint64_t start_ns = 0;
+  uint64_t end_ns = 0;
+  latency_histogram hist;
+  thread_usage client_used;
+  thread_usage server_used;
+  uint64_t server_bytes = 0;
+  uint64_t server_messages = 0;
+};
 
+// Reusable barrier that lines up every server and client worker before the
+// timed loops, so that the aggregate throughput covers a common interval.
+class start_barrier {
+public:
+  explicit start_barrier(int parties) : parties_(parties) {}
+
+  void wait() {
+    std::unique_lock<std::mutex> lk(mtx_);
+    unsigned gen = generation_;
+    if (++arrived_ == parties_) {
+      arrived_ = 0;
+      ++generation_;
+      cv_.notify_all();
+      return;
+    }
+    cv_.wait(lk, [&] { return gen != generation_; });
+  }
+
+private:
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  int parties_;
+  int arrived_ = 0;
+  unsigned generation_ = 0;
+};
+
+static inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+static double gbit_per_sec(uint64_t bytes, uint64_t ns) {
+  return ns ? bytes * 8.0 / ns : 0.0;
+}
+
+static uint64_t timeval_ns(const struct timeval &tv) {
+  return static_cast<uint64_t>(tv.tv_sec) * 1000000000ULL +
+         static_cast<uint64_t>(tv.tv_usec) * 1000ULL;
+}
+
+static thread_usage thread_usage_now() {
+  struct rusage ru;
+  getrusage(RUSAGE_THREAD, &ru);
+  thread_usage u;
+  u.user_ns = timeval_ns(ru.ru_utime);
+  u.sys_ns = timeval_ns(ru.ru_stime);
+  u.voluntary = ru.ru_nvcsw;
+  u.involuntary = ru.ru_nivcsw;
+  u.perf = thread_perf_now();
+  return u;
+}
+
+// Usage of the calling thread since the reading before.
+static thread_usage usage_since(const thread_usage &before) {
+  thread_usage now = thread_usage_now();
+  thread_usage d;
+  d.user_ns = now.user_ns - before.user_ns;
+  d.sys_ns = now.sys_ns - before.sys_ns;
+  d.voluntary = now.voluntary - before.voluntary;
+  d.involuntary = now.involuntary - before.involuntary;
+  d.perf = now.perf - before.perf;
+  return d;
+}
+
+static void add_usage(thread_usage &sum, const thread_usage &u) {
+  sum.user_ns += u.user_ns;
+  sum.sys_ns += u.sys_ns;
+  sum.voluntary += u.voluntary;
+  sum.involuntary += u.involuntary;
+  sum.perf += u.perf;
+}
+
+// Appends the counters normalized per byte and per message. Metrics the
+// kernel would not count are left out; the getrusage figures before them
+// still cover CPU time and context switches.
+static void print_perf(const perf_values &perf, uint64_t bytes,
+                       uint64_t messages) {
+  if (bytes == 0 || messages == 0)
+    return;
+  const char *sep = ", perf: ";
+  double cycles = perf.get(perf_metric::cycles);
+  if (perf.has(perf_metric::cycles)) {
+    std::cout << sep << cycles / bytes << " cycles/B, " << cycles / messages
+              << " cycles/msg";
+    sep = ", ";
+  }
+  if (perf.has(perf_metric::instructions)) {
+    double instructions = perf.get(perf_metric::instructions);
+    std::cout << sep << instructions / messages << " instructions/msg";
+    if (perf.has(perf_metric::cycles) && cycles > 0)
+      std::cout << " (IPC " << instructions / cycles << ")";
+    sep = ", ";
+  }
+  if (perf.has(perf_metric::cache_misses)) {
+    std::cout << sep
+              << static_cast<double>(perf.get(perf_metric::cache_misses)) /
+                     messages
+              << " cache-misses/msg";
+    sep = ", ";
+  }
+  if (perf.has(perf_metric::context_switches)) {
+    std::cout << sep
+              << static_cast<double>(perf.get(perf_metric::context_switches)) /
+                     messages
+              << " ctx switches/msg";
+    sep = ", ";
+  }
+  if (perf.has(perf_metric::task_clock))
+    std::cout << sep
+              << static_cast<double>(perf.get(perf_metric::task_clock)) /
+                     messages
+              << " ns task-clock/msg";
+}
+
+// Appends the syscall, context-switch and CPU cost of a timed loop to a
+// result line. CPU time is normalized to milliseconds per GB moved.
+static void print_io_cost(const io_engine &io, uint64_t syscalls_before,
+                          const thread_usage &used, uint64_t bytes,
+                          uint64_t messages) {
+  uint64_t syscalls = io.syscalls() - syscalls_before;
+  double gb = bytes / 1e9;
+  double user_ms = used.user_ns / 1e6;
+  double sys_ms = used.sys_ns / 1e6;
+  std::cout << ", " << syscalls << " syscalls ("
+            << (syscalls ? bytes / syscalls : 0) << " bytes/syscall), "
+            << used.voluntary << "+" << used.involuntary << " ctx switches, "
+            << "cpu " << (gb > 0 ? (user_ms + sys_ms) / gb : 0.0)
+            << " ms/GB (user " << user_ms << " ms, sys " << sys_ms << " ms)";
+  print_perf(used.perf, bytes, messages);
+  io.print_stats(std::cout);
+}
+
+static void pin_to_cpu(int cpu, const std::string &who) {
   cpu_set_t cpuset;
   CPU_ZERO(&cpuset);
-  CPU_SET(0, &cpuset);
-  pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+  CPU_SET(cpu, &cpuset);
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+  if (err != 0) {
+    std::unique_lock<std::mutex> lk(cout_mutex);
+    std::cerr << who << ": Cannot pin to CPU " << cpu << ": " << strerror(err)
+              << std::endl;
+  }
+}
+
+// "Server"/"Client" for a single connection, "Server[3]" etc. otherwise, so
+// the default output stays unchanged.
+static std::string role_name(const char *role, int idx,
+                             const bench_config &cfg) {
+  if (cfg.connections == 1)
+    return role;
+  return std::string(role) + "[" + std::to_string(idx) + "]";
+}
+
+static int reply_size_of(const bench_config &cfg, int request_size) {
+  return cfg.reply_size > 0 ? cfg.reply_size : request_size;
+}
+
+// The transmit path under test is a server property; clients always send
+// with plain copies so that only one side changes between runs.
+static engine_options client_engine(const bench_config &cfg) {
+  engine_options opts = cfg.engine;
+  opts.tx = tx_kind::copy;
+  return opts;
+}
+
+// Creates the engine moving the messages of pool, rotating over its slots
+// in the repeated transfers. The whole pool is the registered region.
+static std::unique_ptr<io_engine> engine_for(const engine_options &opts,
+                                             const endpoint &ep,
+                                             buffer_pool &pool) {
+  auto io = make_engine(opts, ep, pool.base(), pool.bytes());
+  io->set_rotation(pool.stride(), pool.slots());
+  return io;
+}
+
+// Timed messages per connection for one message size. With a byte budget
+// every size moves roughly the same amount of data.
+static int iterations_for(const bench_config &cfg, int size) {
+  if (cfg.sweep_bytes == 0)
+    return cfg.num_iter;
+  uint64_t per_iter = size;
+  if (cfg.mode == bench_mode::rr)
+    per_iter += reply_size_of(cfg, size);
+  return static_cast<int>(
+      std::max<uint64_t>(1, std::min<uint64_t>(cfg.sweep_bytes / per_iter,
+                                               INT32_MAX)));
+}
+
+// Largest request or reply of the run, so one buffer serves every size.
+static size_t max_message_len(const bench_config &cfg) {
+  size_t len = 0;
+  for (int size : cfg.sizes) {
+    len = std::max<size_t>(len, size);
+    if (cfg.mode == bench_mode::rr)
+      len = std::max<size_t>(len, reply_size_of(cfg, size));
+  }
+  return len;
+}
 
-  int domain = use_ipv6 ? AF_INET6 : AF_INET;
-  sock = socket(domain, SOCK_STREAM, 0);
+static bool text_output(const bench_config &cfg) {
+  return cfg.format == output_format::text && !cfg.quiet;
+}
+
+static bool is_tcp(const bench_config &cfg) {
+  return cfg.transport.kind == transport_kind::tcp;
+}
+
+// Streams cfg.warmup untimed and iterations_for() timed buffers of every
+// size in cfg.sizes to the client. The CPU cost of size k goes to results[k].
+// A failed send ends the run like in rr mode: the engines can't tell how
+// many messages went out, so there is no partial result to report.
+static void stream_send(const endpoint &conn, const bench_config &cfg,
+                        const std::string &who, start_barrier &barrier,
+                        std::vector<conn_result *> &results) {
+  buffer_pool pool(cfg.buffers, max_message_len(cfg), who);
+  pool.fill('x');
+  char *buf = pool.base();
+  auto io = engine_for(cfg.engine, conn, pool);
+
+  for (size_t k = 0; k < cfg.sizes.size(); ++k) {
+    int buffer_size = cfg.sizes[k];
+    int num_iter = iterations_for(cfg, buffer_size);
+    barrier.wait();
+    // Corked for the whole stream, so only full segments leave until the
+    // final uncork flushes the rest.
+    if (cfg.sock.cork)
+      set_cork(conn.wfd, true, who);
+    if (!io->send_repeated(buf, buffer_size, cfg.warmup)) {
+      std::cerr << who << ": Warmup send failed: " << strerror(errno)
+                << std::endl;
+      close_endpoint(conn);
+      exit(1);
+    }
+
+    uint64_t syscalls = io->syscalls();
+    thread_usage cs = thread_usage_now();
+    auto start = std::chrono::high_resolution_clock::now();
+    if (!io->send_repeated(buf, buffer_size, num_iter)) {
+      std::cerr << who << ": Send failed: " << strerror(errno) << std::endl;
+      close_endpoint(conn);
+      exit(1);
+    }
+    if (cfg.sock.cork)
+      set_cork(conn.wfd, false, who);
+    auto end = std::chrono::high_resolution_clock::now();
+    uint64_t bytes = static_cast<uint64_t>(buffer_size) * num_iter;
+    results[k]->server_used = usage_since(cs);
+    results[k]->server_bytes = bytes;
+    results[k]->server_messages = num_iter;
+
+    if (text_output(cfg)) {
+      std::unique_lock<std::mutex> lk(cout_mutex);
+      uint64_t elapsed =
+          std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+              .count();
+      std::cout << who << ": Sent " << num_iter << " buffers in "
+                << elapsed / 1000000 << " ms ("
+                << gbit_per_sec(bytes, elapsed) << " Gbit/s";
+      print_io_cost(*io, syscalls, results[k]->server_used, bytes, num_iter);
+      std::cout << ")" << std::endl;
+    }
+  }
+  io.reset();
+}
+
+// Drains the stream produced by stream_send and records the timed part of
+// size k in results[k].
+static void stream_recv(const endpoint &sock, const bench_config &cfg,
+                        const std::string &who, start_barrier &barrier,
+                        std::vector<conn_result *> &results) {
+  buffer_pool pool(cfg.buffers, max_message_len(cfg), who);
+  char *buf = pool.base();
+  auto io = engine_for(client_engine(cfg), sock, pool);
+
+  for (size_t k = 0; k < cfg.sizes.size(); ++k) {
+    int buffer_size = cfg.sizes[k];
+    int num_iter = iterations_for(cfg, buffer_size);
+    conn_result &result = *results[k];
+    barrier.wait();
+    if (!io->recv_repeated(buf, buffer_size, cfg.warmup)) {
+      std::cerr << who << ": Warmup receive failed" << std::endl;
+      close_endpoint(sock);
+      exit(1);
+    }
+
+    uint64_t syscalls = io->syscalls();
+    thread_usage cs = thread_usage_now();
+    result.start_ns = now_ns();
+    if (!io->recv_repeated(buf, buffer_size, num_iter)) {
+      if (errno == 0)
+        std::cerr << who << ": Connection closed by server" << std::endl;
+      else
+        std::cerr << who << ": Receive failed: " << strerror(errno)
+                  << std::endl;
+      close_endpoint(sock);
+      exit(1);
+    }
+    result.bytes = static_cast<uint64_t>(buffer_size) * num_iter;
+    result.messages = num_iter;
+    result.end_ns = now_ns();
+    result.client_used = usage_since(cs);
+
+    if (text_output(cfg)) {
+      uint64_t elapsed = result.end_ns - result.start_ns;
+      std::unique_lock<std::mutex> lk(cout_mutex);
+      std::cout << who << ": Received " << result.messages << " buffers in "
+                << elapsed / 1000000 << " ms ("
+                << gbit_per_sec(result.bytes, elapsed) << " Gbit/s";
+      print_io_cost(*io, syscalls, result.client_used, result.bytes,
+                    result.messages);
+      std::cout << ")" << std::endl;
+    }
+  }
+  io.reset();
+}
+
+// Serves cfg.warmup + iterations_for() requests of every size in cfg.sizes,
+// answering each one with a reply_size_of() byte response. The CPU cost of
+// size k goes to results[k].
+static void serve_requests(const endpoint &conn, const bench_config &cfg,
+                           const std::string &who, start_barrier &barrier,
+                           std::vector<conn_result *> &results) {
+  buffer_pool pool(cfg.buffers, max_message_len(cfg), who);
+  pool.fill('x');
+  auto io = engine_for(cfg.engine, conn, pool);
+
+  for (size_t k = 0; k < cfg.sizes.size(); ++k) {
+    int request_size = cfg.sizes[k];
+    int reply_size = reply_size_of(cfg, request_size);
+    int total = cfg.warmup + iterations_for(cfg, request_size);
+    barrier.wait();
+    uint64_t syscalls = io->syscalls();
+    thread_usage cs = thread_usage_now();
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < total; ++i) {
+      char *buf = pool.slot(i);
+      if (!io->recv_all(buf, request_size)) {
+        std::cerr << who << ": Request receive failed at iteration " << i
+                  << ": " << (errno ? strerror(errno) : "connection closed")
+                  << std::endl;
+        break;
+      }
+      if (cfg.sock.quickack)
+        rearm_quickack(conn.rfd, who);
+      if (cfg.sock.cork)
+        set_cork(conn.wfd, true, who);
+      if (!io->send_all(buf, reply_size)) {
+        std::cerr << who << ": Reply send failed at iteration " << i << ": "
+                  << strerror(errno) << std::endl;
+        break;
+      }
+      if (cfg.sock.cork)
+        set_cork(conn.wfd, false, who);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    uint64_t bytes = static_cast<uint64_t>(request_size + reply_size) * total;
+    results[k]->server_used = usage_since(cs);
+    results[k]->server_bytes = bytes;
+    results[k]->server_messages = total;
+
+    if (text_output(cfg)) {
+      std::unique_lock<std::mutex> lk(cout_mutex);
+      std::cout << who << ": Answered " << total << " requests in "
+                << std::chrono::duration_cast<std::chrono::milliseconds>(
+                       end - start)
+                       .count()
+                << " ms";
+      print_io_cost(*io, syscalls, results[k]->server_used, bytes, total);
+      std::cout << std::endl;
+    }
+  }
+  io.reset();
+}
+
+static void print_latency(const std::string &who,
+                          const latency_histogram &hist) {
+  std::cout << who << ": Latency ns: min=" << hist.min()
+            << " p50=" << hist.percentile(50)
+            << " p90=" << hist.percentile(90)
+            << " p99=" << hist.percentile(99)
+            << " p99.9=" << hist.percentile(99.9) << " max=" << hist.max()
+            << " mean=" << static_cast<uint64_t>(hist.mean()) << std::endl;
+}
+
+// Issues cfg.warmup untimed and iterations_for() timed round trips of every
+// size on sock and records the latency distribution of the timed ones.
+static void issue_requests(const endpoint &sock, const bench_config &cfg,
+                           const std::string &who, start_barrier &barrier,
+                           std::vector<conn_result *> &results) {
+  buffer_pool pool(cfg.buffers, max_message_len(cfg), who);
+  pool.fill('y');
+  auto io = engine_for(client_engine(cfg), sock, pool);
+
+  for (size_t k = 0; k < cfg.sizes.size(); ++k) {
+    int request_size = cfg.sizes[k];
+    int reply_size = reply_size_of(cfg, request_size);
+    int total = cfg.warmup + iterations_for(cfg, request_size);
+    conn_result &result = *results[k];
+    barrier.wait();
+    uint64_t syscalls = 0;
+    thread_usage cs;
+    for (int i = 0; i < total; ++i) {
+      if (i == cfg.warmup) {
+        syscalls = io->syscalls();
+        cs = thread_usage_now();
+      }
+      char *buf = pool.slot(i);
+      uint64_t t0 = now_ns();
+      if (i == cfg.warmup)
+        result.start_ns = t0;
+      if (cfg.sock.cork)
+        set_cork(sock.wfd, true, who);
+      if (!io->send_all(buf, request_size)) {
+        std::cerr << who << ": Request send failed at iteration " << i
+                  << ": " << strerror(errno) << std::endl;
+        close_endpoint(sock);
+        exit(1);
+      }
+      if (cfg.sock.cork)
+        set_cork(sock.wfd, false, who);
+      if (!io->recv_all(buf, reply_size)) {
+        std::cerr << who << ": Reply receive failed at iteration " << i
+                  << ": " << (errno ? strerror(errno) : "connection closed")
+                  << std::endl;
+        close_endpoint(sock);
+        exit(1);
+      }
+      if (cfg.sock.quickack)
+        rearm_quickack(sock.rfd, who);
+      uint64_t t1 = now_ns();
+      if (i >= cfg.warmup) {
+        result.hist.record(t1 - t0);
+        result.bytes += request_size + reply_size;
+        ++result.messages;
+      }
+    }
+    result.end_ns = now_ns();
+    result.client_used = usage_since(cs);
+
+    if (text_output(cfg)) {
+      uint64_t elapsed = result.end_ns - result.start_ns;
+      std::unique_lock<std::mutex> lk(cout_mutex);
+      std::cout << who << ": Completed " << result.messages
+                << " round trips in " << elapsed / 1000000 << " ms ("
+                << cfg.warmup << " warmup excluded), "
+                << static_cast<uint64_t>(result.messages * 1e9 / elapsed)
+                << " rt/s";
+      print_io_cost(*io, syscalls, result.client_used, result.bytes,
+                    result.messages);
+      std::cout << std::endl;
+      print_latency(who, result.hist);
+    }
+  }
+  io.reset();
+}
+
+// Waits for the absolute CLOCK_MONOTONIC time due_ns.
+static void pace_until(uint64_t due_ns, bool spin) {
+  if (spin) {
+    while (now_ns() < due_ns)
+      ;
+    return;
+  }
+  struct timespec ts;
+  ts.tv_sec = due_ns / 1000000000ULL;
+  ts.tv_nsec = due_ns % 1000000000ULL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) ==
+         EINTR)
+    ;
+}
+
+// Open loop: requests leave on a fixed schedule of cfg.rate / connections
+// per second whether or not earlier replies arrived, and replies are taken
+// by a second thread. Latency counts from the scheduled send time, so a
+// sender that falls behind (or a request stuck behind a slow one) shows up
+// as queueing delay instead of being omitted. Connections are staggered
+// over one interval to avoid sending in lockstep. The receiver of
+// connection i runs on client_cpus[i + connections], the entries after the
+// senders' (wrapping around), so that a spinning sender doesn't hold the
+// CPU its replies wait for.
+static void issue_open_loop(const endpoint &sock, const bench_config &cfg,
+                            const std::string &who, int idx,
+                            start_barrier &barrier,
+                            std::vector<conn_result *> &results) {
+  buffer_pool requests(cfg.buffers, max_message_len(cfg), who);
+  buffer_pool replies(cfg.buffers, max_message_len(cfg), who);
+  requests.fill('y');
+  // One engine per direction, each used by one thread only.
+  auto tx = engine_for(client_engine(cfg), sock, requests);
+  auto rx = engine_for(client_engine(cfg), sock, replies);
+  double interval = 1e9 * cfg.connections / cfg.rate;
+  double phase = static_cast<double>(idx) / cfg.connections;
+  int receiver_cpu =
+      cfg.client_cpus[(idx + cfg.connections) % cfg.client_cpus.size()];
+  // The default 50us timer slack would delay every sleep by about as much.
+  if (!cfg.spin_pacing)
+    prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+
+  for (size_t k = 0; k < cfg.sizes.size(); ++k) {
+    int request_size = cfg.sizes[k];
+    int reply_size = reply_size_of(cfg, request_size);
+    int count = iterations_for(cfg, request_size);
+    conn_result &result = *results[k];
+    barrier.wait();
+    for (int i = 0; i < cfg.warmup; ++i) {
+      if (!tx->send_all(requests.slot(i), request_size) ||
+          !rx->recv_all(replies.slot(i), reply_size)) {
+        std::cerr << who << ": Warmup round trip failed: "
+                  << (errno ? strerror(errno) : "connection closed")
+                  << std::endl;
+        close_endpoint(sock);
+        exit(1);
+      }
+    }
+
+    thread_usage cs = thread_usage_now();
+    uint64_t start = now_ns();
+    auto due = [&](int i) {
+      return start + static_cast<uint64_t>((i + phase) * interval);
+    };
+    thread_usage receiver_used;
+    std::thread receiver([&] {
+      pin_to_cpu(receiver_cpu, who);
+      thread_usage rcs = thread_usage_now();
+      for (int i = 0; i < count; ++i) {
+        if (!rx->recv_all(replies.slot(i), reply_size)) {
+          std::cerr << who << ": Reply receive failed at request " << i
+                    << ": " << (errno ? strerror(errno) : "connection closed")
+                    << std::endl;
+          close_endpoint(sock);
+          exit(1);
+        }
+        result.hist.record(now_ns() - due(i));
+        if (cfg.sock.quickack)
+          rearm_quickack(sock.rfd, who);
+      }
+      result.end_ns = now_ns();
+      receiver_used = usage_since(rcs);
+    });
+
+    uint64_t max_lag = 0, late = 0;
+    for (int i = 0; i < count; ++i) {
+      uint64_t t = due(i);
+      pace_until(t, cfg.spin_pacing);
+      uint64_t lag = now_ns() - t;
+      max_lag = std::max(max_lag, lag);
+      if (lag > interval)
+        ++late;
+      if (cfg.sock.cork)
+        set_cork(sock.wfd, true, who);
+      if (!tx->send_all(requests.slot(i), request_size)) {
+        std::cerr << who << ": Request send failed at request " << i << ": "
+                  << strerror(errno) << std::endl;
+        close_endpoint(sock);
+        exit(1);
+      }
+      if (cfg.sock.cork)
+        set_cork(sock.wfd, false, who);
+    }
+    uint64_t send_end = now_ns();
+    result.client_used = usage_since(cs);
+    receiver.join();
+    add_usage(result.client_used, receiver_used);
+    result.start_ns = start;
+    result.messages = count;
+    result.bytes = static_cast<uint64_t>(request_size + reply_size) * count;
+
+    if (text_output(cfg)) {
+      uint64_t elapsed = result.end_ns - result.start_ns;
+      std::unique_lock<std::mutex> lk(cout_mutex);
+      std::cout << who << ": Completed " << count << " open loop round trips"
+                << " in " << elapsed / 1000000 << " ms, target "
+                << static_cast<uint64_t>(1e9 / interval) << " rt/s, sent at "
+                << static_cast<uint64_t>(count * 1e9 / (send_end - start))
+                << " rt/s, " << late << " sends more than an interval late"
+                << " (max " << max_lag / 1000 << " us)" << std::endl;
+      print_latency(who, result.hist);
+    }
+  }
+  tx.reset();
+  rx.reset();
+}
+
+static bool is_unix_socket(const bench_config &cfg) {
+  return cfg.transport.kind == transport_kind::unix_stream ||
+         cfg.transport.kind == transport_kind::unix_seqpacket;
+}
+
+// A seqpacket message goes out in one piece or fails with EMSGSIZE when it
+// doesn't fit the send buffer. Tries one of len bytes on a fresh pair with
+// SO_SNDBUF sndbuf (0 for the default), before any connection is made.
+static bool seqpacket_fits(size_t len, int sndbuf) {
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) != 0)
+    return true; // the run itself reports why
+  if (sndbuf > 0)
+    setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+  std::vector<char> msg(len);
+  bool fits = send(sv[0], msg.data(), len, MSG_DONTWAIT) >= 0 ||
+              errno != EMSGSIZE;
+  close(sv[0]);
+  close(sv[1]);
+  return fits;
+}
+
+static int socket_domain(const bench_config &cfg) {
+  if (is_unix_socket(cfg))
+    return AF_UNIX;
+  return cfg.use_ipv6 ? AF_INET6 : AF_INET;
+}
+
+static int socket_type(const bench_config &cfg) {
+  return cfg.transport.kind == transport_kind::unix_seqpacket ? SOCK_SEQPACKET
+                                                              : SOCK_STREAM;
+}
+
+// Unix sockets live in the abstract namespace, named after the port so that
+// concurrent runs can be told apart and nothing is left in the filesystem.
+static socklen_t unix_address(const bench_config &cfg,
+                              struct sockaddr_un &addr) {
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::string name = "pingpong-" + std::to_string(cfg.port);
+  memcpy(addr.sun_path + 1, name.data(), name.size());
+  return offsetof(struct sockaddr_un, sun_path) + 1 + name.size();
+}
+
+static int open_listener(const bench_config &cfg) {
+  int sock;
+  struct sockaddr_in serv_addr4;
+  struct sockaddr_in6 serv_addr6;
+  struct sockaddr_un serv_addr_un;
+
+  sock = socket(socket_domain(cfg), socket_type(cfg), 0);
   if (sock < 0) {
     std::cerr << "Server: Socket creation failed: " << strerror(errno)
               << std::endl;
@@ -44,11 +745,24 @@ void server_thread(int port, int buffer_size, int num_iter, bool use_ipv6) {
     close(sock);
     exit(1);
   }
+  // Accepted TCP sockets inherit these, with buffer sizes in effect before
+  // the handshake fixes the window scale. Unix sockets don't, see
+  // server_worker().
+  apply_socket_options(sock, cfg.sock, is_tcp(cfg), cfg.mode == bench_mode::rr,
+                       "Server");
 
-  if (use_ipv6) {
+  if (is_unix_socket(cfg)) {
+    socklen_t len = unix_address(cfg, serv_addr_un);
+    if (bind(sock, (struct sockaddr *)&serv_addr_un, len) < 0) {
+      std::cerr << "Server: Socket binding failed: " << strerror(errno)
+                << std::endl;
+      close(sock);
+      exit(1);
+    }
+  } else if (cfg.use_ipv6) {
     memset(&serv_addr6, 0, sizeof(serv_addr6));
     serv_addr6.sin6_family = AF_INET6;
-    serv_addr6.sin6_port = htons(port);
+    serv_addr6.sin6_port = htons(cfg.port);
     serv_addr6.sin6_addr = in6addr_any;
 
     if (bind(sock, (struct sockaddr *)&serv_addr6, sizeof(serv_addr6)) < 0) {
@@ -60,7 +774,7 @@ void server_thread(int port, int buffer_size, int num_iter, bool use_ipv6) {
   } else {
     memset(&serv_addr4, 0, sizeof(serv_addr4));
     serv_addr4.sin_family = AF_INET;
-    serv_addr4.sin_port = htons(port);
+    serv_addr4.sin_port = htons(cfg.port);
     serv_addr4.sin_addr.s_addr = INADDR_ANY;
 
     if (bind(sock, (struct sockaddr *)&serv_addr4, sizeof(serv_addr4)) < 0) {
@@ -71,21 +785,23 @@ void server_thread(int port, int buffer_size, int num_iter, bool use_ipv6) {
     }
   }
 
-  if (listen(sock, 1) < 0) {
+  if (listen(sock, cfg.connections) < 0) {
     std::cerr << "Server: Socket listening failed: " << strerror(errno)
               << std::endl;
     close(sock);
     exit(1);
   }
+  return sock;
+}
 
-  {
-    std::unique_lock<std::mutex> lk(mtx);
-    server_ready = true;
-    cv.notify_all();
-  }
-
+static int accept_connection(int sock, const bench_config &cfg) {
+  struct sockaddr_in cli_addr4;
+  struct sockaddr_in6 cli_addr6;
   socklen_t clilen;
-  if (use_ipv6) {
+  int conn;
+  if (is_unix_socket(cfg)) {
+    conn = accept(sock, nullptr, nullptr);
+  } else if (cfg.use_ipv6) {
     clilen = sizeof(cli_addr6);
     conn = accept(sock, (struct sockaddr *)&cli_addr6, &clilen);
   } else {
@@ -98,75 +814,41 @@ void server_thread(int port, int buffer_size, int num_iter, bool use_ipv6) {
     close(sock);
     exit(1);
   }
-
-  void *ptr = mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE,
-                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if (ptr == MAP_FAILED) {
-    std::cerr << "mmap failed!" << std::endl;
-    exit(1);
-  }
-  char *buf = static_cast<char *>(ptr);
-  memset(buf, 'x', buffer_size);
-
-  auto start = std::chrono::high_resolution_clock::now();
-  for (int i = 0; i < num_iter; ++i) {
-    ssize_t sent = send(conn, buf, buffer_size, 0);
-    if (sent < 0) {
-      std::cerr << "Server: Send failed at iteration " << i << ": "
-                << strerror(errno) << std::endl;
-      break;
-    }
-  }
-  auto end = std::chrono::high_resolution_clock::now();
-
-  {
-    std::unique_lock<std::mutex> lk(cout_mutex);
-    std::cout << "Server: Sent " << num_iter << " buffers in "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end -
-                                                                       start)
-                     .count()
-              << " ms" << std::endl;
-  }
-  close(conn);
-  close(sock);
-  if (munmap(ptr, buffer_size) != 0) {
-    std::cerr << "munmap failed!" << std::endl;
-    exit(1);
-  }
+  return conn;
 }
 
-void client_thread(int port, int buffer_size, int num_iter, bool use_ipv6) {
+static int connect_to_server(const bench_config &cfg, const std::string &who) {
   int sock;
   struct sockaddr_in serv_addr4;
   struct sockaddr_in6 serv_addr6;
+  struct sockaddr_un serv_addr_un;
 
-  cpu_set_t cpuset;
-  CPU_ZERO(&cpuset);
-  CPU_SET(2, &cpuset);
-  pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-
-  {
-    std::unique_lock<std::mutex> lk(mtx);
-    cv.wait(lk, [] { return server_ready; });
-  }
-
-  int domain = use_ipv6 ? AF_INET6 : AF_INET;
-  sock = socket(domain, SOCK_STREAM, 0);
+  sock = socket(socket_domain(cfg), socket_type(cfg), 0);
 
   if (sock < 0) {
-    std::cerr << "Client: Socket creation failed: " << strerror(errno)
+    std::cerr << who << ": Socket creation failed: " << strerror(errno)
               << std::endl;
     exit(1);
   }
+  apply_socket_options(sock, cfg.sock, is_tcp(cfg), cfg.mode == bench_mode::rr,
+                       who);
 
-  if (use_ipv6) {
+  if (is_unix_socket(cfg)) {
+    socklen_t len = unix_address(cfg, serv_addr_un);
+    if (connect(sock, (struct sockaddr *)&serv_addr_un, len) < 0) {
+      std::cerr << who << ": Socket connection failed: " << strerror(errno)
+                << std::endl;
+      close(sock);
+      exit(1);
+    }
+  } else if (cfg.use_ipv6) {
     memset(&serv_addr6, 0, sizeof(serv_addr6));
     serv_addr6.sin6_family = AF_INET6;
-    serv_addr6.sin6_port = htons(port);
+    serv_addr6.sin6_port = htons(cfg.port);
     serv_addr6.sin6_addr = in6addr_loopback;
 
     if (connect(sock, (struct sockaddr *)&serv_addr6, sizeof(serv_addr6)) < 0) {
-      std::cerr << "Client: Socket connection failed: " << strerror(errno)
+      std::cerr << who << ": Socket connection failed: " << strerror(errno)
                 << std::endl;
       close(sock);
       exit(1);
@@ -174,105 +856,848 @@ void client_thread(int port, int buffer_size, int num_iter, bool use_ipv6) {
   } else {
     memset(&serv_addr4, 0, sizeof(serv_addr4));
     serv_addr4.sin_family = AF_INET;
-    serv_addr4.sin_port = htons(port);
+    serv_addr4.sin_port = htons(cfg.port);
     serv_addr4.sin_addr.s_addr = INADDR_ANY;
 
     if (connect(sock, (struct sockaddr *)&serv_addr4, sizeof(serv_addr4)) < 0) {
-      std::cerr << "Client: Socket connection failed: " << strerror(errno)
+      std::cerr << who << ": Socket connection failed: " << strerror(errno)
                 << std::endl;
       close(sock);
       exit(1);
     }
   }
+  return sock;
+}
 
-  void *ptr = mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE,
-                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if (ptr == MAP_FAILED) {
-    std::cerr << "mmap failed!" << std::endl;
-    exit(1);
+void server_worker(const bench_config &cfg, endpoint conn, int idx,
+                   start_barrier &barrier, std::vector<conn_result *> results) {
+  std::string who = role_name("Server", idx, cfg);
+  pin_to_cpu(cfg.server_cpus[idx % cfg.server_cpus.size()], who);
+
+  // The server end of a unix connection is created by connect(), not
+  // copied from the listener, so it gets its buffer sizes here.
+  if (cfg.transport.kind == transport_kind::socketpair || is_unix_socket(cfg))
+    apply_socket_options(conn.wfd, cfg.sock, false, false, who);
+  if (cfg.mode == bench_mode::rr) {
+    serve_requests(conn, cfg, who, barrier, results);
+  } else {
+    stream_send(conn, cfg, who, barrier, results);
   }
-  char *buf = static_cast<char *>(ptr);
+  close_endpoint(conn);
+}
 
-  auto start = std::chrono::high_resolution_clock::now();
-  int received = 0;
-  for (int i = 0; i < num_iter; ++i) {
-    while (received < buffer_size) {
-      ssize_t bytes_received =
-          recv(sock, buf + received, buffer_size - received, 0);
-      if (bytes_received < 0) {
-        std::cerr << "Client: Receive failed at iteration " << i << ": "
-                  << strerror(errno) << std::endl;
-        close(sock);
-        delete[] buf;
-        exit(1);
-      }
-      if (bytes_received == 0) {
-        std::cerr << "Client: Connection closed by server at iteration " << i
-                  << std::endl;
-        break;
-      }
-      received += bytes_received;
-    }
-    received = 0;
+// Column i of a [size][connection] result matrix.
+static std::vector<conn_result *>
+results_of(std::vector<std::vector<conn_result>> &results, int i) {
+  std::vector<conn_result *> column;
+  for (auto &per_size : results)
+    column.push_back(&per_size[i]);
+  return column;
+}
+
+// Accepts cfg.connections connections and serves each one on its own thread.
+// Transports without a listener hand in their server ends as ends. Accepted
+// connection i need not be client i; only sums over connections are
+// reported, so server costs land in any column.
+void server_thread(const bench_config &cfg, start_barrier &barrier,
+                   const std::vector<endpoint> &ends,
+                   std::vector<std::vector<conn_result>> &results) {
+  if (!transport_connects(cfg.transport.kind)) {
+    std::vector<std::thread> workers;
+    for (int i = 0; i < cfg.connections; ++i)
+      workers.emplace_back(server_worker, std::cref(cfg), ends[i], i,
+                           std::ref(barrier), results_of(results, i));
+    for (auto &t : workers)
+      t.join();
+    return;
   }
-  auto end = std::chrono::high_resolution_clock::now();
+
+  int sock = open_listener(cfg);
 
   {
-    std::unique_lock<std::mutex> lk(cout_mutex);
-    std::cout << "Client: Received " << num_iter << " buffers in "
-              << std::chrono::duration_cast<std::chrono::milliseconds>(end -
-                                                                       start)
-                     .count()
-              << " ms" << std::endl;
+    std::unique_lock<std::mutex> lk(mtx);
+    server_ready = true;
+    cv.notify_all();
   }
 
+  std::vector<std::thread> workers;
+  for (int i = 0; i < cfg.connections; ++i) {
+    endpoint conn;
+    conn.rfd = conn.wfd = accept_connection(sock, cfg);
+    workers.emplace_back(server_worker, std::cref(cfg), conn, i,
+                         std::ref(barrier), results_of(results, i));
+  }
+  for (auto &t : workers)
+    t.join();
   close(sock);
-  if (munmap(ptr, buffer_size) != 0) {
-    std::cerr << "munmap failed!" << std::endl;
-    exit(1);
+}
+
+// results[k] receives the measurement of cfg.sizes[k]. sock is the client
+// end for transports without a listener and ignored otherwise.
+void client_thread(const bench_config &cfg, int idx, start_barrier &barrier,
+                   std::vector<conn_result *> results, endpoint sock) {
+  std::string who = role_name("Client", idx, cfg);
+  pin_to_cpu(cfg.client_cpus[idx % cfg.client_cpus.size()], who);
+
+  if (transport_connects(cfg.transport.kind)) {
+    {
+      std::unique_lock<std::mutex> lk(mtx);
+      cv.wait(lk, [] { return server_ready; });
+    }
+    sock.rfd = sock.wfd = connect_to_server(cfg, who);
+  }
+
+  if (cfg.transport.kind == transport_kind::socketpair)
+    apply_socket_options(sock.wfd, cfg.sock, false, false, who);
+  if (cfg.mode == bench_mode::rr && cfg.rate > 0) {
+    issue_open_loop(sock, cfg, who, idx, barrier, results);
+  } else if (cfg.mode == bench_mode::rr) {
+    issue_requests(sock, cfg, who, barrier, results);
+  } else {
+    stream_recv(sock, cfg, who, barrier, results);
+  }
+  close_endpoint(sock);
+}
+
+// Runs every size in cfg.sizes over one set of connections and returns the
+// per-connection results, indexed [size][connection].
+static std::vector<std::vector<conn_result>> run_once(const bench_config &cfg) {
+  server_ready = false;
+  start_barrier barrier(2 * cfg.connections);
+  std::vector<std::vector<conn_result>> results(
+      cfg.sizes.size(), std::vector<conn_result>(cfg.connections));
+
+  std::vector<endpoint> server_ends(cfg.connections);
+  std::vector<endpoint> client_ends(cfg.connections);
+  if (!transport_connects(cfg.transport.kind)) {
+    for (int i = 0; i < cfg.connections; ++i)
+      make_endpoint_pair(cfg.transport, server_ends[i], client_ends[i]);
+  }
+
+  std::thread serv(server_thread, std::cref(cfg), std::ref(barrier),
+                   std::cref(server_ends), std::ref(results));
+  std::vector<std::thread> clients;
+  for (int i = 0; i < cfg.connections; ++i)
+    clients.emplace_back(client_thread, std::cref(cfg), i, std::ref(barrier),
+                         results_of(results, i), client_ends[i]);
+
+  serv.join();
+  for (auto &t : clients)
+    t.join();
+  return results;
+}
+
+// Normalizes one side's usage. Context switches and CPU time come from the
+// counters when available, from getrusage otherwise.
+static run_record::cpu_cost cost_of(const thread_usage &used, uint64_t bytes,
+                                    uint64_t messages) {
+  run_record::cpu_cost c;
+  if (bytes == 0 || messages == 0)
+    return c;
+  const perf_values &p = used.perf;
+  if (p.has(perf_metric::cycles))
+    c.cycles_per_byte = static_cast<double>(p.get(perf_metric::cycles)) / bytes;
+  if (p.has(perf_metric::instructions))
+    c.instructions_per_msg =
+        static_cast<double>(p.get(perf_metric::instructions)) / messages;
+  if (p.has(perf_metric::cache_misses))
+    c.cache_misses_per_msg =
+        static_cast<double>(p.get(perf_metric::cache_misses)) / messages;
+  double switches = p.has(perf_metric::context_switches)
+                        ? p.get(perf_metric::context_switches)
+                        : used.voluntary + used.involuntary;
+  double cpu_ns = p.has(perf_metric::task_clock)
+                      ? p.get(perf_metric::task_clock)
+                      : used.user_ns + used.sys_ns;
+  c.ctx_switches_per_msg = switches / messages;
+  c.cpu_ns_per_msg = cpu_ns / messages;
+  return c;
+}
+
+// Aggregate over all connections: total bytes over the union of the timed
+// intervals, plus the spread of the per-connection rates.
+static run_record summarize(const bench_config &cfg, int size,
+                            const std::vector<conn_result> &results,
+                            latency_histogram &hist) {
+  uint64_t bytes = 0, messages = 0;
+  uint64_t server_bytes = 0, server_messages = 0;
+  uint64_t first = UINT64_MAX, last = 0;
+  thread_usage client_used, server_used;
+  std::vector<double> rates;
+  for (const auto &r : results) {
+    bytes += r.bytes;
+    messages += r.messages;
+    server_bytes += r.server_bytes;
+    server_messages += r.server_messages;
+    add_usage(client_used, r.client_used);
+    add_usage(server_used, r.server_used);
+    first = std::min(first, r.start_ns);
+    last = std::max(last, r.end_ns);
+    hist.merge(r.hist);
+    rates.push_back(gbit_per_sec(r.bytes, r.end_ns - r.start_ns));
+  }
+
+  double mean = 0;
+  for (double r : rates)
+    mean += r;
+  mean /= rates.size();
+  double var = 0;
+  for (double r : rates)
+    var += (r - mean) * (r - mean);
+  var /= rates.size();
+
+  run_record rec;
+  rec.labels = {{"mode", cfg.mode == bench_mode::rr ? "rr" : "stream"},
+                {"engine", cfg.transport.kind == transport_kind::shm
+                               ? shm_wait_name(cfg.transport.shm_wait)
+                               : engine_name(cfg.engine.kind)},
+                {"tx", tx_name(cfg.engine.tx)},
+                {"transport", transport_name(cfg.transport.kind)},
+                {"ip", cfg.transport.kind != transport_kind::tcp ? "-"
+                       : cfg.use_ipv6                            ? "ipv6"
+                                                                 : "ipv4"}};
+  if (cfg.sock_labels) {
+    for (auto &label : socket_option_labels(cfg.sock))
+      rec.labels.push_back(label);
+  }
+  if (!buffer_options_default(cfg.buffers)) {
+    for (auto &label : buffer_labels(cfg.buffers))
+      rec.labels.push_back(label);
+  }
+  rec.bytes = size;
+  if (cfg.mode == bench_mode::rr)
+    rec.reply_bytes = reply_size_of(cfg, size);
+  rec.iterations = iterations_for(cfg, size);
+  rec.target_rate = cfg.rate;
+  rec.connections = cfg.connections;
+  rec.elapsed_ns = last - first;
+  rec.gbit_per_sec = gbit_per_sec(bytes, rec.elapsed_ns);
+  rec.msgs_per_sec = rec.elapsed_ns ? messages * 1e9 / rec.elapsed_ns : 0.0;
+  rec.conn_gbit_mean = mean;
+  rec.conn_gbit_cv = mean > 0 ? std::sqrt(var) / mean * 100.0 : 0.0;
+  rec.client_cost = cost_of(client_used, bytes, messages);
+  rec.server_cost = cost_of(server_used, server_bytes, server_messages);
+  if (cfg.mode == bench_mode::rr && hist.count() > 0) {
+    rec.lat_min = hist.min();
+    rec.lat_p50 = hist.percentile(50);
+    rec.lat_p90 = hist.percentile(90);
+    rec.lat_p99 = hist.percentile(99);
+    rec.lat_p999 = hist.percentile(99.9);
+    rec.lat_max = hist.max();
+    rec.lat_mean = hist.mean();
+  }
+  return rec;
+}
+
+static void print_summary(const bench_config &cfg, const run_record &rec,
+                          const latency_histogram &hist) {
+  std::cout << "Aggregate: " << cfg.connections << " connections, "
+            << rec.gbit_per_sec << " Gbit/s, "
+            << static_cast<uint64_t>(rec.msgs_per_sec)
+            << (cfg.mode == bench_mode::rr ? " rt/s" : " msgs/s")
+            << ", per-connection mean " << rec.conn_gbit_mean << " Gbit/s, CV "
+            << rec.conn_gbit_cv << "%" << std::endl;
+  if (cfg.mode == bench_mode::rr)
+    print_latency("Aggregate", hist);
+}
+
+// Parses a byte count with an optional K, M or G (binary) suffix. Returns 0
+// on malformed input.
+static uint64_t parse_size(const char *s) {
+  char *end;
+  unsigned long long v = strtoull(s, &end, 10);
+  if (end == s)
+    return 0;
+  switch (*end) {
+  case 'k':
+  case 'K':
+    v <<= 10;
+    ++end;
+    break;
+  case 'm':
+  case 'M':
+    v <<= 20;
+    ++end;
+    break;
+  case 'g':
+  case 'G':
+    v <<= 30;
+    ++end;
+    break;
+  }
+  return *end == '\0' ? v : 0;
+}
+
+// Parses a message rate such as "200k", "1.5M/s" or "5000" (decimal
+// suffixes). Returns 0 on malformed input.
+static uint64_t parse_rate(const char *s) {
+  char *end;
+  double v = strtod(s, &end);
+  if (end == s)
+    return 0;
+  if (*end == 'k' || *end == 'K') {
+    v *= 1e3;
+    ++end;
+  } else if (*end == 'm' || *end == 'M') {
+    v *= 1e6;
+    ++end;
+  }
+  if (strcmp(end, "/s") == 0)
+    end += 2;
+  return *end == '\0' && v >= 1 && v <= INT32_MAX ? static_cast<uint64_t>(v)
+                                                    : 0;
+}
+
+// Parses a duration in ns, us, ms or s (plain numbers are ns). Returns 0 on
+// malformed input.
+static uint64_t parse_duration_ns(const char *s) {
+  char *end;
+  double v = strtod(s, &end);
+  if (end == s || v <= 0)
+    return 0;
+  std::string unit(end);
+  if (unit == "us")
+    v *= 1e3;
+  else if (unit == "ms")
+    v *= 1e6;
+  else if (unit == "s")
+    v *= 1e9;
+  else if (unit != "" && unit != "ns")
+    return 0;
+  return static_cast<uint64_t>(v);
+}
+
+// Expands "start:end:xF" (geometric, factor F) or "start:end:+N" (step N)
+// into a list of message sizes, or other values read by parse_value.
+// Returns an empty list on malformed input.
+static std::vector<int>
+parse_sweep(const char *s, uint64_t (*parse_value)(const char *) = parse_size) {
+  std::string spec(s);
+  size_t c1 = spec.find(':');
+  size_t c2 = c1 == std::string::npos ? c1 : spec.find(':', c1 + 1);
+  if (c2 == std::string::npos || c2 + 2 > spec.size())
+    return {};
+  uint64_t start = parse_value(spec.substr(0, c1).c_str());
+  uint64_t end = parse_value(spec.substr(c1 + 1, c2 - c1 - 1).c_str());
+  char kind = spec[c2 + 1];
+  std::string step_str = spec.substr(c2 + 2);
+  if (start < 1 || end < start || end > INT32_MAX)
+    return {};
+
+  std::vector<int> sizes;
+  if (kind == 'x') {
+    char *tail;
+    double factor = strtod(step_str.c_str(), &tail);
+    if (*tail != '\0' || !(factor > 1.0))
+      return {};
+    for (double v = start; v <= end; v *= factor) {
+      int size = static_cast<int>(v);
+      if (sizes.empty() || sizes.back() != size)
+        sizes.push_back(size);
+    }
+  } else if (kind == '+') {
+    uint64_t step = parse_value(step_str.c_str());
+    if (step < 1)
+      return {};
+    for (uint64_t v = start; v <= end; v += step)
+      sizes.push_back(static_cast<int>(v));
+  }
+  return sizes;
+}
+
+// Parses "0-3,8,10-11" into a list of CPU ids. Returns an empty list on
+// malformed input.
+static std::vector<int> parse_cpu_list(const char *s) {
+  std::vector<int> cpus;
+  while (*s) {
+    char *end;
+    long lo = strtol(s, &end, 10);
+    if (end == s || lo < 0)
+      return {};
+    long hi = lo;
+    if (*end == '-') {
+      s = end + 1;
+      hi = strtol(s, &end, 10);
+      if (end == s || hi < lo)
+        return {};
+    }
+    for (long c = lo; c <= hi; ++c)
+      cpus.push_back(static_cast<int>(c));
+    if (*end == ',')
+      ++end;
+    else if (*end != '\0')
+      return {};
+    s = end;
   }
+  return cpus;
+}
+
+enum class rank_metric { gbit, msgs, p50, p99 };
+
+static bool parse_rank_metric(const char *name, rank_metric &metric) {
+  static const std::pair<const char *, rank_metric> names[] = {
+      {"gbit", rank_metric::gbit},
+      {"msgs", rank_metric::msgs},
+      {"p50", rank_metric::p50},
+      {"p99", rank_metric::p99}};
+  for (const auto &n : names) {
+    if (strcmp(name, n.first) == 0) {
+      metric = n.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Orders the records of every message size from best to worst and puts the
+// position in a leading "rank" column.
+static void rank_records(std::vector<run_record> &recs, rank_metric metric) {
+  auto score = [metric](const run_record &r) {
+    switch (metric) {
+    case rank_metric::msgs:
+      return r.msgs_per_sec;
+    case rank_metric::p50:
+      return -static_cast<double>(r.lat_p50);
+    case rank_metric::p99:
+      return -static_cast<double>(r.lat_p99);
+    case rank_metric::gbit:
+    default:
+      return r.gbit_per_sec;
+    }
+  };
+  std::stable_sort(recs.begin(), recs.end(),
+                   [&](const run_record &a, const run_record &b) {
+                     if (a.bytes != b.bytes)
+                       return a.bytes < b.bytes;
+                     return score(a) > score(b);
+                   });
+  int rank = 0;
+  for (size_t i = 0; i < recs.size(); ++i) {
+    rank = i > 0 && recs[i].bytes == recs[i - 1].bytes ? rank + 1 : 1;
+    recs[i].labels.insert(recs[i].labels.begin(),
+                          {"rank", std::to_string(rank)});
+  }
+}
+
+// Splits a comma separated option value and parses every element with
+// parse_one, which returns false on malformed input.
+template <typename T, typename F>
+static bool parse_list(const char *s, std::vector<T> &out, F &&parse_one) {
+  std::string all(s);
+  out.clear();
+  size_t pos = 0;
+  for (;;) {
+    size_t comma = all.find(',', pos);
+    T v;
+    if (!parse_one(all.substr(pos, comma - pos), v))
+      return false;
+    out.push_back(v);
+    if (comma == std::string::npos)
+      return true;
+    pos = comma + 1;
+  }
+}
+
+static bool parse_on_off(const std::string &s, bool &on) {
+  on = s == "on";
+  return on || s == "off";
 }
 
 void print_usage(const char *prog_name) {
   std::cerr
       << "Usage: " << prog_name << " [options]\n"
       << "Options:\n"
-      << "  -b, --buffer-size <size>   Buffer size in bytes (default: 4096)\n"
+      << "  -b, --buffer-size <size>   Buffer size in bytes, K/M/G suffixes\n"
+      << "                             allowed (default: 4096)\n"
       << "  -n, --num-iter <count>     Number of iterations (default: 1000)\n"
+      << "  -m, --mode <stream|rr>     Stream one way, or time request/reply\n"
+      << "                             round trips (default: stream)\n"
+      << "  -r, --reply-size <size>    Reply size in bytes for rr mode\n"
+      << "                             (default: same as buffer size)\n"
+      << "  -w, --warmup <count>       Untimed iterations before measuring\n"
+      << "                             (default: 0)\n"
+      << "  -c, --connections <count>  Concurrent connections, each with its\n"
+      << "                             own server and client thread\n"
+      << "                             (default: 1)\n"
+      << "      --server-cpus <list>   CPUs for server threads, e.g. 0-7,16\n"
+      << "                             (default: 0)\n"
+      << "      --client-cpus <list>   CPUs for client threads; open loop\n"
+      << "                             receivers take the entries after the\n"
+      << "                             senders' (default: 2)\n"
+      << "  -e, --engine <name>        I/O engine: blocking, epoll or io_uring\n"
+      << "                             (default: blocking)\n"
+      << "      --uring-depth <n>      io_uring requests in flight per batch\n"
+      << "                             (default: 8)\n"
+      << "      --uring-fixed-buffers  Use registered buffers with io_uring\n"
+      << "      --uring-multishot      Use multishot recv with io_uring\n"
+      << "                             (seqpacket messages up to 64K)\n"
+      << "  -t, --tx <path>            Server transmit path (blocking engine):\n"
+      << "                             copy, zerocopy (MSG_ZEROCOPY), splice\n"
+      << "                             (vmsplice+splice) or sendfile (memfd)\n"
+      << "                             (default: copy)\n"
+      << "  -s, --sweep <spec>         Measure the sizes start:end:xF (multiply\n"
+      << "                             by F) or start:end:+N (add N) instead\n"
+      << "                             of -b, e.g. 64:1M:x4\n"
+      << "      --sweep-bytes <size>   Move about this many bytes per size and\n"
+      << "                             connection instead of -n iterations\n"
+      << "      --reconnect            New connections for every size\n"
+      << "  -f, --format <fmt>         text, json (one object per line) or csv\n"
+      << "                             (default: text)\n"
+      << "  -T, --transport <name>     tcp, unix (stream), seqpacket,\n"
+      << "                             socketpair, pipe or shm (default: tcp)\n"
+      << "      --shm-wait <mode>      How shm waits for data or space: futex\n"
+      << "                             or spin, which needs a CPU per side\n"
+      << "                             (default: futex)\n"
+      << "      --shm-ring-size <size> shm ring bytes per direction, a power\n"
+      << "                             of two (default: 1M)\n"
+      << "      --pipe-size <size>     F_SETPIPE_SZ for pipes\n"
+      << "      --rate <n[k|M]/s>      Open loop rr: send requests on a fixed\n"
+      << "                             schedule, total over all connections\n"
+      << "      --pacing <sleep|spin>  Wait for send times in clock_nanosleep\n"
+      << "                             or by busy-waiting, which needs a\n"
+      << "                             client CPU per sender and receiver\n"
+      << "                             (default: sleep)\n"
+      << "      --ramp <spec>          Open loop at every rate start:end:xF or\n"
+      << "                             start:end:+N until the p99 exceeds\n"
+      << "                             --p99-limit, e.g. 10k:1M:x1.5\n"
+      << "      --p99-limit <time>     Ramp stop condition, e.g. 100us\n"
+      << "      --pages <kind>         Message buffer pages: normal, thp\n"
+      << "                             (madvise) or hugetlb (default: normal)\n"
+      << "      --numa <node>          Bind buffers with mbind to the local\n"
+      << "                             or a remote node, or none (default)\n"
+      << "      --populate             Fault buffers in before measuring\n"
+      << "      --buffer-pool <count>  Rotate every thread over this many\n"
+      << "                             buffers, for cold cache copies\n"
+      << "                             (default: 1)\n"
+      << "Socket options take comma separated lists; with more than one\n"
+      << "value every combination runs and a ranked table is printed:\n"
+      << "      --nodelay <mode>       TCP_NODELAY on, off or default (on for\n"
+      << "                             rr only)\n"
+      << "      --sndbuf <size|auto>   SO_SNDBUF (default: auto)\n"
+      << "      --rcvbuf <size|auto>   SO_RCVBUF (default: auto)\n"
+      << "      --busy-poll <usec>     SO_BUSY_POLL (default: 0, unset)\n"
+      << "      --quickack <on|off>    TCP_QUICKACK after every rr receive\n"
+      << "      --cork <on|off>        TCP_CORK around every sent message\n"
+      << "      --rank-by <metric>     gbit, msgs, p50 or p99 (default: gbit\n"
+      << "                             for stream, p99 for rr)\n"
       << "  -4, --ipv4                 Use IPv4\n"
       << "  -6, --ipv6                 Use IPv6 (default)\n"
       << "  -h, --help                 Show this help message\n";
 }
 
+enum long_only_options {
+  OPT_SERVER_CPUS = 256,
+  OPT_CLIENT_CPUS,
+  OPT_URING_DEPTH,
+  OPT_URING_FIXED_BUFFERS,
+  OPT_URING_MULTISHOT,
+  OPT_SWEEP_BYTES,
+  OPT_RECONNECT,
+  OPT_SHM_WAIT,
+  OPT_SHM_RING_SIZE,
+  OPT_PIPE_SIZE,
+  OPT_NODELAY,
+  OPT_SNDBUF,
+  OPT_RCVBUF,
+  OPT_BUSY_POLL,
+  OPT_QUICKACK,
+  OPT_CORK,
+  OPT_RANK_BY,
+  OPT_RATE,
+  OPT_PACING,
+  OPT_RAMP,
+  OPT_P99_LIMIT,
+  OPT_PAGES,
+  OPT_NUMA,
+  OPT_POPULATE,
+  OPT_BUFFER_POOL,
+};
+
 int main(int argc, char *argv[]) {
-  int port = 50007;
-  int buffer_size = 4096;
-  int num_iter = 1000;
-  bool use_ipv6 = true;
+  bench_config cfg;
+  socket_option_lists sock_lists;
+  rank_metric rank_by = rank_metric::gbit;
+  bool rank_by_set = false;
+  std::vector<int> ramp;
+  uint64_t p99_limit = 0;
 
   static struct option long_options[] = {
       {"buffer-size", required_argument, nullptr, 'b'},
       {"num-iter", required_argument, nullptr, 'n'},
+      {"mode", required_argument, nullptr, 'm'},
+      {"reply-size", required_argument, nullptr, 'r'},
+      {"warmup", required_argument, nullptr, 'w'},
+      {"connections", required_argument, nullptr, 'c'},
+      {"server-cpus", required_argument, nullptr, OPT_SERVER_CPUS},
+      {"client-cpus", required_argument, nullptr, OPT_CLIENT_CPUS},
+      {"engine", required_argument, nullptr, 'e'},
+      {"tx", required_argument, nullptr, 't'},
+      {"uring-depth", required_argument, nullptr, OPT_URING_DEPTH},
+      {"uring-fixed-buffers", no_argument, nullptr, OPT_URING_FIXED_BUFFERS},
+      {"uring-multishot", no_argument, nullptr, OPT_URING_MULTISHOT},
+      {"sweep", required_argument, nullptr, 's'},
+      {"sweep-bytes", required_argument, nullptr, OPT_SWEEP_BYTES},
+      {"reconnect", no_argument, nullptr, OPT_RECONNECT},
+      {"format", required_argument, nullptr, 'f'},
+      {"transport", required_argument, nullptr, 'T'},
+      {"shm-wait", required_argument, nullptr, OPT_SHM_WAIT},
+      {"shm-ring-size", required_argument, nullptr, OPT_SHM_RING_SIZE},
+      {"pipe-size", required_argument, nullptr, OPT_PIPE_SIZE},
+      {"nodelay", required_argument, nullptr, OPT_NODELAY},
+      {"sndbuf", required_argument, nullptr, OPT_SNDBUF},
+      {"rcvbuf", required_argument, nullptr, OPT_RCVBUF},
+      {"busy-poll", required_argument, nullptr, OPT_BUSY_POLL},
+      {"quickack", required_argument, nullptr, OPT_QUICKACK},
+      {"cork", required_argument, nullptr, OPT_CORK},
+      {"rank-by", required_argument, nullptr, OPT_RANK_BY},
+      {"rate", required_argument, nullptr, OPT_RATE},
+      {"pacing", required_argument, nullptr, OPT_PACING},
+      {"ramp", required_argument, nullptr, OPT_RAMP},
+      {"p99-limit", required_argument, nullptr, OPT_P99_LIMIT},
+      {"pages", required_argument, nullptr, OPT_PAGES},
+      {"numa", required_argument, nullptr, OPT_NUMA},
+      {"populate", no_argument, nullptr, OPT_POPULATE},
+      {"buffer-pool", required_argument, nullptr, OPT_BUFFER_POOL},
       {"ipv4", no_argument, nullptr, '4'},
       {"ipv6", no_argument, nullptr, '6'},
       {"help", no_argument, nullptr, 'h'},
       {nullptr, 0, nullptr, 0}};
 
   int opt;
-  while ((opt = getopt_long(argc, argv, "b:n:46h", long_options, nullptr)) !=
-         -1) {
+  while ((opt = getopt_long(argc, argv, "b:n:m:r:w:c:e:t:s:f:T:46h", long_options,
+                            nullptr)) != -1) {
     switch (opt) {
     case 'b':
-      buffer_size = std::atoi(optarg);
+      cfg.buffer_size = static_cast<int>(
+          std::min<uint64_t>(parse_size(optarg), INT32_MAX));
       break;
     case 'n':
-      num_iter = std::atoi(optarg);
+      cfg.num_iter = std::atoi(optarg);
+      break;
+    case 'm':
+      if (strcmp(optarg, "stream") == 0) {
+        cfg.mode = bench_mode::stream;
+      } else if (strcmp(optarg, "rr") == 0) {
+        cfg.mode = bench_mode::rr;
+      } else {
+        std::cerr << "Unknown mode: " << optarg << std::endl;
+        print_usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'r':
+      cfg.reply_size = static_cast<int>(
+          std::min<uint64_t>(parse_size(optarg), INT32_MAX));
+      break;
+    case 'w':
+      cfg.warmup = std::atoi(optarg);
+      break;
+    case 'c':
+      cfg.connections = std::atoi(optarg);
+      break;
+    case OPT_SERVER_CPUS:
+    case OPT_CLIENT_CPUS: {
+      std::vector<int> cpus = parse_cpu_list(optarg);
+      if (cpus.empty()) {
+        std::cerr << "Invalid CPU list: " << optarg << std::endl;
+        return 1;
+      }
+      (opt == OPT_SERVER_CPUS ? cfg.server_cpus : cfg.client_cpus) = cpus;
+      break;
+    }
+    case 'e':
+      if (!parse_engine(optarg, cfg.engine.kind)) {
+        std::cerr << "Unknown engine: " << optarg << std::endl;
+        print_usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 't':
+      if (!parse_tx(optarg, cfg.engine.tx)) {
+        std::cerr << "Unknown transmit path: " << optarg << std::endl;
+        print_usage(argv[0]);
+        return 1;
+      }
+      break;
+    case OPT_URING_DEPTH:
+      cfg.engine.uring_depth = std::atoi(optarg);
+      break;
+    case OPT_URING_FIXED_BUFFERS:
+      cfg.engine.uring_fixed_buffers = true;
+      break;
+    case OPT_URING_MULTISHOT:
+      cfg.engine.uring_multishot = true;
+      break;
+    case 's':
+      cfg.sizes = parse_sweep(optarg);
+      if (cfg.sizes.empty()) {
+        std::cerr << "Invalid sweep: " << optarg << std::endl;
+        return 1;
+      }
+      break;
+    case OPT_SWEEP_BYTES:
+      cfg.sweep_bytes = parse_size(optarg);
+      if (cfg.sweep_bytes == 0) {
+        std::cerr << "Invalid byte budget: " << optarg << std::endl;
+        return 1;
+      }
+      break;
+    case OPT_RECONNECT:
+      cfg.reconnect = true;
+      break;
+    case 'f':
+      if (!parse_format(optarg, cfg.format)) {
+        std::cerr << "Unknown format: " << optarg << std::endl;
+        print_usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'T':
+      if (!parse_transport(optarg, cfg.transport.kind)) {
+        std::cerr << "Unknown transport: " << optarg << std::endl;
+        print_usage(argv[0]);
+        return 1;
+      }
+      break;
+    case OPT_SHM_WAIT:
+      if (!parse_shm_wait(optarg, cfg.transport.shm_wait)) {
+        std::cerr << "Unknown shm wait mode: " << optarg << std::endl;
+        print_usage(argv[0]);
+        return 1;
+      }
+      break;
+    case OPT_SHM_RING_SIZE:
+      cfg.transport.shm_ring_size = parse_size(optarg);
+      break;
+    case OPT_PIPE_SIZE:
+      cfg.transport.pipe_size = static_cast<int>(
+          std::min<uint64_t>(parse_size(optarg), INT32_MAX));
+      break;
+    case OPT_NODELAY:
+      if (!parse_list(optarg, sock_lists.nodelay,
+                      [](const std::string &v, int &nodelay) {
+                        bool on;
+                        if (v == "default") {
+                          nodelay = -1;
+                          return true;
+                        }
+                        if (!parse_on_off(v, on))
+                          return false;
+                        nodelay = on;
+                        return true;
+                      })) {
+        std::cerr << "Invalid TCP_NODELAY list: " << optarg << std::endl;
+        return 1;
+      }
+      break;
+    case OPT_SNDBUF:
+    case OPT_RCVBUF:
+      if (!parse_list(optarg,
+                      opt == OPT_SNDBUF ? sock_lists.sndbuf
+                                        : sock_lists.rcvbuf,
+                      [](const std::string &v, int &bytes) {
+                        uint64_t n = v == "auto" ? 0 : parse_size(v.c_str());
+                        bytes = static_cast<int>(n);
+                        return v == "auto" || (n > 0 && n <= INT32_MAX);
+                      })) {
+        std::cerr << "Invalid buffer size list: " << optarg << std::endl;
+        return 1;
+      }
+      break;
+    case OPT_BUSY_POLL:
+      if (!parse_list(optarg, sock_lists.busy_poll,
+                      [](const std::string &v, int &usec) {
+                        char *end;
+                        long n = strtol(v.c_str(), &end, 10);
+                        usec = static_cast<int>(n);
+                        return !v.empty() && *end == '\0' && n >= 0 &&
+                               n <= INT32_MAX;
+                      })) {
+        std::cerr << "Invalid busy-poll list: " << optarg << std::endl;
+        return 1;
+      }
+      break;
+    case OPT_QUICKACK:
+    case OPT_CORK:
+      if (!parse_list(optarg,
+                      opt == OPT_QUICKACK ? sock_lists.quickack
+                                          : sock_lists.cork,
+                      [](const std::string &v, bool &on) {
+                        return parse_on_off(v, on);
+                      })) {
+        std::cerr << "Invalid on/off list: " << optarg << std::endl;
+        return 1;
+      }
+      break;
+    case OPT_RANK_BY:
+      if (!parse_rank_metric(optarg, rank_by)) {
+        std::cerr << "Unknown ranking metric: " << optarg << std::endl;
+        print_usage(argv[0]);
+        return 1;
+      }
+      rank_by_set = true;
+      break;
+    case OPT_RATE:
+      cfg.rate = parse_rate(optarg);
+      if (cfg.rate == 0) {
+        std::cerr << "Invalid rate: " << optarg << std::endl;
+        return 1;
+      }
+      break;
+    case OPT_PACING:
+      if (strcmp(optarg, "spin") == 0) {
+        cfg.spin_pacing = true;
+      } else if (strcmp(optarg, "sleep") == 0) {
+        cfg.spin_pacing = false;
+      } else {
+        std::cerr << "Unknown pacing: " << optarg << std::endl;
+        print_usage(argv[0]);
+        return 1;
+      }
+      break;
+    case OPT_RAMP:
+      ramp = parse_sweep(optarg, parse_rate);
+      if (ramp.empty()) {
+        std::cerr << "Invalid ramp: " << optarg << std::endl;
+        return 1;
+      }
+      break;
+    case OPT_P99_LIMIT:
+      p99_limit = parse_duration_ns(optarg);
+      if (p99_limit == 0) {
+        std::cerr << "Invalid p99 limit: " << optarg << std::endl;
+        return 1;
+      }
+      break;
+    case OPT_PAGES:
+      if (!parse_pages(optarg, cfg.buffers.pages)) {
+        std::cerr << "Unknown page kind: " << optarg << std::endl;
+        print_usage(argv[0]);
+        return 1;
+      }
+      break;
+    case OPT_NUMA:
+      if (!parse_numa(optarg, cfg.buffers.numa)) {
+        std::cerr << "Unknown NUMA placement: " << optarg << std::endl;
+        print_usage(argv[0]);
+        return 1;
+      }
+      break;
+    case OPT_POPULATE:
+      cfg.buffers.populate = true;
+      break;
+    case OPT_BUFFER_POOL:
+      cfg.buffers.pool = atoi(optarg);
+      if (cfg.buffers.pool <= 0) {
+        std::cerr << "Invalid buffer pool size: " << optarg << std::endl;
+        return 1;
+      }
       break;
     case '4':
-      use_ipv6 = false;
+      cfg.use_ipv6 = false;
       break;
     case '6':
-      use_ipv6 = true;
+      cfg.use_ipv6 = true;
       break;
     case 'h':
       print_usage(argv[0]);
@@ -283,25 +1708,263 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  if (buffer_size < 1) {
+  if (cfg.buffer_size < 1) {
     std::cerr << "Buffer size must be positive." << std::endl;
     return 1;
   }
 
-  if (num_iter < 1) {
+  if (cfg.num_iter < 1) {
     std::cerr << "Number of iterations must be positive." << std::endl;
     return 1;
   }
 
-  std::cout << "Using buffer_size=" << buffer_size
-            << " bytes, num_iter=" << num_iter << ", "
-            << (use_ipv6 ? "IPv6" : "IPv4") << std::endl;
+  if (cfg.reply_size < 0) {
+    std::cerr << "Reply size must not be negative." << std::endl;
+    return 1;
+  }
 
-  std::thread serv(server_thread, port, buffer_size, num_iter, use_ipv6);
-  std::thread cli(client_thread, port, buffer_size, num_iter, use_ipv6);
+  if (cfg.warmup < 0) {
+    std::cerr << "Warmup count must not be negative." << std::endl;
+    return 1;
+  }
 
-  serv.join();
-  cli.join();
+  if (cfg.connections < 1) {
+    std::cerr << "Number of connections must be positive." << std::endl;
+    return 1;
+  }
+
+  if (cfg.engine.uring_depth < 1) {
+    std::cerr << "io_uring depth must be positive." << std::endl;
+    return 1;
+  }
+
+  if (cfg.engine.tx != tx_kind::copy &&
+      cfg.engine.kind != engine_kind::blocking) {
+    std::cerr << "Transmit path " << tx_name(cfg.engine.tx)
+              << " requires the blocking engine." << std::endl;
+    return 1;
+  }
+
+  size_t ring = cfg.transport.shm_ring_size;
+  if (ring < 4096 || (ring & (ring - 1)) != 0) {
+    std::cerr << "shm ring size must be a power of two of at least 4K."
+              << std::endl;
+    return 1;
+  }
+
+  if (cfg.transport.kind == transport_kind::shm &&
+      (cfg.engine.kind != engine_kind::blocking ||
+       cfg.engine.tx != tx_kind::copy)) {
+    std::cerr << "The shm transport has its own engine; it cannot be "
+                 "combined with -e or -t."
+              << std::endl;
+    return 1;
+  }
+
+  if (cfg.engine.tx == tx_kind::zerocopy &&
+      cfg.transport.kind != transport_kind::tcp) {
+    std::cerr << "MSG_ZEROCOPY requires the tcp transport." << std::endl;
+    return 1;
+  }
+
+  socket_option_lists defaults;
+  bool tcp_only = sock_lists.nodelay != defaults.nodelay ||
+                  sock_lists.quickack != defaults.quickack ||
+                  sock_lists.cork != defaults.cork;
+  if (tcp_only && !is_tcp(cfg)) {
+    std::cerr << "TCP_NODELAY, TCP_QUICKACK and TCP_CORK require the tcp "
+                 "transport."
+              << std::endl;
+    return 1;
+  }
+  if (sock_lists.tuned() && (cfg.transport.kind == transport_kind::pipe ||
+                             cfg.transport.kind == transport_kind::shm)) {
+    std::cerr << "Socket options require a socket transport." << std::endl;
+    return 1;
+  }
+
+  if ((cfg.rate > 0 || !ramp.empty()) && cfg.mode != bench_mode::rr) {
+    std::cerr << "Open loop (--rate, --ramp) requires rr mode." << std::endl;
+    return 1;
+  }
+  if (!ramp.empty() && (cfg.rate > 0 || p99_limit == 0)) {
+    std::cerr << "--ramp replaces --rate and requires --p99-limit."
+              << std::endl;
+    return 1;
+  }
+  if (p99_limit > 0 && ramp.empty()) {
+    std::cerr << "--p99-limit only applies to --ramp." << std::endl;
+    return 1;
+  }
+  uint64_t min_rate = ramp.empty() ? cfg.rate : ramp.front();
+  if (min_rate > 0 && min_rate < static_cast<uint64_t>(cfg.connections)) {
+    std::cerr << "Rate must be at least one request per second and "
+                 "connection."
+              << std::endl;
+    return 1;
+  }
+  if (cfg.spin_pacing && (cfg.rate > 0 || !ramp.empty()) &&
+      cfg.client_cpus.size() < 2 * static_cast<size_t>(cfg.connections)) {
+    std::cerr << "--pacing spin needs two --client-cpus per connection, one "
+                 "for the sender and one for the receiver."
+              << std::endl;
+    return 1;
+  }
+
+  std::vector<socket_options> combos = sock_lists.expand();
+  bool matrix = combos.size() > 1;
+  cfg.quiet = matrix;
+  cfg.sock_labels = sock_lists.tuned();
+  if (!rank_by_set && cfg.mode == bench_mode::rr)
+    rank_by = rank_metric::p99;
+
+  if (cfg.sizes.empty())
+    cfg.sizes = {cfg.buffer_size};
+  bool sweeping = cfg.sizes.size() > 1;
+
+  if (cfg.transport.kind == transport_kind::unix_seqpacket) {
+    size_t len = max_message_len(cfg);
+    for (int sndbuf : sock_lists.sndbuf) {
+      if (!seqpacket_fits(len, sndbuf)) {
+        std::cerr << "seqpacket messages of " << len << " bytes exceed the "
+                  << (sndbuf > 0 ? "--sndbuf " + std::to_string(sndbuf)
+                                 : std::string("default"))
+                  << " socket send buffer; use smaller sizes or a larger "
+                     "--sndbuf."
+                  << std::endl;
+        return 1;
+      }
+    }
+    if (cfg.engine.uring_multishot && len > uring_multishot_buffer_max) {
+      std::cerr << "--uring-multishot receives at most "
+                << uring_multishot_buffer_max << " bytes per completion, "
+                << "which would truncate seqpacket messages of " << len
+                << " bytes." << std::endl;
+      return 1;
+    }
+  }
+
+  if (cfg.format == output_format::text) {
+    std::cout << "Using buffer_size=";
+    if (sweeping)
+      std::cout << cfg.sizes.front() << ".." << cfg.sizes.back() << " ("
+                << cfg.sizes.size() << " sizes)";
+    else
+      std::cout << cfg.sizes[0];
+    std::cout << " bytes, ";
+    if (cfg.sweep_bytes)
+      std::cout << "sweep_bytes=" << cfg.sweep_bytes;
+    else
+      std::cout << "num_iter=" << cfg.num_iter;
+    if (cfg.transport.kind == transport_kind::tcp)
+      std::cout << ", " << (cfg.use_ipv6 ? "IPv6" : "IPv4");
+    else
+      std::cout << ", transport=" << transport_name(cfg.transport.kind);
+    if (cfg.transport.kind == transport_kind::shm)
+      std::cout << " (" << shm_wait_name(cfg.transport.shm_wait) << ", "
+                << cfg.transport.shm_ring_size << " byte rings)";
+    if (cfg.mode == bench_mode::rr) {
+      std::cout << ", rr reply_size=";
+      if (cfg.reply_size > 0)
+        std::cout << cfg.reply_size << " bytes";
+      else
+        std::cout << "request size";
+    }
+    if (cfg.warmup > 0)
+      std::cout << ", warmup=" << cfg.warmup;
+    if (cfg.connections > 1)
+      std::cout << ", connections=" << cfg.connections;
+    if (cfg.transport.kind != transport_kind::shm)
+      std::cout << ", engine=" << engine_name(cfg.engine.kind);
+    if (cfg.engine.tx != tx_kind::copy)
+      std::cout << ", tx=" << tx_name(cfg.engine.tx);
+    if (cfg.rate > 0)
+      std::cout << ", open loop at " << cfg.rate << " rt/s";
+    if (!ramp.empty())
+      std::cout << ", open loop ramp " << ramp.front() << ".." << ramp.back()
+                << " rt/s until p99 > " << p99_limit << " ns";
+    if (!buffer_options_default(cfg.buffers)) {
+      for (const auto &label : buffer_labels(cfg.buffers))
+        std::cout << ", " << label.first << "=" << label.second;
+    }
+    if (matrix) {
+      std::cout << ", " << combos.size() << " socket option combinations";
+    } else if (cfg.sock_labels) {
+      for (const auto &label : socket_option_labels(combos[0]))
+        std::cout << ", " << label.first << "=" << label.second;
+    }
+    std::cout << std::endl;
+  }
+
+  // Measures one configuration and returns its records, one per size.
+  auto measure = [](const bench_config &run) {
+    // Either one set of connections runs every size back to back, or each
+    // size gets its own run so that no socket state carries over.
+    std::vector<std::vector<conn_result>> results;
+    if (run.reconnect) {
+      for (int size : run.sizes) {
+        bench_config one = run;
+        one.sizes = {size};
+        results.push_back(std::move(run_once(one)[0]));
+      }
+    } else {
+      results = run_once(run);
+    }
+
+    std::vector<run_record> recs;
+    for (size_t k = 0; k < run.sizes.size(); ++k) {
+      latency_histogram hist;
+      recs.push_back(summarize(run, run.sizes[k], results[k], hist));
+      if (text_output(run) && run.connections > 1)
+        print_summary(run, recs.back(), hist);
+    }
+    return recs;
+  };
+
+  // Socket options are set at connect time, so every combination runs on
+  // its own connections. A ramp steps the open loop rate up until the p99
+  // of any size exceeds the limit.
+  std::vector<run_record> records;
+  for (const socket_options &combo : combos) {
+    bench_config run = cfg;
+    run.sock = combo;
+    if (ramp.empty()) {
+      for (auto &rec : measure(run))
+        records.push_back(rec);
+      continue;
+    }
+
+    uint64_t good_rate = 0;
+    bool exceeded = false;
+    for (int rate : ramp) {
+      run.rate = rate;
+      uint64_t worst_p99 = 0;
+      for (auto &rec : measure(run)) {
+        worst_p99 = std::max(worst_p99, rec.lat_p99);
+        records.push_back(rec);
+      }
+      if (worst_p99 > p99_limit) {
+        if (cfg.format == output_format::text)
+          std::cout << "Ramp: p99 " << worst_p99 << " ns exceeds "
+                    << p99_limit << " ns at " << rate
+                    << " rt/s, highest rate within the limit: " << good_rate
+                    << " rt/s" << std::endl;
+        exceeded = true;
+        break;
+      }
+      good_rate = rate;
+    }
+    // Without a step over the limit the knee lies beyond the ramp.
+    if (!exceeded && cfg.format == output_format::text)
+      std::cout << "Ramp: p99 stayed within " << p99_limit << " ns up to "
+                << good_rate << " rt/s, the end of the ramp" << std::endl;
+  }
+
+  if (matrix)
+    rank_records(records, rank_by);
+  if (cfg.format != output_format::text || sweeping || matrix ||
+      !ramp.empty())
+    print_records(cfg.format, records, std::cout);
 
   return 0;
 }
@@ -0,0 +1,171 @@
+#include "report.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <ostream>
+#include <sstream>
+
+namespace {
+
+struct field {
+  std::string name;
+  std::string value;
+  bool quoted; // string valued in JSON
+};
+
+std::string num(uint64_t v) { return std::to_string(v); }
+
+std::string num(double v) {
+  std::ostringstream os;
+  os << std::fixed << std::setprecision(3) << v;
+  return os.str();
+}
+
+// Flattens a record into its columns. The order here is the CSV column
+// order and the JSON key order.
+std::vector<field> fields_of(const run_record &r) {
+  std::vector<field> f;
+  for (const auto &l : r.labels)
+    f.push_back({l.first, l.second, true});
+  f.push_back({"bytes", num(r.bytes), false});
+  f.push_back({"reply_bytes", num(r.reply_bytes), false});
+  f.push_back({"connections", num(static_cast<uint64_t>(r.connections)),
+               false});
+  f.push_back({"iterations", num(r.iterations), false});
+  f.push_back({"target_rate", num(r.target_rate), false});
+  f.push_back({"elapsed_ns", num(r.elapsed_ns), false});
+  f.push_back({"gbit_per_sec", num(r.gbit_per_sec), false});
+  f.push_back({"msgs_per_sec", num(r.msgs_per_sec), false});
+  f.push_back({"conn_gbit_mean", num(r.conn_gbit_mean), false});
+  f.push_back({"conn_gbit_cv_pct", num(r.conn_gbit_cv), false});
+  for (const auto &side : {std::make_pair("server", &r.server_cost),
+                           std::make_pair("client", &r.client_cost)}) {
+    std::string prefix = side.first;
+    const run_record::cpu_cost &c = *side.second;
+    f.push_back({prefix + "_cycles_per_byte", num(c.cycles_per_byte), false});
+    f.push_back({prefix + "_instructions_per_msg",
+                 num(c.instructions_per_msg), false});
+    f.push_back({prefix + "_cache_misses_per_msg",
+                 num(c.cache_misses_per_msg), false});
+    f.push_back({prefix + "_ctx_switches_per_msg",
+                 num(c.ctx_switches_per_msg), false});
+    f.push_back({prefix + "_cpu_ns_per_msg", num(c.cpu_ns_per_msg), false});
+  }
+  f.push_back({"lat_min_ns", num(r.lat_min), false});
+  f.push_back({"lat_p50_ns", num(r.lat_p50), false});
+  f.push_back({"lat_p90_ns", num(r.lat_p90), false});
+  f.push_back({"lat_p99_ns", num(r.lat_p99), false});
+  f.push_back({"lat_p999_ns", num(r.lat_p999), false});
+  f.push_back({"lat_max_ns", num(r.lat_max), false});
+  f.push_back({"lat_mean_ns", num(r.lat_mean), false});
+  return f;
+}
+
+std::string json_escape(const std::string &s) {
+  std::string out;
+  for (char c : s) {
+    if (c == '"' || c == '\\')
+      out += '\\';
+    out += c;
+  }
+  return out;
+}
+
+} // namespace
+
+const char *format_name(output_format format) {
+  switch (format) {
+  case output_format::json:
+    return "json";
+  case output_format::csv:
+    return "csv";
+  case output_format::text:
+  default:
+    return "text";
+  }
+}
+
+bool parse_format(const char *name, output_format &format) {
+  for (output_format f :
+       {output_format::text, output_format::json, output_format::csv}) {
+    if (strcmp(name, format_name(f)) == 0) {
+      format = f;
+      return true;
+    }
+  }
+  return false;
+}
+
+void print_records(output_format format, const std::vector<run_record> &recs,
+                   std::ostream &os) {
+  if (recs.empty())
+    return;
+
+  if (format == output_format::json) {
+    for (const auto &r : recs) {
+      const char *sep = "{";
+      for (const auto &f : fields_of(r)) {
+        os << sep << '"' << f.name << "\":";
+        if (f.quoted)
+          os << '"' << json_escape(f.value) << '"';
+        else
+          os << f.value;
+        sep = ",";
+      }
+      os << "}\n";
+    }
+    os.flush();
+    return;
+  }
+
+  std::vector<std::vector<field>> rows;
+  for (const auto &r : recs)
+    rows.push_back(fields_of(r));
+
+  if (format == output_format::csv) {
+    const char *sep = "";
+    for (const auto &f : rows[0]) {
+      os << sep << f.name;
+      sep = ",";
+    }
+    os << "\n";
+    for (const auto &row : rows) {
+      sep = "";
+      for (const auto &f : row) {
+        os << sep << f.value;
+        sep = ",";
+      }
+      os << "\n";
+    }
+    os.flush();
+    return;
+  }
+
+  // Text: right-aligned table. Numeric columns that are zero in every row
+  // (latency of a stream run, say) are left out to keep it readable.
+  std::vector<size_t> cols;
+  std::vector<size_t> width;
+  for (size_t c = 0; c < rows[0].size(); ++c) {
+    bool used = rows[0][c].quoted;
+    size_t w = rows[0][c].name.size();
+    for (const auto &row : rows) {
+      used = used || std::strtod(row[c].value.c_str(), nullptr) != 0.0;
+      w = std::max(w, row[c].value.size());
+    }
+    if (used) {
+      cols.push_back(c);
+      width.push_back(w);
+    }
+  }
+  for (size_t i = 0; i < cols.size(); ++i)
+    os << (i ? "  " : "") << std::setw(width[i]) << rows[0][cols[i]].name;
+  os << "\n";
+  for (const auto &row : rows) {
+    for (size_t i = 0; i < cols.size(); ++i)
+      os << (i ? "  " : "") << std::setw(width[i]) << row[cols[i]].value;
+    os << "\n";
+  }
+  os.flush();
+}
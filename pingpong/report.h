@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum class output_format {
+  text, // human readable lines from every thread plus summaries
+  json, // one JSON object per record and line (JSON Lines)
+  csv,  // header line followed by one row per record
+};
+
+// One measured configuration, aggregated over all connections.
+struct run_record {
+  // Leading string columns describing the configuration, e.g. mode, engine.
+  // Every record of one run must carry the same keys in the same order.
+  std::vector<std::pair<std::string, std::string>> labels;
+
+  uint64_t bytes = 0;       // message (stream) or request (rr) size
+  uint64_t reply_bytes = 0; // rr reply size, 0 for stream
+  uint64_t iterations = 0;  // timed messages per connection
+  uint64_t target_rate = 0; // open loop requests per second, 0 closed loop
+  int connections = 0;
+  uint64_t elapsed_ns = 0;  // union of the per-connection timed intervals
+  double gbit_per_sec = 0;  // aggregate payload rate, both directions for rr
+  double msgs_per_sec = 0;  // messages or round trips per second
+  double conn_gbit_mean = 0;
+  double conn_gbit_cv = 0; // coefficient of variation across connections, %
+
+  // CPU cost of each side summed over connections. Cycles, instructions and
+  // cache misses need perf counters and stay 0 without them; context
+  // switches and CPU time fall back to getrusage. The server side includes
+  // rr warmup in both its cost and its message count.
+  struct cpu_cost {
+    double cycles_per_byte = 0;
+    double instructions_per_msg = 0;
+    double cache_misses_per_msg = 0;
+    double ctx_switches_per_msg = 0;
+    double cpu_ns_per_msg = 0;
+  };
+  cpu_cost server_cost;
+  cpu_cost client_cost;
+
+  // Round-trip latency in ns, all zero for stream runs. Open loop runs count
+  // from the scheduled send time.
+  uint64_t lat_min = 0, lat_p50 = 0, lat_p90 = 0, lat_p99 = 0, lat_p999 = 0,
+           lat_max = 0;
+  double lat_mean = 0;
+};
+
+const char *format_name(output_format format);
+bool parse_format(const char *name, output_format &format);
+
+// Writes the records in the requested format. The text format is an aligned
+// table meant to close a human readable run.
+void print_records(output_format format, const std::vector<run_record> &recs,
+                   std::ostream &os);
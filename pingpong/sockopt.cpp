@@ -0,0 +1,88 @@
+#include "sockopt.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+namespace {
+
+void set_int_option(int fd, int level, int name, int value,
+                    const char *option, const std::string &who) {
+  if (setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+    std::cerr << who << ": setsockopt(" << option << ", " << value
+              << ") failed: " << strerror(errno) << std::endl;
+    exit(1);
+  }
+}
+
+std::string on_off(bool on) { return on ? "on" : "off"; }
+
+} // namespace
+
+std::vector<socket_options> socket_option_lists::expand() const {
+  std::vector<socket_options> all;
+  for (int nd : nodelay)
+    for (int sb : sndbuf)
+      for (int rb : rcvbuf)
+        for (int bp : busy_poll)
+          for (bool qa : quickack)
+            for (bool ck : cork) {
+              socket_options o;
+              o.nodelay = nd;
+              o.sndbuf = sb;
+              o.rcvbuf = rb;
+              o.busy_poll = bp;
+              o.quickack = qa;
+              o.cork = ck;
+              all.push_back(o);
+            }
+  return all;
+}
+
+bool socket_option_lists::tuned() const {
+  socket_option_lists defaults;
+  return nodelay != defaults.nodelay || sndbuf != defaults.sndbuf ||
+         rcvbuf != defaults.rcvbuf || busy_poll != defaults.busy_poll ||
+         quickack != defaults.quickack || cork != defaults.cork;
+}
+
+void apply_socket_options(int fd, const socket_options &opts, bool tcp,
+                          bool rr, const std::string &who) {
+  if (opts.sndbuf > 0)
+    set_int_option(fd, SOL_SOCKET, SO_SNDBUF, opts.sndbuf, "SO_SNDBUF", who);
+  if (opts.rcvbuf > 0)
+    set_int_option(fd, SOL_SOCKET, SO_RCVBUF, opts.rcvbuf, "SO_RCVBUF", who);
+  if (opts.busy_poll > 0)
+    set_int_option(fd, SOL_SOCKET, SO_BUSY_POLL, opts.busy_poll,
+                   "SO_BUSY_POLL", who);
+  if (!tcp)
+    return;
+  int nodelay = opts.nodelay >= 0 ? opts.nodelay : rr;
+  if (nodelay)
+    set_int_option(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY", who);
+  if (opts.quickack)
+    set_int_option(fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK", who);
+}
+
+void set_cork(int fd, bool on, const std::string &who) {
+  set_int_option(fd, IPPROTO_TCP, TCP_CORK, on, "TCP_CORK", who);
+}
+
+// Quick-ack mode ends by itself once the kernel thinks the connection is
+// interactive, so it has to be asked for again after every receive.
+void rearm_quickack(int fd, const std::string &who) {
+  set_int_option(fd, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK", who);
+}
+
+std::vector<std::pair<std::string, std::string>>
+socket_option_labels(const socket_options &opts) {
+  return {{"nodelay", opts.nodelay < 0 ? "default" : on_off(opts.nodelay)},
+          {"sndbuf", opts.sndbuf ? std::to_string(opts.sndbuf) : "auto"},
+          {"rcvbuf", opts.rcvbuf ? std::to_string(opts.rcvbuf) : "auto"},
+          {"busy_poll", std::to_string(opts.busy_poll)},
+          {"quickack", on_off(opts.quickack)},
+          {"cork", on_off(opts.cork)}};
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// Socket tuning of one run. Everything except the buffer sizes only applies
+// to TCP.
+struct socket_options {
+  int nodelay = -1;      // TCP_NODELAY: 1 on, 0 off, -1 only in rr mode
+  int sndbuf = 0;        // SO_SNDBUF in bytes, 0 keeps kernel autotuning
+  int rcvbuf = 0;        // SO_RCVBUF in bytes, 0 keeps kernel autotuning
+  int busy_poll = 0;     // SO_BUSY_POLL in microseconds, 0 leaves it unset
+  bool quickack = false; // TCP_QUICKACK, re-armed after every rr receive
+  bool cork = false;     // TCP_CORK around every message the sender writes
+};
+
+// Every value given for each option; the runs are their Cartesian product.
+struct socket_option_lists {
+  std::vector<int> nodelay{-1};
+  std::vector<int> sndbuf{0};
+  std::vector<int> rcvbuf{0};
+  std::vector<int> busy_poll{0};
+  std::vector<bool> quickack{false};
+  std::vector<bool> cork{false};
+
+  std::vector<socket_options> expand() const;
+  bool tuned() const; // anything but the defaults requested
+};
+
+// Sets the options that stick to a socket: buffer sizes and busy-poll on any
+// socket, TCP_NODELAY and TCP_QUICKACK on TCP ones. Buffer sizes must be set
+// before connect() or listen() to affect window scaling. Exits with a
+// message if the kernel refuses an option.
+void apply_socket_options(int fd, const socket_options &opts, bool tcp,
+                          bool rr, const std::string &who);
+
+// Per message helpers for the options that do not stick.
+void set_cork(int fd, bool on, const std::string &who);
+void rearm_quickack(int fd, const std::string &who);
+
+// Label columns describing opts, for run records.
+std::vector<std::pair<std::string, std::string>>
+socket_option_labels(const socket_options &opts);
@@ -0,0 +1,370 @@
+#include "transport.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/futex.h>
+#include <new>
+#include <ostream>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// One direction of a shm connection. The producer owns tail, the consumer
+// owns head; each sits on its own cache line together with what the other
+// side polls on its fast path, so an uncontended transfer touches two lines.
+struct shm_ring {
+  // Written by the producer.
+  alignas(64) std::atomic<uint64_t> tail; // bytes published
+  std::atomic<uint32_t> data_seq;         // futex word the consumer sleeps on
+  std::atomic<uint32_t> consumer_sleeping;
+  std::atomic<uint32_t> closed; // producer is gone, EOF after the last byte
+
+  // Written by the consumer.
+  alignas(64) std::atomic<uint64_t> head; // bytes consumed
+  std::atomic<uint32_t> space_seq;        // futex word the producer sleeps on
+  std::atomic<uint32_t> producer_sleeping;
+  std::atomic<uint32_t> abandoned; // consumer is gone, sends fail with EPIPE
+};
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) &&
+                  std::atomic<uint32_t>::is_always_lock_free,
+              "futex words must be plain 32-bit integers");
+
+// Header of the shared mapping, followed by the two rings and their data.
+struct shm_channel {
+  std::atomic<int> refs; // unmapped when both ends are closed
+  size_t map_len;
+  size_t ring_size;
+  shm_wait_kind wait;
+  shm_ring *rings[2]; // rings[i] is produced into by side i
+  char *data[2];
+};
+
+namespace {
+
+// The mapping is MAP_SHARED and the futexes are not FUTEX_PRIVATE, so the
+// costs are those of two processes sharing the ring, not two threads.
+long futex(std::atomic<uint32_t> &word, int op, uint32_t val) {
+  return syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), op, val,
+                 nullptr, nullptr, 0);
+}
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield" ::: "memory");
+#endif
+}
+
+// Unconditional wakeup for close: bumping the word also fails a FUTEX_WAIT
+// that is just about to start.
+void wake_peer(std::atomic<uint32_t> &seq) {
+  seq.fetch_add(1, std::memory_order_release);
+  futex(seq, FUTEX_WAKE, 1);
+}
+
+// Byte stream over the two rings of a shm_channel. Indices only grow; the
+// position in the data area is index & (ring_size - 1). Each side caches the
+// peer's index and only re-reads it when the cached value says the ring is
+// full (or empty), which keeps the other side's cache line where it is.
+class shm_engine : public io_engine {
+public:
+  explicit shm_engine(const endpoint &ep)
+      : ch_(ep.shm), tx_(ch_->rings[ep.side]), rx_(ch_->rings[1 - ep.side]),
+        tx_data_(ch_->data[ep.side]), rx_data_(ch_->data[1 - ep.side]),
+        size_(ch_->ring_size) {
+    head_cache_ = tx_->head.load(std::memory_order_acquire);
+    tail_cache_ = rx_->tail.load(std::memory_order_acquire);
+  }
+
+  bool send_all(const char *buf, size_t len) override {
+    uint64_t tail = tx_->tail.load(std::memory_order_relaxed);
+    while (len > 0) {
+      uint64_t space = size_ - (tail - head_cache_);
+      if (space == 0) {
+        if (tx_->abandoned.load(std::memory_order_acquire)) {
+          errno = EPIPE;
+          return false;
+        }
+        head_cache_ = tx_->head.load(std::memory_order_acquire);
+        if (head_cache_ + size_ == tail) {
+          wait_until(tx_->space_seq, tx_->producer_sleeping, [&] {
+            return tx_->head.load(std::memory_order_acquire) + size_ != tail ||
+                   tx_->abandoned.load(std::memory_order_acquire);
+          });
+        }
+        continue;
+      }
+      size_t n = std::min<uint64_t>(len, space);
+      size_t pos = tail & (size_ - 1);
+      size_t first = std::min(n, size_ - pos);
+      memcpy(tx_data_ + pos, buf, first);
+      memcpy(tx_data_, buf + first, n - first);
+      tail += n;
+      tx_->tail.store(tail, std::memory_order_release);
+      notify(tx_->data_seq, tx_->consumer_sleeping);
+      buf += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  bool recv_all(char *buf, size_t len) override {
+    uint64_t head = rx_->head.load(std::memory_order_relaxed);
+    while (len > 0) {
+      uint64_t avail = tail_cache_ - head;
+      if (avail == 0) {
+        // closed is stored after the final tail, so reading it first
+        // guarantees the tail below is final if it is set.
+        bool closed = rx_->closed.load(std::memory_order_acquire);
+        tail_cache_ = rx_->tail.load(std::memory_order_acquire);
+        if (tail_cache_ == head) {
+          if (closed) {
+            errno = 0;
+            return false;
+          }
+          wait_until(rx_->data_seq, rx_->consumer_sleeping, [&] {
+            return rx_->tail.load(std::memory_order_acquire) != head ||
+                   rx_->closed.load(std::memory_order_acquire);
+          });
+        }
+        continue;
+      }
+      size_t n = std::min<uint64_t>(len, avail);
+      size_t pos = head & (size_ - 1);
+      size_t first = std::min(n, size_ - pos);
+      memcpy(buf, rx_data_ + pos, first);
+      memcpy(buf + first, rx_data_, n - first);
+      head += n;
+      rx_->head.store(head, std::memory_order_release);
+      notify(rx_->space_seq, rx_->producer_sleeping);
+      buf += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  void print_stats(std::ostream &os) const override {
+    if (ch_->wait == shm_wait_kind::futex)
+      os << ", shm " << sleeps_ << " futex sleeps, " << wakes_ << " wakes";
+    else
+      os << ", shm " << spins_ << " spins";
+  }
+
+private:
+  // Futex mode announces the sleep, then re-checks: either the peer sees the
+  // flag after publishing, or we see what it published. The sequence number
+  // closes the window between the re-check and FUTEX_WAIT.
+  template <typename F>
+  void wait_until(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &sleeping,
+                  F &&ready) {
+    if (ch_->wait == shm_wait_kind::spin) {
+      while (!ready()) {
+        cpu_relax();
+        ++spins_;
+      }
+      return;
+    }
+    for (;;) {
+      uint32_t s = seq.load(std::memory_order_acquire);
+      sleeping.store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (ready())
+        break;
+      futex(seq, FUTEX_WAIT, s);
+      ++syscalls_;
+      ++sleeps_;
+    }
+    sleeping.store(0, std::memory_order_relaxed);
+  }
+
+  void notify(std::atomic<uint32_t> &seq, std::atomic<uint32_t> &sleeping) {
+    if (ch_->wait == shm_wait_kind::spin)
+      return;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping.load(std::memory_order_relaxed) &&
+        sleeping.exchange(0, std::memory_order_relaxed)) {
+      seq.fetch_add(1, std::memory_order_release);
+      futex(seq, FUTEX_WAKE, 1);
+      ++syscalls_;
+      ++wakes_;
+    }
+  }
+
+  shm_channel *ch_;
+  shm_ring *tx_;
+  shm_ring *rx_;
+  char *tx_data_;
+  char *rx_data_;
+  size_t size_;
+  uint64_t head_cache_; // last head of tx_ we saw
+  uint64_t tail_cache_; // last tail of rx_ we saw
+  uint64_t sleeps_ = 0;
+  uint64_t wakes_ = 0;
+  uint64_t spins_ = 0;
+};
+
+void set_pipe_size(int fd, int size) {
+  if (size > 0 && fcntl(fd, F_SETPIPE_SZ, size) < 0) {
+    std::cerr << "pipe: F_SETPIPE_SZ(" << size << ") failed: "
+              << strerror(errno) << std::endl;
+    exit(1);
+  }
+}
+
+shm_channel *map_channel(const transport_options &opts) {
+  const size_t page = 4096;
+  size_t header = (sizeof(shm_channel) + page - 1) / page * page;
+  size_t ring = (sizeof(shm_ring) + page - 1) / page * page;
+  size_t len = header + 2 * (ring + opts.shm_ring_size);
+  void *p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (p == MAP_FAILED) {
+    std::cerr << "shm: mmap failed: " << strerror(errno) << std::endl;
+    exit(1);
+  }
+  // Fresh anonymous memory is zeroed, which is the initial state of every
+  // index, flag and futex word.
+  char *base = static_cast<char *>(p);
+  shm_channel *ch = new (base) shm_channel;
+  ch->refs.store(2);
+  ch->map_len = len;
+  ch->ring_size = opts.shm_ring_size;
+  ch->wait = opts.shm_wait;
+  for (int i = 0; i < 2; ++i) {
+    char *r = base + header + i * (ring + opts.shm_ring_size);
+    ch->rings[i] = new (r) shm_ring;
+    ch->data[i] = r + ring;
+  }
+  return ch;
+}
+
+} // namespace
+
+bool transport_connects(transport_kind kind) {
+  return kind == transport_kind::tcp || kind == transport_kind::unix_stream ||
+         kind == transport_kind::unix_seqpacket;
+}
+
+void make_endpoint_pair(const transport_options &opts, endpoint &a,
+                        endpoint &b) {
+  switch (opts.kind) {
+  case transport_kind::socketpair: {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+      std::cerr << "socketpair failed: " << strerror(errno) << std::endl;
+      exit(1);
+    }
+    a.rfd = a.wfd = sv[0];
+    b.rfd = b.wfd = sv[1];
+    break;
+  }
+  case transport_kind::pipe: {
+    int ab[2], ba[2];
+    if (pipe2(ab, O_CLOEXEC) < 0 || pipe2(ba, O_CLOEXEC) < 0) {
+      std::cerr << "pipe2 failed: " << strerror(errno) << std::endl;
+      exit(1);
+    }
+    set_pipe_size(ab[1], opts.pipe_size);
+    set_pipe_size(ba[1], opts.pipe_size);
+    a.wfd = ab[1];
+    b.rfd = ab[0];
+    b.wfd = ba[1];
+    a.rfd = ba[0];
+    break;
+  }
+  case transport_kind::shm:
+    a.shm = b.shm = map_channel(opts);
+    a.side = 0;
+    b.side = 1;
+    break;
+  default:
+    std::cerr << transport_name(opts.kind)
+              << " connections are not created in pairs" << std::endl;
+    exit(1);
+  }
+}
+
+void close_endpoint(const endpoint &ep) {
+  if (ep.shm == nullptr) {
+    close(ep.rfd);
+    if (ep.wfd != ep.rfd)
+      close(ep.wfd);
+    return;
+  }
+  shm_channel *ch = ep.shm;
+  shm_ring *tx = ch->rings[ep.side];
+  shm_ring *rx = ch->rings[1 - ep.side];
+  tx->closed.store(1, std::memory_order_release);
+  rx->abandoned.store(1, std::memory_order_release);
+  wake_peer(tx->data_seq);
+  wake_peer(rx->space_seq);
+  if (ch->refs.fetch_sub(1) == 1)
+    munmap(ch, ch->map_len);
+}
+
+std::unique_ptr<io_engine> make_engine(const engine_options &opts,
+                                       const endpoint &ep, char *buf,
+                                       size_t buf_len) {
+  if (ep.shm != nullptr)
+    return std::unique_ptr<io_engine>(new shm_engine(ep));
+  return make_engine(opts, ep.rfd, ep.wfd, buf, buf_len);
+}
+
+const char *transport_name(transport_kind kind) {
+  switch (kind) {
+  case transport_kind::unix_stream:
+    return "unix";
+  case transport_kind::unix_seqpacket:
+    return "seqpacket";
+  case transport_kind::socketpair:
+    return "socketpair";
+  case transport_kind::pipe:
+    return "pipe";
+  case transport_kind::shm:
+    return "shm";
+  case transport_kind::tcp:
+  default:
+    return "tcp";
+  }
+}
+
+bool parse_transport(const char *name, transport_kind &kind) {
+  for (transport_kind k :
+       {transport_kind::tcp, transport_kind::unix_stream,
+        transport_kind::unix_seqpacket, transport_kind::socketpair,
+        transport_kind::pipe, transport_kind::shm}) {
+    if (strcmp(name, transport_name(k)) == 0) {
+      kind = k;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char *shm_wait_name(shm_wait_kind kind) {
+  switch (kind) {
+  case shm_wait_kind::spin:
+    return "spin";
+  case shm_wait_kind::futex:
+  default:
+    return "futex";
+  }
+}
+
+bool parse_shm_wait(const char *name, shm_wait_kind &kind) {
+  for (shm_wait_kind k : {shm_wait_kind::futex, shm_wait_kind::spin}) {
+    if (strcmp(name, shm_wait_name(k)) == 0) {
+      kind = k;
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "io_engine.h"
+
+#include <cstddef>
+#include <memory>
+
+enum class transport_kind {
+  tcp,            // TCP over loopback, -4/-6 pick the address family
+  unix_stream,    // AF_UNIX SOCK_STREAM on an abstract address
+  unix_seqpacket, // AF_UNIX SOCK_SEQPACKET, every message is one record
+  socketpair,     // socketpair(AF_UNIX, SOCK_STREAM), no listener
+  pipe,           // one pipe per direction
+  shm,            // lock-free single-producer/single-consumer byte ring per
+                  // direction in a shared mapping
+};
+
+// How a shm ring side waits for data or space.
+enum class shm_wait_kind {
+  futex, // sleep in FUTEX_WAIT, the peer wakes us only if we are asleep
+  spin,  // busy-poll the ring indices, no syscalls at all
+};
+
+struct transport_options {
+  transport_kind kind = transport_kind::tcp;
+  shm_wait_kind shm_wait = shm_wait_kind::futex;
+  size_t shm_ring_size = 1 << 20; // bytes per direction, power of two
+  int pipe_size = 0;              // F_SETPIPE_SZ for pipes, 0 keeps default
+};
+
+struct shm_channel;
+
+// One side of an established connection. The fd based transports read from
+// rfd and write to wfd, which is the same fd for sockets. The shm transport
+// has no fds and goes through shm instead.
+struct endpoint {
+  int rfd = -1;
+  int wfd = -1;
+  shm_channel *shm = nullptr;
+  int side = 0; // which shm ring this side produces into
+};
+
+// True for the transports that are set up through listen/accept/connect;
+// the others are created as connected pairs by make_endpoint_pair().
+bool transport_connects(transport_kind kind);
+
+// Creates both ends of a socketpair, pipe or shm connection. Exits with a
+// message on failure.
+void make_endpoint_pair(const transport_options &opts, endpoint &a,
+                        endpoint &b);
+
+// Closes one end. The peer sees EOF on its next receive once everything
+// already sent was drained.
+void close_endpoint(const endpoint &ep);
+
+// Creates the engine for an endpoint: shm has its own, every other transport
+// goes through the fd engines of make_engine(opts, rfd, wfd, ...).
+std::unique_ptr<io_engine> make_engine(const engine_options &opts,
+                                       const endpoint &ep, char *buf,
+                                       size_t buf_len);
+
+const char *transport_name(transport_kind kind);
+bool parse_transport(const char *name, transport_kind &kind);
+const char *shm_wait_name(shm_wait_kind kind);
+bool parse_shm_wait(const char *name, shm_wait_kind &kind);
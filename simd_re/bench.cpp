@@ -1,8 +1,32 @@
 #include <benchmark/benchmark.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <sched.h>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "cpu_features.h"
+#include "jit.h"
+#include "perf_counters.h"
+#include "transient.h"
 
 ///////////////////////////////////////////////////////////////
 // Architecture-specific function declarations
+//
+// All kernels of the target architecture are linked in; each benchmark
+// names the extension it needs and is registered only when
+// detect_cpu_features() reports it, so one binary runs on any CPU of the
+// architecture.
 ///////////////////////////////////////////////////////////////
 
 #if defined(__x86_64__) || defined(_M_X64)
@@ -19,8 +43,7 @@ void sse2_unroll_7(std::uint64_t);
 void sse2_unroll_8(std::uint64_t);
 }
 
-// AVX / AVX2
-#ifdef __AVX__
+// AVX2
 extern "C" {
 void avx_unroll_1(std::uint64_t);
 void avx_unroll_2(std::uint64_t);
@@ -31,10 +54,8 @@ void avx_unroll_6(std::uint64_t);
 void avx_unroll_7(std::uint64_t);
 void avx_unroll_8(std::uint64_t);
 }
-#endif
 
 // AVX-512
-#ifdef __AVX512F__
 extern "C" {
 void avx512_unroll_1(std::uint64_t);
 void avx512_unroll_2(std::uint64_t);
@@ -45,7 +66,6 @@ void avx512_unroll_6(std::uint64_t);
 void avx512_unroll_7(std::uint64_t);
 void avx512_unroll_8(std::uint64_t);
 }
-#endif
 
 #endif  // x86-64
 
@@ -65,9 +85,6 @@ void neon_unroll_8(std::uint64_t);
 }
 
 // SVE
-#ifdef __ARM_FEATURE_SVE
-#include <arm_sve.h>
-
 extern "C" {
 void sve_unroll_1(std::uint64_t);
 void sve_unroll_2(std::uint64_t);
@@ -77,24 +94,174 @@ void sve_unroll_5(std::uint64_t);
 void sve_unroll_6(std::uint64_t);
 void sve_unroll_7(std::uint64_t);
 void sve_unroll_8(std::uint64_t);
+
+// Number of 32-bit lanes in the current SVE vector length (cntw)
+std::uint64_t sve_cntw();
 }
 
 static inline int sve_lane_count_32()
 {
-    // Number of active 32-bit lanes in current SVE VL
-    return svcntw();
+    return static_cast<int>(sve_cntw());
 }
-#endif  // __ARM_FEATURE_SVE
 
 #endif  // __aarch64__
 
 
+///////////////////////////////////////////////////////////////
+// Cycles
+//
+// Core cycles and retired instructions come from perf_event counters
+// (perf_counters.h), so ops/cycle holds under turbo and AVX-512 frequency
+// licenses, and GHz = cycles / thread CPU time shows the clock the kernel
+// actually ran at. Without counters, cycles are estimated from the time
+// of one add in a dependent chain of single-cycle adds, measured once at
+// startup; hw_counters is 0 then, and GHz is that estimate.
+///////////////////////////////////////////////////////////////
+
+extern "C" void calib_add_chain(std::uint64_t);
+
+// Nanoseconds per core cycle, the best of five runs of the add chain.
+static double ns_per_cycle()
+{
+    static const double value = [] {
+        constexpr std::uint64_t n = 10'000'000;
+        calib_add_chain(n);
+        double best = 1e9;
+        for (int i = 0; i < 5; ++i) {
+            const auto t0 = std::chrono::steady_clock::now();
+            calib_add_chain(n);
+            const auto t1 = std::chrono::steady_clock::now();
+            const double ns =
+                std::chrono::duration<double, std::nano>(t1 - t0).count();
+            best = std::min(best, ns / (n * 12));
+        }
+        return best;
+    }();
+    return value;
+}
+
+// Cycles of a run that took wall_ns, reporting GHz, IPC and hw_counters.
+static double cycles_of(benchmark::State& state, const perf_reading& d,
+                        double wall_ns)
+{
+    using benchmark::Counter;
+    double cycles;
+    if (d.has_cycles && d.cycles > 0) {
+        cycles = static_cast<double>(d.cycles);
+        state.counters["GHz"] =
+            Counter(cycles / d.cpu_ns, Counter::kAvgThreads);
+        if (d.has_instructions)
+            state.counters["IPC"] =
+                Counter(d.instructions / cycles, Counter::kAvgThreads);
+    } else {
+        cycles = wall_ns / ns_per_cycle();
+        state.counters["GHz"] =
+            Counter(1.0 / ns_per_cycle(), Counter::kAvgThreads);
+    }
+    state.counters["hw_counters"] =
+        Counter(d.has_cycles ? 1 : 0, Counter::kAvgThreads);
+    return cycles;
+}
+
+///////////////////////////////////////////////////////////////
+// Multi-core runs
+//
+// Every *_unroll_N benchmark is registered a second time on 2..N threads,
+// N the CPUs this process may use, with thread i pinned to the i-th of
+// them. Wide-vector frequency licenses depend on how many cores run wide
+// vectors at once, which the per-thread GHz then shows. lane_ops and
+// vec_ops are aggregate rates, lane_ops_per_core the mean per thread;
+// per-cycle figures, GHz and IPC are means over the threads.
+///////////////////////////////////////////////////////////////
+
+static const std::vector<int>& allowed_cpus()
+{
+    static const std::vector<int> cpus = [] {
+        std::vector<int> v;
+        cpu_set_t set;
+        if (sched_getaffinity(0, sizeof(set), &set) == 0)
+            for (int c = 0; c < CPU_SETSIZE; ++c)
+                if (CPU_ISSET(c, &set))
+                    v.push_back(c);
+        return v;
+    }();
+    return cpus;
+}
+
+// Pins the calling thread to a CPU while in scope; no-op for cpu < 0.
+class thread_pin {
+public:
+    explicit thread_pin(int cpu)
+    {
+        pinned_ = cpu >= 0 &&
+                  sched_getaffinity(0, sizeof(saved_), &saved_) == 0;
+        if (!pinned_)
+            return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+
+    // A thread of a multi-threaded run goes to its CPU.
+    explicit thread_pin(const benchmark::State& state)
+        : thread_pin(state.threads() > 1 && !allowed_cpus().empty()
+                         ? allowed_cpus()[state.thread_index() %
+                                          allowed_cpus().size()]
+                         : -1)
+    {
+    }
+
+    ~thread_pin()
+    {
+        if (pinned_)
+            sched_setaffinity(0, sizeof(saved_), &saved_);
+    }
+
+    thread_pin(const thread_pin&) = delete;
+    thread_pin& operator=(const thread_pin&) = delete;
+
+private:
+    cpu_set_t saved_;
+    bool pinned_;
+};
+
+///////////////////////////////////////////////////////////////
+// Registration
+///////////////////////////////////////////////////////////////
+
+// Whether the running CPU has the given cpu_features extension.
+#define HAS(feature) (detect_cpu_features().feature)
+
+// Registers fn when supported, plus its multi-core runs when asked for.
+static bool register_bench(bool supported, const char* name,
+                           void (*fn)(benchmark::State&),
+                           bool multicore = false)
+{
+    if (!supported)
+        return false;
+    benchmark::RegisterBenchmark(name, fn);
+    const int n = static_cast<int>(allowed_cpus().size());
+    if (multicore && n >= 2)
+        benchmark::RegisterBenchmark(name, fn)
+            ->DenseThreadRange(2, n)
+            ->UseRealTime();
+    return true;
+}
+
+static const bool isa_context = [] {
+    benchmark::AddCustomContext("isa",
+                                cpu_features_string(detect_cpu_features()));
+    return true;
+}();
+
 ///////////////////////////////////////////////////////////////
 // Generic SIMD benchmark macro
 //
 // - Func:          assembly function to call
 // - UNROLL_COUNT:  how many independent vector accumulators (1..8)
 // - LANES_EXPR:    number of lanes per vector (e.g., 4, 8, 16, or sve_lane_count_32())
+// - SUPPORTED:     whether the CPU runs Func, e.g. HAS(avx2)
 //
 // The assembly functions are assumed to do:
 //
@@ -103,7 +270,7 @@ static inline int sve_lane_count_32()
 //
 ///////////////////////////////////////////////////////////////
 
-#define DEFINE_SIMD_BENCH(Func, UNROLL_COUNT, LANES_EXPR)                            \
+#define DEFINE_SIMD_BENCH(Func, UNROLL_COUNT, LANES_EXPR, SUPPORTED)                 \
     static void bench_##Func(benchmark::State& state) {                              \
         constexpr std::uint64_t N = 1'000'000; /* outer loop count passed to asm */  \
         constexpr std::uint64_t inner_unroll = 8;                                    \
@@ -113,22 +280,37 @@ static inline int sve_lane_count_32()
         const double ops_per_call =                                                 \
             static_cast<double>(N) * inner_unroll * unroll_count; /* vector ops */   \
                                                                                      \
+        thread_pin pin(state);                                                       \
+        const perf_reading p0 = perf_read_thread();                                  \
+        const auto t0 = std::chrono::steady_clock::now();                            \
         for (auto _ : state) {                                                       \
             Func(N);                                                                 \
         }                                                                            \
+        const auto t1 = std::chrono::steady_clock::now();                            \
+        const perf_reading p1 = perf_read_thread();                                  \
                                                                                      \
         const double iters = static_cast<double>(state.iterations());                \
         const double total_vec_ops  = ops_per_call * iters;                          \
         const double total_lane_ops = total_vec_ops * lanes;                         \
+        const double cycles = cycles_of(                                             \
+            state, p1 - p0,                                                          \
+            std::chrono::duration<double, std::nano>(t1 - t0).count());              \
                                                                                      \
         using benchmark::Counter;                                                    \
         /* vec_ops and lane_ops will show up as X/s (rate) */                        \
         state.counters["vec_ops"]  = Counter(total_vec_ops, Counter::kIsRate);       \
         state.counters["lane_ops"] = Counter(total_lane_ops, Counter::kIsRate);      \
-        state.counters["unroll"]   = Counter(unroll_count);                          \
-        state.counters["lanes"]    = Counter(lanes);                                 \
+        state.counters["lane_ops_per_core"] =                                       \
+            Counter(total_lane_ops, Counter::kAvgThreadsRate);                       \
+        state.counters["vec_ops_per_cyc"]  =                                        \
+            Counter(total_vec_ops / cycles, Counter::kAvgThreads);                   \
+        state.counters["lane_ops_per_cyc"] =                                        \
+            Counter(total_lane_ops / cycles, Counter::kAvgThreads);                  \
+        state.counters["unroll"]   = Counter(unroll_count, Counter::kAvgThreads);    \
+        state.counters["lanes"]    = Counter(lanes, Counter::kAvgThreads);           \
     }                                                                                \
-    BENCHMARK(bench_##Func);
+    static const bool bench_##Func##_registered =                                    \
+        register_bench((SUPPORTED), "bench_" #Func, bench_##Func, true);
 
 
 ///////////////////////////////////////////////////////////////
@@ -138,38 +320,34 @@ static inline int sve_lane_count_32()
 #if defined(__x86_64__) || defined(_M_X64)
 
 // SSE2: 128-bit, 4 lanes of int32
-DEFINE_SIMD_BENCH(sse2_unroll_1, 1, 4)
-DEFINE_SIMD_BENCH(sse2_unroll_2, 2, 4)
-DEFINE_SIMD_BENCH(sse2_unroll_3, 3, 4)
-DEFINE_SIMD_BENCH(sse2_unroll_4, 4, 4)
-DEFINE_SIMD_BENCH(sse2_unroll_5, 5, 4)
-DEFINE_SIMD_BENCH(sse2_unroll_6, 6, 4)
-DEFINE_SIMD_BENCH(sse2_unroll_7, 7, 4)
-DEFINE_SIMD_BENCH(sse2_unroll_8, 8, 4)
-
-#ifdef __AVX__
-// AVX / AVX2: 256-bit, 8 lanes of int32
-DEFINE_SIMD_BENCH(avx_unroll_1, 1, 8)
-DEFINE_SIMD_BENCH(avx_unroll_2, 2, 8)
-DEFINE_SIMD_BENCH(avx_unroll_3, 3, 8)
-DEFINE_SIMD_BENCH(avx_unroll_4, 4, 8)
-DEFINE_SIMD_BENCH(avx_unroll_5, 5, 8)
-DEFINE_SIMD_BENCH(avx_unroll_6, 6, 8)
-DEFINE_SIMD_BENCH(avx_unroll_7, 7, 8)
-DEFINE_SIMD_BENCH(avx_unroll_8, 8, 8)
-#endif
+DEFINE_SIMD_BENCH(sse2_unroll_1, 1, 4, true)
+DEFINE_SIMD_BENCH(sse2_unroll_2, 2, 4, true)
+DEFINE_SIMD_BENCH(sse2_unroll_3, 3, 4, true)
+DEFINE_SIMD_BENCH(sse2_unroll_4, 4, 4, true)
+DEFINE_SIMD_BENCH(sse2_unroll_5, 5, 4, true)
+DEFINE_SIMD_BENCH(sse2_unroll_6, 6, 4, true)
+DEFINE_SIMD_BENCH(sse2_unroll_7, 7, 4, true)
+DEFINE_SIMD_BENCH(sse2_unroll_8, 8, 4, true)
+
+// AVX2: 256-bit, 8 lanes of int32
+DEFINE_SIMD_BENCH(avx_unroll_1, 1, 8, HAS(avx2))
+DEFINE_SIMD_BENCH(avx_unroll_2, 2, 8, HAS(avx2))
+DEFINE_SIMD_BENCH(avx_unroll_3, 3, 8, HAS(avx2))
+DEFINE_SIMD_BENCH(avx_unroll_4, 4, 8, HAS(avx2))
+DEFINE_SIMD_BENCH(avx_unroll_5, 5, 8, HAS(avx2))
+DEFINE_SIMD_BENCH(avx_unroll_6, 6, 8, HAS(avx2))
+DEFINE_SIMD_BENCH(avx_unroll_7, 7, 8, HAS(avx2))
+DEFINE_SIMD_BENCH(avx_unroll_8, 8, 8, HAS(avx2))
 
-#ifdef __AVX512F__
 // AVX-512: 512-bit, 16 lanes of int32
-DEFINE_SIMD_BENCH(avx512_unroll_1, 1, 16)
-DEFINE_SIMD_BENCH(avx512_unroll_2, 2, 16)
-DEFINE_SIMD_BENCH(avx512_unroll_3, 3, 16)
-DEFINE_SIMD_BENCH(avx512_unroll_4, 4, 16)
-DEFINE_SIMD_BENCH(avx512_unroll_5, 5, 16)
-DEFINE_SIMD_BENCH(avx512_unroll_6, 6, 16)
-DEFINE_SIMD_BENCH(avx512_unroll_7, 7, 16)
-DEFINE_SIMD_BENCH(avx512_unroll_8, 8, 16)
-#endif
+DEFINE_SIMD_BENCH(avx512_unroll_1, 1, 16, HAS(avx512f))
+DEFINE_SIMD_BENCH(avx512_unroll_2, 2, 16, HAS(avx512f))
+DEFINE_SIMD_BENCH(avx512_unroll_3, 3, 16, HAS(avx512f))
+DEFINE_SIMD_BENCH(avx512_unroll_4, 4, 16, HAS(avx512f))
+DEFINE_SIMD_BENCH(avx512_unroll_5, 5, 16, HAS(avx512f))
+DEFINE_SIMD_BENCH(avx512_unroll_6, 6, 16, HAS(avx512f))
+DEFINE_SIMD_BENCH(avx512_unroll_7, 7, 16, HAS(avx512f))
+DEFINE_SIMD_BENCH(avx512_unroll_8, 8, 16, HAS(avx512f))
 
 #endif  // x86-64
 
@@ -177,32 +355,694 @@ DEFINE_SIMD_BENCH(avx512_unroll_8, 8, 16)
 #if defined(__aarch64__)
 
 // NEON: 128-bit, 4 lanes of int32 (vN.4s)
-DEFINE_SIMD_BENCH(neon_unroll_1, 1, 4)
-DEFINE_SIMD_BENCH(neon_unroll_2, 2, 4)
-DEFINE_SIMD_BENCH(neon_unroll_3, 3, 4)
-DEFINE_SIMD_BENCH(neon_unroll_4, 4, 4)
-DEFINE_SIMD_BENCH(neon_unroll_5, 5, 4)
-DEFINE_SIMD_BENCH(neon_unroll_6, 6, 4)
-DEFINE_SIMD_BENCH(neon_unroll_7, 7, 4)
-DEFINE_SIMD_BENCH(neon_unroll_8, 8, 4)
-
-#ifdef __ARM_FEATURE_SVE
-// SVE: variable-length, lanes = svcntw()
-DEFINE_SIMD_BENCH(sve_unroll_1, 1, sve_lane_count_32())
-DEFINE_SIMD_BENCH(sve_unroll_2, 2, sve_lane_count_32())
-DEFINE_SIMD_BENCH(sve_unroll_3, 3, sve_lane_count_32())
-DEFINE_SIMD_BENCH(sve_unroll_4, 4, sve_lane_count_32())
-DEFINE_SIMD_BENCH(sve_unroll_5, 5, sve_lane_count_32())
-DEFINE_SIMD_BENCH(sve_unroll_6, 6, sve_lane_count_32())
-DEFINE_SIMD_BENCH(sve_unroll_7, 7, sve_lane_count_32())
-DEFINE_SIMD_BENCH(sve_unroll_8, 8, sve_lane_count_32())
-#endif  // __ARM_FEATURE_SVE
+DEFINE_SIMD_BENCH(neon_unroll_1, 1, 4, true)
+DEFINE_SIMD_BENCH(neon_unroll_2, 2, 4, true)
+DEFINE_SIMD_BENCH(neon_unroll_3, 3, 4, true)
+DEFINE_SIMD_BENCH(neon_unroll_4, 4, 4, true)
+DEFINE_SIMD_BENCH(neon_unroll_5, 5, 4, true)
+DEFINE_SIMD_BENCH(neon_unroll_6, 6, 4, true)
+DEFINE_SIMD_BENCH(neon_unroll_7, 7, 4, true)
+DEFINE_SIMD_BENCH(neon_unroll_8, 8, 4, true)
+
+// SVE: variable-length, lanes = cntw
+DEFINE_SIMD_BENCH(sve_unroll_1, 1, sve_lane_count_32(), HAS(sve))
+DEFINE_SIMD_BENCH(sve_unroll_2, 2, sve_lane_count_32(), HAS(sve))
+DEFINE_SIMD_BENCH(sve_unroll_3, 3, sve_lane_count_32(), HAS(sve))
+DEFINE_SIMD_BENCH(sve_unroll_4, 4, sve_lane_count_32(), HAS(sve))
+DEFINE_SIMD_BENCH(sve_unroll_5, 5, sve_lane_count_32(), HAS(sve))
+DEFINE_SIMD_BENCH(sve_unroll_6, 6, sve_lane_count_32(), HAS(sve))
+DEFINE_SIMD_BENCH(sve_unroll_7, 7, sve_lane_count_32(), HAS(sve))
+DEFINE_SIMD_BENCH(sve_unroll_8, 8, sve_lane_count_32(), HAS(sve))
+
+#endif  // __aarch64__
+
+
+///////////////////////////////////////////////////////////////
+// Instruction characterization
+//
+// insn_<name>_lat runs 12 instructions per iteration as one dependent
+// chain: cyc_per_insn is the latency. insn_<name>_tput runs them on 12
+// independent accumulators: insn_per_cyc is the throughput. Cycles are
+// core cycles, see cycles_of().
+///////////////////////////////////////////////////////////////
+
+// Zeroed scratch memory for the load, store and gather kernels.
+alignas(4096) static unsigned char insn_scratch[4096];
+
+#define DEFINE_INSN_BENCH_KIND(Name, Kind, SUPPORTED)                                \
+    extern "C" void insn_##Name##_##Kind(std::uint64_t, void*);                      \
+    static void bench_insn_##Name##_##Kind(benchmark::State& state) {                \
+        constexpr std::uint64_t N = 100'000; /* iterations of 12 instructions */     \
+        constexpr std::uint64_t insns_per_iter = 12;                                 \
+                                                                                     \
+        const perf_reading p0 = perf_read_thread();                                  \
+        const auto t0 = std::chrono::steady_clock::now();                            \
+        for (auto _ : state) {                                                       \
+            insn_##Name##_##Kind(N, insn_scratch);                                   \
+        }                                                                            \
+        const auto t1 = std::chrono::steady_clock::now();                            \
+        const perf_reading p1 = perf_read_thread();                                  \
+                                                                                     \
+        const double insns = static_cast<double>(state.iterations()) * N *           \
+                             insns_per_iter;                                         \
+        const double cycles = cycles_of(                                             \
+            state, p1 - p0,                                                          \
+            std::chrono::duration<double, std::nano>(t1 - t0).count());              \
+                                                                                     \
+        using benchmark::Counter;                                                    \
+        state.counters["insns"]        = Counter(insns, Counter::kIsRate);           \
+        state.counters["cyc_per_insn"] = Counter(cycles / insns);                    \
+        state.counters["insn_per_cyc"] = Counter(insns / cycles);                    \
+    }                                                                                \
+    static const bool bench_insn_##Name##_##Kind##_registered =                      \
+        register_bench((SUPPORTED), "bench_insn_" #Name "_" #Kind,                   \
+                       bench_insn_##Name##_##Kind);
+
+// Latency and throughput kernels, or throughput alone.
+#define DEFINE_INSN_BENCH(Name, SUPPORTED)        \
+    DEFINE_INSN_BENCH_KIND(Name, lat, SUPPORTED)  \
+    DEFINE_INSN_BENCH_KIND(Name, tput, SUPPORTED)
+#define DEFINE_INSN_TPUT_BENCH(Name, SUPPORTED) \
+    DEFINE_INSN_BENCH_KIND(Name, tput, SUPPORTED)
+
+// Scalar load-to-use latency, for reference next to the vector loads
+DEFINE_INSN_BENCH_KIND(load_gpr, lat, true)
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+DEFINE_INSN_BENCH(sse_paddd, true)
+DEFINE_INSN_BENCH(sse_mulps, true)
+DEFINE_INSN_BENCH(sse_pshufd, true)
+DEFINE_INSN_BENCH(sse_pcmpgtd, true)
+DEFINE_INSN_TPUT_BENCH(sse_load, true)
+DEFINE_INSN_TPUT_BENCH(sse_store, true)
+DEFINE_INSN_BENCH(sse_pmulld, HAS(sse4_1))
+DEFINE_INSN_BENCH(sse_pblendw, HAS(sse4_1))
+
+DEFINE_INSN_BENCH(avx_vpaddd, HAS(avx2))
+DEFINE_INSN_BENCH(avx_vpmulld, HAS(avx2))
+DEFINE_INSN_BENCH(avx_vmulps, HAS(avx2))
+DEFINE_INSN_BENCH(avx_vfmadd231ps, HAS(fma))
+DEFINE_INSN_BENCH(avx_vpshufd, HAS(avx2))
+DEFINE_INSN_BENCH(avx_vpermd, HAS(avx2))
+DEFINE_INSN_BENCH(avx_vpcmpgtd, HAS(avx2))
+DEFINE_INSN_BENCH(avx_vpblendvb, HAS(avx2))
+DEFINE_INSN_BENCH(avx_vpgatherdd, HAS(avx2))
+DEFINE_INSN_TPUT_BENCH(avx_load, HAS(avx2))
+DEFINE_INSN_TPUT_BENCH(avx_store, HAS(avx2))
+DEFINE_INSN_BENCH(avx_store_load, HAS(avx2))
+
+DEFINE_INSN_BENCH(avx512_vpaddd, HAS(avx512f))
+DEFINE_INSN_BENCH(avx512_vpmulld, HAS(avx512f))
+DEFINE_INSN_BENCH(avx512_vmulps, HAS(avx512f))
+DEFINE_INSN_BENCH(avx512_vfmadd231ps, HAS(avx512f))
+DEFINE_INSN_BENCH(avx512_vpshufd, HAS(avx512f))
+DEFINE_INSN_BENCH(avx512_vpermd, HAS(avx512f))
+DEFINE_INSN_BENCH(avx512_vpermt2d, HAS(avx512f))
+DEFINE_INSN_TPUT_BENCH(avx512_vpcmpgtd, HAS(avx512f))
+DEFINE_INSN_BENCH(avx512_vpblendmd, HAS(avx512f))
+DEFINE_INSN_BENCH(avx512_vpgatherdd, HAS(avx512f))
+DEFINE_INSN_TPUT_BENCH(avx512_load, HAS(avx512f))
+DEFINE_INSN_TPUT_BENCH(avx512_store, HAS(avx512f))
+DEFINE_INSN_BENCH(avx512_store_load, HAS(avx512f))
+
+#endif  // x86-64
+
+
+#if defined(__aarch64__)
+
+DEFINE_INSN_BENCH(neon_add, true)
+DEFINE_INSN_BENCH(neon_mul, true)
+DEFINE_INSN_BENCH(neon_fmul, true)
+DEFINE_INSN_BENCH(neon_fmla, true)
+DEFINE_INSN_BENCH(neon_tbl, true)
+DEFINE_INSN_BENCH(neon_zip1, true)
+DEFINE_INSN_BENCH(neon_cmgt, true)
+DEFINE_INSN_BENCH(neon_bsl, true)
+DEFINE_INSN_TPUT_BENCH(neon_load, true)
+DEFINE_INSN_TPUT_BENCH(neon_store, true)
+DEFINE_INSN_BENCH(neon_store_load, true)
+
+DEFINE_INSN_BENCH(sve_add, HAS(sve))
+DEFINE_INSN_BENCH(sve_mul, HAS(sve))
+DEFINE_INSN_BENCH(sve_fmul, HAS(sve))
+DEFINE_INSN_BENCH(sve_fmla, HAS(sve))
+DEFINE_INSN_BENCH(sve_tbl, HAS(sve))
+DEFINE_INSN_BENCH(sve_zip1, HAS(sve))
+DEFINE_INSN_TPUT_BENCH(sve_cmpgt, HAS(sve))
+DEFINE_INSN_BENCH(sve_sel, HAS(sve))
+DEFINE_INSN_BENCH(sve_gather, HAS(sve))
+DEFINE_INSN_TPUT_BENCH(sve_load, HAS(sve))
+DEFINE_INSN_TPUT_BENCH(sve_store, HAS(sve))
+DEFINE_INSN_BENCH(sve_store_load, HAS(sve))
+
+#endif  // __aarch64__
+
+
+///////////////////////////////////////////////////////////////
+// Memory-bound kernels
+//
+// mem_<isa>_<kind>_unroll_<n> streams loads, stores or load+add+store
+// (rmw) through a buffer sized for one level: half of each data cache,
+// and four times the last one, at least 64 MiB, for DRAM. The level is
+// in the name and the label. bytes counts bytes loaded plus bytes
+// stored, so rmw moves the buffer twice per pass; bytes_per_cyc is per
+// core cycle, see cycles_of().
+///////////////////////////////////////////////////////////////
+
+enum class mem_kind { load, store, rmw };
+
+struct mem_size {
+    std::int64_t bytes;
+    int level;  // cache level 1..3, 4 for DRAM
+};
+
+// Buffer size per level, from the caches Google Benchmark found.
+static const std::vector<mem_size>& mem_sizes()
+{
+    static const std::vector<mem_size> sizes = [] {
+        std::vector<mem_size> v;
+        std::int64_t below = 0;  // size of the level below
+        for (const auto& c : benchmark::CPUInfo::Get().caches) {
+            if (c.type == "Instruction" || c.level < 1 || c.level > 3)
+                continue;
+            const std::int64_t bytes = c.size / 2 / 4096 * 4096;
+            if (bytes > below) {
+                v.push_back({bytes, c.level});
+                below = c.size;
+            }
+        }
+        v.push_back({std::max<std::int64_t>(4 * below, 64 << 20), 4});
+        return v;
+    }();
+    return sizes;
+}
+
+static const char* mem_level_name(std::int64_t level)
+{
+    static const char* const names[] = {"L1d", "L2", "L3", "DRAM"};
+    return level >= 1 && level <= 4 ? names[level - 1] : "?";
+}
+
+// One buffer of the DRAM size for all runs, written once so that page
+// faults stay out of the timing; null when it can't be allocated.
+static unsigned char* mem_buffer()
+{
+    static unsigned char* const buf = [] {
+        const std::size_t bytes = mem_sizes().back().bytes;
+        auto* p = static_cast<unsigned char*>(std::aligned_alloc(4096, bytes));
+        if (p != nullptr)
+            std::memset(p, 0, bytes);
+        return p;
+    }();
+    return buf;
+}
+
+static void run_mem_bench(benchmark::State& state,
+                          void (*kernel)(std::uint64_t, void*, std::uint64_t),
+                          std::uint64_t unroll, std::uint64_t vector_bytes,
+                          mem_kind kind)
+{
+    unsigned char* const buf = mem_buffer();
+    if (buf == nullptr) {
+        state.SkipWithError("cannot allocate the DRAM-sized buffer");
+        return;
+    }
+    const std::uint64_t block = unroll * vector_bytes;
+    const std::uint64_t blocks = std::max<std::uint64_t>(
+        static_cast<std::uint64_t>(state.range(0)) / block, 1);
+    // Enough passes for some 64 MiB of traffic per call.
+    const std::uint64_t passes =
+        std::max<std::uint64_t>((std::uint64_t{64} << 20) / (blocks * block), 1);
+    const double bytes_per_call = static_cast<double>(passes * blocks * block) *
+                                  (kind == mem_kind::rmw ? 2 : 1);
+
+    const perf_reading p0 = perf_read_thread();
+    const auto t0 = std::chrono::steady_clock::now();
+    for (auto _ : state) {
+        kernel(passes, buf, blocks);
+    }
+    const auto t1 = std::chrono::steady_clock::now();
+    const perf_reading p1 = perf_read_thread();
+
+    const double bytes = bytes_per_call * static_cast<double>(state.iterations());
+    const double cycles = cycles_of(
+        state, p1 - p0,
+        std::chrono::duration<double, std::nano>(t1 - t0).count());
+
+    using benchmark::Counter;
+    state.SetLabel(mem_level_name(state.range(1)));
+    state.counters["bytes"]         = Counter(bytes, Counter::kIsRate);
+    state.counters["bytes_per_cyc"] = Counter(bytes / cycles);
+    state.counters["unroll"]        = Counter(static_cast<double>(unroll));
+}
+
+// Registers fn once per buffer size when supported.
+static bool register_mem_bench(bool supported, const char* name,
+                               void (*fn)(benchmark::State&))
+{
+    if (!supported)
+        return false;
+    benchmark::internal::Benchmark* b =
+        benchmark::RegisterBenchmark(name, fn)->ArgNames({"bytes", "level"});
+    for (const mem_size& m : mem_sizes())
+        b->Args({m.bytes, m.level});
+    return true;
+}
+
+#define DEFINE_MEM_BENCH(Isa, Kind, N, VECTOR_BYTES, SUPPORTED)                      \
+    extern "C" void mem_##Isa##_##Kind##_unroll_##N(std::uint64_t, void*,            \
+                                                     std::uint64_t);                 \
+    static void bench_mem_##Isa##_##Kind##_unroll_##N(benchmark::State& state) {     \
+        run_mem_bench(state, mem_##Isa##_##Kind##_unroll_##N, N, (VECTOR_BYTES),     \
+                      mem_kind::Kind);                                               \
+    }                                                                                \
+    static const bool bench_mem_##Isa##_##Kind##_unroll_##N##_registered =           \
+        register_mem_bench((SUPPORTED), "bench_mem_" #Isa "_" #Kind "_unroll_" #N,   \
+                           bench_mem_##Isa##_##Kind##_unroll_##N);
+
+// Unroll levels 1..8 of one access kind.
+#define DEFINE_MEM_BENCHES(Isa, Kind, VECTOR_BYTES, SUPPORTED)  \
+    DEFINE_MEM_BENCH(Isa, Kind, 1, VECTOR_BYTES, SUPPORTED)     \
+    DEFINE_MEM_BENCH(Isa, Kind, 2, VECTOR_BYTES, SUPPORTED)     \
+    DEFINE_MEM_BENCH(Isa, Kind, 3, VECTOR_BYTES, SUPPORTED)     \
+    DEFINE_MEM_BENCH(Isa, Kind, 4, VECTOR_BYTES, SUPPORTED)     \
+    DEFINE_MEM_BENCH(Isa, Kind, 5, VECTOR_BYTES, SUPPORTED)     \
+    DEFINE_MEM_BENCH(Isa, Kind, 6, VECTOR_BYTES, SUPPORTED)     \
+    DEFINE_MEM_BENCH(Isa, Kind, 7, VECTOR_BYTES, SUPPORTED)     \
+    DEFINE_MEM_BENCH(Isa, Kind, 8, VECTOR_BYTES, SUPPORTED)
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+DEFINE_MEM_BENCHES(sse, load,  16, true)
+DEFINE_MEM_BENCHES(sse, store, 16, true)
+DEFINE_MEM_BENCHES(sse, rmw,   16, true)
+
+DEFINE_MEM_BENCHES(avx, load,  32, HAS(avx2))
+DEFINE_MEM_BENCHES(avx, store, 32, HAS(avx2))
+DEFINE_MEM_BENCHES(avx, rmw,   32, HAS(avx2))
+
+DEFINE_MEM_BENCHES(avx512, load,  64, HAS(avx512f))
+DEFINE_MEM_BENCHES(avx512, store, 64, HAS(avx512f))
+DEFINE_MEM_BENCHES(avx512, rmw,   64, HAS(avx512f))
+
+#endif  // x86-64
+
+
+#if defined(__aarch64__)
+
+DEFINE_MEM_BENCHES(neon, load,  16, true)
+DEFINE_MEM_BENCHES(neon, store, 16, true)
+DEFINE_MEM_BENCHES(neon, rmw,   16, true)
+
+DEFINE_MEM_BENCHES(sve, load,  sve_lane_count_32() * 4, HAS(sve))
+DEFINE_MEM_BENCHES(sve, store, sve_lane_count_32() * 4, HAS(sve))
+DEFINE_MEM_BENCHES(sve, rmw,   sve_lane_count_32() * 4, HAS(sve))
 
 #endif  // __aarch64__
 
 
+///////////////////////////////////////////////////////////////
+// Mixed-ISA transitions
+//
+// bench_mix_<name> alternates blocks of 8 adds of two widths, see
+// x86.S. Comparing *_dirty with *_vzeroupper gives the cost of running
+// legacy SSE with dirty upper lanes, sse_sse the cost without any wide
+// code. The warm-up and frequency transients behind these need time
+// series rather than averages; see transient.h and --transient.
+///////////////////////////////////////////////////////////////
+
+#define DEFINE_MIX_BENCH(Name, SUPPORTED)                                            \
+    extern "C" void mix_##Name(std::uint64_t);                                       \
+    static void bench_mix_##Name(benchmark::State& state) {                          \
+        constexpr std::uint64_t N = 100'000; /* iterations of 16 adds */             \
+                                                                                     \
+        const perf_reading p0 = perf_read_thread();                                  \
+        const auto t0 = std::chrono::steady_clock::now();                            \
+        for (auto _ : state) {                                                       \
+            mix_##Name(N);                                                           \
+        }                                                                            \
+        const auto t1 = std::chrono::steady_clock::now();                            \
+        const perf_reading p1 = perf_read_thread();                                  \
+                                                                                     \
+        const double iters = static_cast<double>(state.iterations()) * N;            \
+        const double wall_ns =                                                       \
+            std::chrono::duration<double, std::nano>(t1 - t0).count();               \
+        const double cycles = cycles_of(state, p1 - p0, wall_ns);                    \
+                                                                                     \
+        using benchmark::Counter;                                                    \
+        state.counters["cyc_per_iter"] = Counter(cycles / iters);                    \
+        state.counters["ns_per_iter"]  = Counter(wall_ns / iters);                   \
+    }                                                                                \
+    static const bool bench_mix_##Name##_registered =                                \
+        register_bench((SUPPORTED), "bench_mix_" #Name, bench_mix_##Name);
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+DEFINE_MIX_BENCH(sse_sse, true)
+DEFINE_MIX_BENCH(avx_sse_dirty, HAS(avx2))
+DEFINE_MIX_BENCH(avx_sse_vzeroupper, HAS(avx2))
+DEFINE_MIX_BENCH(avx512_sse_dirty, HAS(avx512f))
+DEFINE_MIX_BENCH(avx512_sse_vzeroupper, HAS(avx512f))
+DEFINE_MIX_BENCH(avx512_avx, HAS(avx512f))
+
+#endif  // x86-64
+
+
+///////////////////////////////////////////////////////////////
+// Generated kernels
+//
+// bench_jit_<op>/unroll:U/regs:R runs a kernel built by jit.h: U
+// instances of one instruction per iteration over R independent
+// registers, so regs:1 gives the latency and more registers the
+// throughput. Which U and R are registered is chosen at startup, see
+// main().
+///////////////////////////////////////////////////////////////
+
+static void run_jit_bench(benchmark::State& state, std::size_t op)
+{
+    const int unroll = static_cast<int>(state.range(0));
+    const int regs = static_cast<int>(state.range(1));
+    const std::unique_ptr<jit_kernel> kernel =
+        jit_kernel::build(op, unroll, regs);
+    if (!kernel) {
+        state.SkipWithError(std::strerror(errno));
+        return;
+    }
+    constexpr std::uint64_t N = 100'000;  // iterations of unroll instructions
+
+    const perf_reading p0 = perf_read_thread();
+    const auto t0 = std::chrono::steady_clock::now();
+    for (auto _ : state) {
+        kernel->run(N);
+    }
+    const auto t1 = std::chrono::steady_clock::now();
+    const perf_reading p1 = perf_read_thread();
+
+    const double insns = static_cast<double>(state.iterations()) * N * unroll;
+    const double cycles = cycles_of(
+        state, p1 - p0,
+        std::chrono::duration<double, std::nano>(t1 - t0).count());
+
+    using benchmark::Counter;
+    state.counters["insns"]        = Counter(insns, Counter::kIsRate);
+    state.counters["cyc_per_insn"] = Counter(cycles / insns);
+    state.counters["insn_per_cyc"] = Counter(insns / cycles);
+}
+
+// Registers every supported instruction for each unroll depth and
+// register count it allows. Register counts above the unroll depth
+// would leave registers idle and are skipped.
+static void register_jit_benches(const std::vector<int>& unrolls,
+                                 const std::vector<int>& regs)
+{
+    const std::vector<jit_op_info> ops = jit_ops();
+    for (std::size_t i = 0; i < ops.size(); ++i) {
+        if (!ops[i].supported)
+            continue;
+        std::vector<std::vector<std::int64_t>> args;
+        for (int u : unrolls)
+            for (int r : regs)
+                if (r <= u && r <= ops[i].max_regs)
+                    args.push_back({u, r});
+        if (args.empty())
+            continue;
+        const std::string name = std::string("bench_jit_") + ops[i].name;
+        benchmark::internal::Benchmark* b = benchmark::RegisterBenchmark(
+            name.c_str(),
+            [i](benchmark::State& state) { run_jit_bench(state, i); });
+        b->ArgNames({"unroll", "regs"});
+        for (const auto& a : args)
+            b->Args(a);
+    }
+}
+
+// Parses comma-separated values and ranges, e.g. "1,2,8-16", each
+// within min..4096.
+static bool parse_int_list(const std::string& s, std::vector<int>& out,
+                           int min = 1)
+{
+    std::vector<int> v;
+    std::size_t pos = 0;
+    while (pos <= s.size()) {
+        const std::size_t end = std::min(s.find(',', pos), s.size());
+        const std::string item = s.substr(pos, end - pos);
+        char* e;
+        const long lo = std::strtol(item.c_str(), &e, 10);
+        long hi = lo;
+        if (*e == '-')
+            hi = std::strtol(e + 1, &e, 10);
+        if (item.empty() || *e != '\0' || lo < min || hi > 4096 || lo > hi)
+            return false;
+        for (int x = static_cast<int>(lo); x <= hi; ++x)
+            v.push_back(x);
+        pos = end + 1;
+    }
+    out = v;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////
+// SMT sibling interference
+//
+// bench_smt_<a>_vs_<b> pins kernel a on one logical CPU of a core and
+// kernel b on its SMT sibling, both running for the whole measurement.
+// ops_a and ops_b are each side's operations per second (vector ops,
+// adds or loads, by kernel), rel_a and rel_b that rate over the rate
+// of the kernel alone on the same CPU, measured once beforehand: 1 is
+// no interference, 0.5 an even split of the core.
+///////////////////////////////////////////////////////////////
+
+struct smt_kernel {
+    const char* name;
+    bool supported;
+    std::uint64_t n;      // argument per call, about a millisecond's work
+    double ops_per_call;
+    void (*run)(std::uint64_t n, void* buf);
+};
+
+// Per-side L1-resident buffers for the load kernel, apart so the
+// siblings share the L1d but not lines.
+alignas(4096) static unsigned char smt_buffers[2][16384];
+constexpr std::uint64_t smt_load_blocks = sizeof(smt_buffers[0]) / (8 * 16);
+
+static const std::vector<smt_kernel>& smt_kernels()
+{
+    static const std::vector<smt_kernel> kernels = {
+        {"scalar", true, 100'000, 100'000.0 * 12,
+         [](std::uint64_t n, void*) { calib_add_chain(n); }},
+#if defined(__x86_64__) || defined(_M_X64)
+        {"sse2", true, 20'000, 20'000.0 * 64,
+         [](std::uint64_t n, void*) { sse2_unroll_8(n); }},
+        {"avx", HAS(avx2), 20'000, 20'000.0 * 64,
+         [](std::uint64_t n, void*) { avx_unroll_8(n); }},
+        {"avx512", HAS(avx512f), 20'000, 20'000.0 * 64,
+         [](std::uint64_t n, void*) { avx512_unroll_8(n); }},
+        {"load", true, 1000, 1000.0 * smt_load_blocks * 8,
+         [](std::uint64_t n, void* buf) {
+             mem_sse_load_unroll_8(n, buf, smt_load_blocks);
+         }},
+#elif defined(__aarch64__)
+        {"neon", true, 20'000, 20'000.0 * 64,
+         [](std::uint64_t n, void*) { neon_unroll_8(n); }},
+        {"sve", HAS(sve), 20'000, 20'000.0 * 64,
+         [](std::uint64_t n, void*) { sve_unroll_8(n); }},
+        {"load", true, 1000, 1000.0 * smt_load_blocks * 8,
+         [](std::uint64_t n, void* buf) {
+             mem_neon_load_unroll_8(n, buf, smt_load_blocks);
+         }},
+#endif
+    };
+    return kernels;
+}
+
+// The first core with two logical CPUs this process may use, from
+// /sys/devices/system/cpu/cpu*/topology/thread_siblings_list, or
+// {-1, -1} when there is none.
+static std::pair<int, int> smt_pair()
+{
+    static const std::pair<int, int> pair = [] {
+        const std::vector<int>& cpus = allowed_cpus();
+        for (int c : cpus) {
+            const std::string path = "/sys/devices/system/cpu/cpu" +
+                                     std::to_string(c) +
+                                     "/topology/thread_siblings_list";
+            std::FILE* f = std::fopen(path.c_str(), "r");
+            if (f == nullptr)
+                continue;
+            char line[256] = "";
+            const bool ok = std::fgets(line, sizeof(line), f) != nullptr;
+            std::fclose(f);
+            std::vector<int> siblings;
+            if (!ok || !parse_int_list(std::string(line, std::strcspn(line, "\n")),
+                                       siblings, 0))
+                continue;
+            for (int s : siblings)
+                if (s != c && std::find(cpus.begin(), cpus.end(), s) != cpus.end())
+                    return std::make_pair(c, s);
+        }
+        return std::make_pair(-1, -1);
+    }();
+    return pair;
+}
+
+// Calls per second of kernel k alone on cpu, measured over 100 ms the
+// first time it is asked for.
+static double smt_solo_rate(std::size_t k, int cpu, void* buf)
+{
+    static std::map<std::pair<std::size_t, int>, double> rates;
+    const auto it = rates.find({k, cpu});
+    if (it != rates.end())
+        return it->second;
+
+    const smt_kernel& kernel = smt_kernels()[k];
+    thread_pin pin(cpu);
+    kernel.run(kernel.n, buf);
+    std::uint64_t calls = 0;
+    const auto t0 = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed{};
+    do {
+        kernel.run(kernel.n, buf);
+        ++calls;
+        elapsed = std::chrono::steady_clock::now() - t0;
+    } while (elapsed.count() < 0.1);
+    return rates[{k, cpu}] = calls / elapsed.count();
+}
+
+static void run_smt_bench(benchmark::State& state, std::size_t a,
+                          std::size_t b)
+{
+    const std::pair<int, int> cpus = smt_pair();
+    const smt_kernel& ka = smt_kernels()[a];
+    const smt_kernel& kb = smt_kernels()[b];
+    const double solo_a = smt_solo_rate(a, cpus.first, smt_buffers[0]);
+    const double solo_b = smt_solo_rate(b, cpus.second, smt_buffers[1]);
+
+    // b runs on the sibling until a is done; only its calls that
+    // complete within a's measurement count.
+    thread_pin pin(cpus.first);
+    std::atomic<bool> stop{false};
+    std::atomic<std::uint64_t> calls_b{0};
+    std::thread sibling([&] {
+        thread_pin sibling_pin(cpus.second);
+        while (!stop.load(std::memory_order_relaxed)) {
+            kb.run(kb.n, smt_buffers[1]);
+            calls_b.fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+    while (calls_b.load() == 0) {
+    }
+
+    const std::uint64_t b0 = calls_b.load();
+    const auto t0 = std::chrono::steady_clock::now();
+    for (auto _ : state) {
+        ka.run(ka.n, smt_buffers[0]);
+    }
+    const auto t1 = std::chrono::steady_clock::now();
+    const std::uint64_t b1 = calls_b.load();
+    stop.store(true);
+    sibling.join();
+
+    const double secs = std::chrono::duration<double>(t1 - t0).count();
+    const double rate_a = static_cast<double>(state.iterations()) / secs;
+    const double rate_b = static_cast<double>(b1 - b0) / secs;
+
+    using benchmark::Counter;
+    state.counters["ops_a"] = Counter(rate_a * ka.ops_per_call);
+    state.counters["ops_b"] = Counter(rate_b * kb.ops_per_call);
+    state.counters["rel_a"] = Counter(rate_a / solo_a);
+    state.counters["rel_b"] = Counter(rate_b / solo_b);
+}
+
+// Registers every pair of supported kernels when there is an SMT pair
+// to run them on, and names the pair in the context either way.
+static void register_smt_benches()
+{
+    const std::pair<int, int> cpus = smt_pair();
+    if (cpus.first < 0) {
+        benchmark::AddCustomContext("smt_pair", "none");
+        return;
+    }
+    benchmark::AddCustomContext("smt_pair",
+                                std::to_string(cpus.first) + "," +
+                                    std::to_string(cpus.second));
+
+    const std::vector<smt_kernel>& kernels = smt_kernels();
+    for (std::size_t a = 0; a < kernels.size(); ++a) {
+        for (std::size_t b = a; b < kernels.size(); ++b) {
+            if (!kernels[a].supported || !kernels[b].supported)
+                continue;
+            const std::string name = std::string("bench_smt_") +
+                                     kernels[a].name + "_vs_" +
+                                     kernels[b].name;
+            benchmark::RegisterBenchmark(
+                name.c_str(),
+                [a, b](benchmark::State& state) { run_smt_bench(state, a, b); });
+        }
+    }
+}
+
 ///////////////////////////////////////////////////////////////
 // Main
+//
+// Besides the Google Benchmark flags:
+//
+//   --jit_unroll=LIST  unroll depths of the generated kernels
+//   --jit_regs=LIST    register counts of the generated kernels
+//   --transient=FILE   write the transient series as CSV to FILE, "-"
+//                      for stdout, instead of running benchmarks
+//
+// LIST is comma-separated values and ranges, e.g. 1-32 or 1,2,4. Both
+// default to 1,2,4,8,16,32.
 ///////////////////////////////////////////////////////////////
 
-BENCHMARK_MAIN();
+int main(int argc, char** argv)
+{
+    benchmark::Initialize(&argc, argv);
+
+    std::vector<int> unrolls = {1, 2, 4, 8, 16, 32};
+    std::vector<int> regs = {1, 2, 4, 8, 16, 32};
+    std::string transient_path;
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        bool ok = true;
+        if (arg.rfind("--jit_unroll=", 0) == 0)
+            ok = parse_int_list(arg.substr(13), unrolls);
+        else if (arg.rfind("--jit_regs=", 0) == 0)
+            ok = parse_int_list(arg.substr(11), regs);
+        else if (arg.rfind("--transient=", 0) == 0)
+            transient_path = arg.substr(12);
+        else {
+            argv[kept++] = argv[i];
+            continue;
+        }
+        if (!ok) {
+            std::fprintf(stderr, "%s: bad list in %s\n", argv[0], argv[i]);
+            return 1;
+        }
+    }
+    argc = kept;
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+
+    if (!transient_path.empty()) {
+        std::FILE* out = transient_path == "-"
+                             ? stdout
+                             : std::fopen(transient_path.c_str(), "w");
+        if (out == nullptr) {
+            std::perror(transient_path.c_str());
+            return 1;
+        }
+        run_transients(out);
+        if (out != stdout)
+            std::fclose(out);
+        return 0;
+    }
+
+    register_jit_benches(unrolls, regs);
+    register_smt_benches();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "cpu_features.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <cpuid.h>
+#include <cstdint>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#ifndef HWCAP_SVE
+#define HWCAP_SVE (1UL << 22)
+#endif
+#endif
+
+namespace {
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+// XCR0, the register state the OS saves on context switches. Only
+// valid when CPUID reports OSXSAVE.
+std::uint64_t xgetbv0()
+{
+    std::uint32_t lo, hi;
+    asm volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<std::uint64_t>(hi) << 32) | lo;
+}
+
+cpu_features detect()
+{
+    cpu_features f;
+    unsigned a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d))
+        return f;
+    f.sse4_1 = c & bit_SSE4_1;
+    const bool osxsave = c & bit_OSXSAVE;
+    const bool avx = c & bit_AVX;
+    const bool fma = c & bit_FMA;
+
+    constexpr std::uint64_t xcr0_ymm = 0x6;    // xmm, ymm upper halves
+    constexpr std::uint64_t xcr0_zmm = 0xe6;   // and opmask, zmm 0..31
+    const std::uint64_t xcr0 = osxsave ? xgetbv0() : 0;
+    const bool os_ymm = (xcr0 & xcr0_ymm) == xcr0_ymm;
+    const bool os_zmm = (xcr0 & xcr0_zmm) == xcr0_zmm;
+
+    f.fma = avx && fma && os_ymm;
+    if (__get_cpuid_count(7, 0, &a, &b, &c, &d)) {
+        f.avx2 = avx && (b & bit_AVX2) && os_ymm;
+        f.avx512f = (b & bit_AVX512F) && os_zmm;
+    }
+    return f;
+}
+
+#elif defined(__aarch64__)
+
+cpu_features detect()
+{
+    cpu_features f;
+    f.sve = getauxval(AT_HWCAP) & HWCAP_SVE;
+    return f;
+}
+
+#else
+
+cpu_features detect()
+{
+    return cpu_features{};
+}
+
+#endif
+
+}  // namespace
+
+const cpu_features& detect_cpu_features()
+{
+    static const cpu_features features = detect();
+    return features;
+}
+
+std::string cpu_features_string(const cpu_features& f)
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    std::string s = "sse2";
+    if (f.sse4_1)
+        s += " sse4.1";
+    if (f.avx2)
+        s += " avx2";
+    if (f.fma)
+        s += " fma";
+    if (f.avx512f)
+        s += " avx512f";
+    return s;
+#elif defined(__aarch64__)
+    return f.sve ? "neon sve" : "neon";
+#else
+    (void)f;
+    return "";
+#endif
+}
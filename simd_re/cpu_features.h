@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+
+///////////////////////////////////////////////////////////////
+// SIMD extensions the CPU and the kernel support
+//
+// Every kernel in x86.S and arm64.S is assembled whatever the build
+// machine is; only those this table allows are run. On x86-64 an
+// extension counts when CPUID reports it and XGETBV shows the OS saving
+// its registers; on AArch64 the kernel's AT_HWCAP says so.
+///////////////////////////////////////////////////////////////
+
+struct cpu_features {
+    // x86-64, SSE2 being part of the base ISA
+    bool sse4_1 = false;
+    bool avx2 = false;  // AVX2 with the OS saving ymm
+    bool fma = false;
+    bool avx512f = false;  // AVX-512F with the OS saving zmm and k
+    // AArch64, NEON being part of the base ISA
+    bool sve = false;
+};
+
+// Detected on the first call.
+const cpu_features& detect_cpu_features();
+
+// The supported extensions, e.g. "sse2 sse4.1 avx2 fma avx512f".
+std::string cpu_features_string(const cpu_features& f);
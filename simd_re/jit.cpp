@@ -0,0 +1,292 @@
+#include "jit.h"
+
+#include "cpu_features.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+class code_buffer {
+public:
+    void byte(std::uint8_t b) { bytes_.push_back(b); }
+
+    void word(std::uint32_t w)
+    {
+        for (int i = 0; i < 4; ++i)
+            byte(static_cast<std::uint8_t>(w >> (8 * i)));
+    }
+
+    std::size_t pos() const { return bytes_.size(); }
+    const std::vector<std::uint8_t>& bytes() const { return bytes_; }
+
+private:
+    std::vector<std::uint8_t> bytes_;
+};
+
+bool always(const cpu_features&) { return true; }
+
+#if defined(__x86_64__) || defined(_M_X64)
+
+bool has_sse4_1(const cpu_features& f) { return f.sse4_1; }
+bool has_avx2(const cpu_features& f) { return f.avx2; }
+bool has_fma(const cpu_features& f) { return f.fma; }
+bool has_avx512f(const cpu_features& f) { return f.avx512f; }
+
+enum class encoding { sse, vex256, evex512 };
+
+// op r, r[, r][, imm8] with every operand the same register. All forms
+// used here are W0. With `idiom` set, ModRM.rm reads the ISA's last
+// register instead, which is never written: equal operands would make
+// the instruction a dependency-breaking idiom (pcmpgtd x, x is zero).
+struct op_desc {
+    const char* name;
+    encoding enc;
+    std::uint8_t pp;      // 0: no prefix, 1: 66
+    std::uint8_t map;     // 1: 0F, 2: 0F38, 3: 0F3A
+    std::uint8_t opcode;
+    bool nds;             // VEX/EVEX vvvv is a source, else unused
+    int imm;              // imm8, -1 for none
+    bool idiom;
+    bool (*supported)(const cpu_features&);
+};
+
+const op_desc ops[] = {
+    {"sse_paddd",          encoding::sse,     1, 1, 0xfe, true,  -1,   false, always},
+    {"sse_pmulld",         encoding::sse,     1, 2, 0x40, true,  -1,   false, has_sse4_1},
+    {"sse_mulps",          encoding::sse,     0, 1, 0x59, true,  -1,   false, always},
+    {"sse_pshufd",         encoding::sse,     1, 1, 0x70, false, 0x1b, false, always},
+    {"sse_pcmpgtd",        encoding::sse,     1, 1, 0x66, true,  -1,   true,  always},
+    {"avx_vpaddd",         encoding::vex256,  1, 1, 0xfe, true,  -1,   false, has_avx2},
+    {"avx_vpmulld",        encoding::vex256,  1, 2, 0x40, true,  -1,   false, has_avx2},
+    {"avx_vmulps",         encoding::vex256,  0, 1, 0x59, true,  -1,   false, has_avx2},
+    {"avx_vfmadd231ps",    encoding::vex256,  1, 2, 0xb8, true,  -1,   false, has_fma},
+    {"avx_vpshufd",        encoding::vex256,  1, 1, 0x70, false, 0x1b, false, has_avx2},
+    {"avx_vpermd",         encoding::vex256,  1, 2, 0x36, true,  -1,   false, has_avx2},
+    {"avx_vpcmpgtd",       encoding::vex256,  1, 1, 0x66, true,  -1,   true,  has_avx2},
+    {"avx512_vpaddd",      encoding::evex512, 1, 1, 0xfe, true,  -1,   false, has_avx512f},
+    {"avx512_vpmulld",     encoding::evex512, 1, 2, 0x40, true,  -1,   false, has_avx512f},
+    {"avx512_vmulps",      encoding::evex512, 0, 1, 0x59, true,  -1,   false, has_avx512f},
+    {"avx512_vfmadd231ps", encoding::evex512, 1, 2, 0xb8, true,  -1,   false, has_avx512f},
+    {"avx512_vpshufd",     encoding::evex512, 1, 1, 0x70, false, 0x1b, false, has_avx512f},
+    {"avx512_vpermd",      encoding::evex512, 1, 2, 0x36, true,  -1,   false, has_avx512f},
+    {"avx512_vpternlogd",  encoding::evex512, 1, 3, 0x25, true,  0x96, false, has_avx512f},
+};
+
+// pxor, vpxor ymm, vpxord zmm
+const op_desc zero_ops[] = {
+    {"pxor",    encoding::sse,     1, 1, 0xef, true, -1, false, always},
+    {"vpxor",   encoding::vex256,  1, 1, 0xef, true, -1, false, always},
+    {"vpxord",  encoding::evex512, 1, 1, 0xef, true, -1, false, always},
+};
+
+int isa_regs(const op_desc& op)
+{
+    return op.enc == encoding::evex512 ? 32 : 16;
+}
+
+int max_regs(const op_desc& op)
+{
+    return isa_regs(op) - (op.idiom ? 1 : 0);
+}
+
+// Destination (ModRM.reg, and vvvv when nds) r, source (ModRM.rm) s.
+void emit(code_buffer& c, const op_desc& op, int r, int s)
+{
+    const int v = op.nds ? r : 0;
+    const int r_hi = (r >> 3) & 1;   // REX/VEX/EVEX R
+    const int r_top = (r >> 4) & 1;  // EVEX R'
+    const int s_hi = (s >> 3) & 1;   // REX/VEX/EVEX B
+    const int s_top = (s >> 4) & 1;  // EVEX X
+    switch (op.enc) {
+    case encoding::sse:
+        if (op.pp == 1)
+            c.byte(0x66);
+        if (r_hi || s_hi)
+            c.byte(static_cast<std::uint8_t>(0x40 | r_hi << 2 | s_hi));
+        c.byte(0x0f);
+        if (op.map == 2)
+            c.byte(0x38);
+        else if (op.map == 3)
+            c.byte(0x3a);
+        break;
+    case encoding::vex256:
+        c.byte(0xc4);
+        c.byte(static_cast<std::uint8_t>((!r_hi) << 7 | 1 << 6 | (!s_hi) << 5 |
+                                         op.map));
+        c.byte(static_cast<std::uint8_t>((~v & 0xf) << 3 | 1 << 2 | op.pp));
+        break;
+    case encoding::evex512:
+        c.byte(0x62);
+        c.byte(static_cast<std::uint8_t>((!r_hi) << 7 | (!s_top) << 6 |
+                                         (!s_hi) << 5 | (!r_top) << 4 | op.map));
+        c.byte(static_cast<std::uint8_t>((~v & 0xf) << 3 | 1 << 2 | op.pp));
+        c.byte(static_cast<std::uint8_t>(2 << 5 | (!((v >> 4) & 1)) << 3));
+        break;
+    }
+    c.byte(op.opcode);
+    c.byte(static_cast<std::uint8_t>(0xc0 | (r & 7) << 3 | (s & 7)));
+    if (op.imm >= 0)
+        c.byte(static_cast<std::uint8_t>(op.imm));
+}
+
+// rdi = iterations. No callee-saved vector registers in the SysV ABI.
+code_buffer generate(const op_desc& op, int unroll, int regs)
+{
+    code_buffer c;
+    const op_desc& zero = zero_ops[static_cast<int>(op.enc)];
+    const int src = op.idiom ? isa_regs(op) - 1 : -1;
+    for (int r = 0; r < regs; ++r)
+        emit(c, zero, r, r);
+    if (src >= 0)
+        emit(c, zero, src, src);
+    while (c.pos() % 16 != 0)
+        c.byte(0x90);
+
+    const std::size_t loop = c.pos();
+    for (int i = 0; i < unroll; ++i)
+        emit(c, op, i % regs, src >= 0 ? src : i % regs);
+    c.byte(0x48);  // dec %rdi
+    c.byte(0xff);
+    c.byte(0xcf);
+    c.byte(0x0f);  // jnz loop
+    c.byte(0x85);
+    c.word(static_cast<std::uint32_t>(static_cast<std::int64_t>(loop) -
+                                      static_cast<std::int64_t>(c.pos() + 4)));
+    if (op.enc != encoding::sse) {
+        c.byte(0xc5);  // vzeroupper
+        c.byte(0xf8);
+        c.byte(0x77);
+    }
+    c.byte(0xc3);  // ret
+    return c;
+}
+
+#elif defined(__aarch64__)
+
+bool has_sve(const cpu_features& f) { return f.sve; }
+
+// A 32-bit instruction word with the register in Rd and, when set, in
+// Rn (bit 5) and Rm (bit 16). SVE predicated forms use p0, all true.
+// With `idiom` set, Rm is v31, which is never written, as on x86-64.
+struct op_desc {
+    const char* name;
+    std::uint32_t base;
+    bool rn;
+    bool rm;
+    bool sve;
+    bool idiom;
+    bool (*supported)(const cpu_features&);
+};
+
+const op_desc ops[] = {
+    {"neon_add",  0x4ea08400, true, true,  false, false, always},
+    {"neon_mul",  0x4ea09c00, true, true,  false, false, always},
+    {"neon_fmul", 0x6e20dc00, true, true,  false, false, always},
+    {"neon_fmla", 0x4e20cc00, true, true,  false, false, always},
+    {"neon_zip1", 0x4e803800, true, true,  false, false, always},
+    {"neon_cmgt", 0x4ea03400, true, true,  false, true,  always},
+    {"sve_add",   0x04a00000, true, true,  true,  false, has_sve},
+    {"sve_mul",   0x04900000, true, false, true,  false, has_sve},  // Zdn, p0/m, Zm
+    {"sve_fmul",  0x65800800, true, true,  true,  false, has_sve},
+    {"sve_fmla",  0x65a00000, true, true,  true,  false, has_sve},  // p0/m
+    {"sve_zip1",  0x05a06000, true, true,  true,  false, has_sve},
+};
+
+int max_regs(const op_desc& op)
+{
+    return op.idiom ? 31 : 32;
+}
+
+void emit(code_buffer& c, const op_desc& op, int r)
+{
+    const std::uint32_t reg = static_cast<std::uint32_t>(r);
+    const std::uint32_t src = op.idiom ? 31 : reg;
+    c.word(op.base | reg | (op.rn ? reg << 5 : 0) | (op.rm ? src << 16 : 0));
+}
+
+// x0 = iterations. d8..d15 are callee-saved, so they are spilled.
+code_buffer generate(const op_desc& op, int unroll, int regs)
+{
+    code_buffer c;
+    c.word(0x6dbc27e8);  // stp d8, d9, [sp, #-64]!
+    c.word(0x6d012fea);  // stp d10, d11, [sp, #16]
+    c.word(0x6d0237ec);  // stp d12, d13, [sp, #32]
+    c.word(0x6d033fee);  // stp d14, d15, [sp, #48]
+    if (op.sve)
+        c.word(0x2598e3e0);  // ptrue p0.s
+    for (int r = 0; r < regs; ++r)
+        c.word((op.sve ? 0x25b8c000 : 0x4f00e400) |  // dup z.s / movi v.16b, #0
+               static_cast<std::uint32_t>(r));
+    if (op.idiom)
+        c.word(0x4f00e400 | 31);  // movi v31.16b, #0
+
+    const std::size_t loop = c.pos();
+    for (int i = 0; i < unroll; ++i)
+        emit(c, op, i % regs);
+    c.word(0xf1000400);  // subs x0, x0, #1
+    const std::int64_t back =
+        (static_cast<std::int64_t>(loop) - static_cast<std::int64_t>(c.pos())) / 4;
+    c.word(0x54000001 |  // b.ne loop
+           (static_cast<std::uint32_t>(back) & 0x7ffff) << 5);
+    c.word(0x6d433fee);  // ldp d14, d15, [sp, #48]
+    c.word(0x6d4237ec);  // ldp d12, d13, [sp, #32]
+    c.word(0x6d412fea);  // ldp d10, d11, [sp, #16]
+    c.word(0x6cc427e8);  // ldp d8, d9, [sp], #64
+    c.word(0xd65f03c0);  // ret
+    return c;
+}
+
+#else
+#error "jit.cpp: no emitter for this architecture"
+#endif
+
+}  // namespace
+
+std::vector<jit_op_info> jit_ops()
+{
+    const cpu_features& f = detect_cpu_features();
+    std::vector<jit_op_info> v;
+    for (const op_desc& op : ops)
+        v.push_back({op.name, max_regs(op), op.supported(f)});
+    return v;
+}
+
+std::unique_ptr<jit_kernel> jit_kernel::build(std::size_t op, int unroll,
+                                              int regs)
+{
+    const code_buffer code = generate(ops[op], unroll, regs);
+    const std::size_t page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    const std::size_t size = (code.pos() + page - 1) / page * page;
+
+    // Written, then flipped to read+execute: never writable and
+    // executable at once.
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return nullptr;
+    std::memcpy(p, code.bytes().data(), code.pos());
+    if (mprotect(p, size, PROT_READ | PROT_EXEC) != 0) {
+        const int err = errno;
+        munmap(p, size);
+        errno = err;
+        return nullptr;
+    }
+    char* begin = static_cast<char*>(p);
+    __builtin___clear_cache(begin, begin + code.pos());
+    return std::unique_ptr<jit_kernel>(new jit_kernel(p, size));
+}
+
+jit_kernel::jit_kernel(void* page, std::size_t size)
+    : page_(page),
+      size_(size),
+      fn_(reinterpret_cast<void (*)(std::uint64_t)>(page))
+{
+}
+
+jit_kernel::~jit_kernel()
+{
+    munmap(page_, size_);
+}
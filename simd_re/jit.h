@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+///////////////////////////////////////////////////////////////
+// Kernels generated at run time
+//
+// A small x86-64 / AArch64 emitter writes register-only kernels into an
+// mmap'ed page, so any instruction of its table can run at any unroll
+// depth and register count without touching x86.S or arm64.S.
+//
+// A kernel takes the iteration count. Each iteration runs `unroll`
+// instances of one instruction over registers 0..regs-1 round-robin,
+// every instance reading and writing only its own register: regs is the
+// number of independent dependency chains, 1 giving the latency and
+// enough of them the throughput. Registers start at zero. Compares,
+// which cores treat as dependency-breaking idioms when both sources are
+// the same register, read their second source from the ISA's last
+// register instead; it is never written and not counted in max_regs.
+///////////////////////////////////////////////////////////////
+
+struct jit_op_info {
+    const char* name;  // e.g. "avx512_vpaddd"
+    int max_regs;      // vector registers of its ISA
+    bool supported;    // whether this CPU runs it, see cpu_features.h
+};
+
+// The instructions the emitter knows for the build architecture.
+std::vector<jit_op_info> jit_ops();
+
+class jit_kernel {
+public:
+    // A kernel for jit_ops()[op], or null with errno set when the code
+    // page can't be mapped. unroll >= 1, 1 <= regs <= max_regs.
+    static std::unique_ptr<jit_kernel> build(std::size_t op, int unroll,
+                                             int regs);
+
+    ~jit_kernel();
+    jit_kernel(const jit_kernel&) = delete;
+    jit_kernel& operator=(const jit_kernel&) = delete;
+
+    void run(std::uint64_t iterations) const { fn_(iterations); }
+
+private:
+    jit_kernel(void* page, std::size_t size);
+
+    void* page_;
+    std::size_t size_;
+    void (*fn_)(std::uint64_t);
+};
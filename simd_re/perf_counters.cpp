@@ -0,0 +1,108 @@
+#include "perf_counters.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <linux/perf_event.h>
+#include <mutex>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+std::once_flag warned;
+
+// Separate counters rather than a group, so cycles still count when the
+// kernel refuses instructions or the other way around.
+class thread_counters {
+public:
+    thread_counters()
+    {
+        cycles_ = open_counter(PERF_COUNT_HW_CPU_CYCLES, "cycles");
+        instructions_ =
+            open_counter(PERF_COUNT_HW_INSTRUCTIONS, "instructions");
+    }
+
+    ~thread_counters()
+    {
+        if (cycles_ >= 0)
+            close(cycles_);
+        if (instructions_ >= 0)
+            close(instructions_);
+    }
+
+    perf_reading read_all() const
+    {
+        perf_reading r;
+        r.has_cycles = read_counter(cycles_, r.cycles);
+        r.has_instructions = read_counter(instructions_, r.instructions);
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        r.cpu_ns = static_cast<std::uint64_t>(ts.tv_sec) * 1'000'000'000 +
+                   static_cast<std::uint64_t>(ts.tv_nsec);
+        return r;
+    }
+
+private:
+    static int open_counter(std::uint64_t config, const char* name)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config;
+        attr.read_format =
+            PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        int fd = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1,
+                                          -1, PERF_FLAG_FD_CLOEXEC));
+        if (fd < 0) {
+            const int err = errno;
+            std::call_once(warned, [&] {
+                std::fprintf(stderr,
+                             "perf_event_open(%s) failed: %s; cycles are "
+                             "estimated from a dependent add chain instead\n",
+                             name, std::strerror(err));
+            });
+        }
+        return fd;
+    }
+
+    static bool read_counter(int fd, std::uint64_t& value)
+    {
+        std::uint64_t buf[3];  // value, time enabled, time running
+        if (fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[2] == 0)
+            return false;
+        // Scale up if the PMU was multiplexed between events.
+        if (buf[2] < buf[1])
+            buf[0] = static_cast<std::uint64_t>(static_cast<double>(buf[0]) *
+                                                buf[1] / buf[2]);
+        value = buf[0];
+        return true;
+    }
+
+    int cycles_;
+    int instructions_;
+};
+
+}  // namespace
+
+perf_reading operator-(const perf_reading& after, const perf_reading& before)
+{
+    perf_reading d;
+    d.has_cycles = after.has_cycles && before.has_cycles;
+    d.has_instructions = after.has_instructions && before.has_instructions;
+    d.cycles = d.has_cycles ? after.cycles - before.cycles : 0;
+    d.instructions =
+        d.has_instructions ? after.instructions - before.instructions : 0;
+    d.cpu_ns = after.cpu_ns - before.cpu_ns;
+    return d;
+}
+
+perf_reading perf_read_thread()
+{
+    static thread_local thread_counters counters;
+    return counters.read_all();
+}
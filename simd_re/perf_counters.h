@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+///////////////////////////////////////////////////////////////
+// Per-thread core-cycle and retired-instruction counters
+//
+// Read through perf_event_open, user space only, together with the
+// thread's CPU time so that cycles / CPU time is the effective clock.
+// A counter is invalid when the kernel refuses it: no PMU in a VM,
+// perf_event_paranoid, seccomp.
+///////////////////////////////////////////////////////////////
+
+struct perf_reading {
+    std::uint64_t cycles = 0;
+    std::uint64_t instructions = 0;
+    std::uint64_t cpu_ns = 0;  // CLOCK_THREAD_CPUTIME_ID
+    bool has_cycles = false;
+    bool has_instructions = false;
+};
+
+// Difference of two readings; a counter is valid where both were.
+perf_reading operator-(const perf_reading& after, const perf_reading& before);
+
+// Counters of the calling thread. They are opened on its first call, so
+// take a reading before the part to be measured. The first failure to
+// open one is reported once on stderr.
+perf_reading perf_read_thread();
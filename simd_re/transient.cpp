@@ -0,0 +1,229 @@
+#include "transient.h"
+
+#include "cpu_features.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+void calib_add_chain(std::uint64_t);
+#if defined(__x86_64__) || defined(_M_X64)
+void avx_unroll_8(std::uint64_t);
+void avx512_unroll_8(std::uint64_t);
+void insn_avx_vfmadd231ps_tput(std::uint64_t, void*);
+void insn_avx512_vfmadd231ps_tput(std::uint64_t, void*);
+#elif defined(__aarch64__)
+void neon_unroll_8(std::uint64_t);
+void sve_unroll_8(std::uint64_t);
+void insn_neon_fmla_tput(std::uint64_t, void*);
+void insn_sve_fmla_tput(std::uint64_t, void*);
+#endif
+}
+
+namespace {
+
+// Ticks of the constant-rate counter: the TSC, cntvct_el0, or
+// steady_clock nanoseconds elsewhere.
+inline std::uint64_t ticks()
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    std::uint32_t lo, hi;
+    asm volatile("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+    return (static_cast<std::uint64_t>(hi) << 32) | lo;
+#elif defined(__aarch64__)
+    std::uint64_t t;
+    asm volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(t) : : "memory");
+    return t;
+#else
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+#endif
+}
+
+// Ticks per nanosecond, against steady_clock over 20 ms.
+double ticks_per_ns()
+{
+    static const double value = [] {
+        const auto t0 = std::chrono::steady_clock::now();
+        const std::uint64_t c0 = ticks();
+        while (std::chrono::steady_clock::now() - t0 <
+               std::chrono::milliseconds(20)) {
+        }
+        const std::uint64_t c1 = ticks();
+        const auto t1 = std::chrono::steady_clock::now();
+        return (c1 - c0) /
+               std::chrono::duration<double, std::nano>(t1 - t0).count();
+    }();
+    return value;
+}
+
+std::uint64_t us_to_ticks(double us)
+{
+    return static_cast<std::uint64_t>(us * 1000 * ticks_per_ns());
+}
+
+struct sample {
+    std::uint64_t start;  // ticks
+    std::uint64_t ticks;
+};
+
+// Calls chunk back to back for us microseconds, timing each call.
+template <class Chunk>
+std::vector<sample> record(Chunk chunk, double us)
+{
+    std::vector<sample> v;
+    v.reserve(static_cast<std::size_t>(us) * 4);
+    const std::uint64_t end = ticks() + us_to_ticks(us);
+    for (std::uint64_t t = ticks(); t < end;) {
+        chunk();
+        const std::uint64_t t1 = ticks();
+        v.push_back({t, t1 - t});
+        t = t1;
+    }
+    return v;
+}
+
+// About a microsecond of dependent scalar adds: 2400 of them, one per
+// cycle, as cycles_of() assumes.
+constexpr std::uint64_t add_chunk_iters = 200;
+constexpr double adds_per_chunk = add_chunk_iters * 12;
+
+void add_chunk()
+{
+    calib_add_chain(add_chunk_iters);
+}
+
+void scalar_for(double us)
+{
+    const std::uint64_t end = ticks() + us_to_ticks(us);
+    while (ticks() < end)
+        add_chunk();
+}
+
+alignas(4096) unsigned char burst_scratch[4096];
+
+struct wide_isa {
+    const char* name;
+    bool supported;
+    void (*chunk)();        // about a microsecond of vector adds
+    void (*burst)(std::uint64_t, void*);  // FMA throughput kernel
+};
+
+std::vector<wide_isa> wide_isas()
+{
+    const cpu_features& f = detect_cpu_features();
+    return {
+#if defined(__x86_64__) || defined(_M_X64)
+        {"avx2", f.avx2 && f.fma, [] { avx_unroll_8(64); },
+         insn_avx_vfmadd231ps_tput},
+        {"avx512", f.avx512f, [] { avx512_unroll_8(64); },
+         insn_avx512_vfmadd231ps_tput},
+#elif defined(__aarch64__)
+        {"neon", true, [] { neon_unroll_8(64); }, insn_neon_fmla_tput},
+        {"sve", f.sve, [] { sve_unroll_8(64); }, insn_sve_fmla_tput},
+#endif
+    };
+}
+
+double median(std::vector<double> v)
+{
+    if (v.empty())
+        return 0;
+    std::nth_element(v.begin(), v.begin() + v.size() / 2, v.end());
+    return v[v.size() / 2];
+}
+
+// Time of the first of 10 consecutive samples with rel >= threshold,
+// or a negative value when there is none.
+double settled_us(const std::vector<double>& t_us,
+                  const std::vector<double>& rel, double threshold)
+{
+    std::size_t run = 0;
+    for (std::size_t i = 0; i < rel.size(); ++i) {
+        run = rel[i] >= threshold ? run + 1 : 0;
+        if (run == 10)
+            return t_us[i - 9];
+    }
+    return -1;
+}
+
+void warmup(std::FILE* out, const wide_isa& isa)
+{
+    scalar_for(5000);
+    const std::vector<sample> s = record(isa.chunk, 2000);
+    if (s.empty())
+        return;
+
+    std::vector<double> tail;
+    for (std::size_t i = s.size() * 3 / 4; i < s.size(); ++i)
+        tail.push_back(static_cast<double>(s[i].ticks));
+    const double steady = median(tail);
+
+    std::vector<double> t_us, rel;
+    for (const sample& x : s) {
+        t_us.push_back((x.start - s[0].start) / ticks_per_ns() / 1000);
+        rel.push_back(steady / x.ticks);
+        std::fprintf(out, "%s_warmup,%.3f,%.1f,%.4f,\n", isa.name,
+                     t_us.back(), x.ticks / ticks_per_ns(), rel.back());
+    }
+    std::fprintf(stderr,
+                 "%s_warmup: first chunk at %.0f%% of steady throughput, "
+                 "90%% from %.1f us\n",
+                 isa.name, 100 * rel[0], settled_us(t_us, rel, 0.9));
+}
+
+void recovery(std::FILE* out, const wide_isa& isa)
+{
+    const std::vector<sample> before = record(add_chunk, 1000);
+    const std::uint64_t end = ticks() + us_to_ticks(10000);
+    while (ticks() < end)
+        isa.burst(1000, burst_scratch);
+    const std::vector<sample> after = record(add_chunk, 5000);
+    if (before.empty() || after.empty())
+        return;
+
+    auto ghz = [](const sample& x) {
+        return adds_per_chunk / (x.ticks / ticks_per_ns());
+    };
+    std::vector<double> base;
+    for (const sample& x : before)
+        base.push_back(ghz(x));
+    const double base_ghz = median(base);
+
+    const std::uint64_t t0 = after[0].start;
+    auto row = [&](const sample& x, double t_us) {
+        std::fprintf(out, "%s_recovery,%.3f,%.1f,%.4f,%.4f\n", isa.name,
+                     t_us, x.ticks / ticks_per_ns(), ghz(x) / base_ghz,
+                     ghz(x));
+    };
+    for (const sample& x : before)
+        row(x, -((t0 - x.start) / ticks_per_ns() / 1000));
+    std::vector<double> t_us, rel;
+    for (const sample& x : after) {
+        t_us.push_back((x.start - t0) / ticks_per_ns() / 1000);
+        rel.push_back(ghz(x) / base_ghz);
+        row(x, t_us.back());
+    }
+    std::fprintf(stderr,
+                 "%s_recovery: %.2f GHz right after the burst, within 2%% "
+                 "of %.2f GHz from %.1f us\n",
+                 isa.name, ghz(after[0]), base_ghz,
+                 settled_us(t_us, rel, 0.98));
+}
+
+}  // namespace
+
+void run_transients(std::FILE* out)
+{
+    std::fprintf(out, "series,t_us,chunk_ns,rel,ghz\n");
+    for (const wide_isa& isa : wide_isas()) {
+        if (!isa.supported)
+            continue;
+        warmup(out, isa);
+        recovery(out, isa);
+    }
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstdio>
+
+///////////////////////////////////////////////////////////////
+// Wide-vector transients
+//
+// Time series with one sample per chunk of about a microsecond, so the
+// transient is visible instead of averaged into a benchmark result:
+//
+//   <isa>_warmup    the ISA's add kernel, started after 5 ms of scalar
+//                   work has let the upper lanes power down; rel is
+//                   the chunk's throughput over the steady state at
+//                   the end of the series
+//   <isa>_recovery  scalar adds after a 10 ms burst of the ISA's FMAs;
+//                   ghz is the clock from the dependent add chain, rel
+//                   that over the clock before the burst
+//
+// Written as CSV, series,t_us,chunk_ns,rel,ghz, with t_us counted from
+// the start of the wide kernel or the end of the burst; samples of the
+// pre-burst baseline have negative times.
+///////////////////////////////////////////////////////////////
+
+// Runs every series the CPU supports into out, with a one-line summary
+// of each on stderr.
+void run_transients(std::FILE* out);
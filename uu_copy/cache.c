@@ -0,0 +1,217 @@
+// cache.c - cache hierarchy detection and cold-cache helpers
+#define _GNU_SOURCE
+#include "cache.h"
+#include "common.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static int
+read_line(const char *dir, const char *name, char *buf, size_t len)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return 0;
+    int ok = fgets(buf, (int)len, f) != NULL;
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return ok;
+}
+
+static void
+detect_sysconf(struct cache_info *ci)
+{
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    long v;
+    if ((v = sysconf(_SC_LEVEL1_DCACHE_LINESIZE)) > 0)
+        ci->line = (size_t)v;
+    if ((v = sysconf(_SC_LEVEL1_DCACHE_SIZE)) > 0)
+        ci->l1d = (size_t)v;
+    if ((v = sysconf(_SC_LEVEL2_CACHE_SIZE)) > 0)
+        ci->l2 = (size_t)v;
+    if ((v = sysconf(_SC_LEVEL3_CACHE_SIZE)) > 0)
+        ci->l3 = (size_t)v;
+#else
+    (void)ci;
+#endif
+}
+
+void
+detect_caches(struct cache_info *ci)
+{
+    memset(ci, 0, sizeof(*ci));
+    for (int i = 0;; ++i) {
+        char dir[128], level[16], type[32], size[32], line[16];
+        snprintf(dir, sizeof(dir), "/sys/devices/system/cpu/cpu0/cache/index%d",
+                 i);
+        if (!read_line(dir, "level", level, sizeof(level)))
+            break;
+        if (!read_line(dir, "type", type, sizeof(type)) ||
+            strcmp(type, "Instruction") == 0 ||
+            !read_line(dir, "size", size, sizeof(size)))
+            continue;
+        size_t bytes = parse_size(size);
+        if (read_line(dir, "coherency_line_size", line, sizeof(line)))
+            ci->line = parse_size(line);
+        switch (atoi(level)) {
+        case 1:
+            ci->l1d = bytes;
+            break;
+        case 2:
+            ci->l2 = bytes;
+            break;
+        case 3:
+            ci->l3 = bytes;
+            break;
+        }
+    }
+    if (ci->l1d == 0 && ci->l2 == 0 && ci->l3 == 0)
+        detect_sysconf(ci);
+    if (ci->line == 0)
+        ci->line = 64;
+}
+
+size_t
+cache_level_size(const struct cache_info *ci, int level)
+{
+    switch (level) {
+    case 1:
+        return ci->l1d;
+    case 2:
+        return ci->l2;
+    case 3:
+        return ci->l3;
+    default:
+        return 0;
+    }
+}
+
+int
+cache_level_of(const struct cache_info *ci, size_t footprint)
+{
+    for (int level = 1; level <= 3; ++level) {
+        size_t size = cache_level_size(ci, level);
+        if (size != 0 && footprint <= size)
+            return level;
+    }
+    return 4;
+}
+
+const char *
+cache_level_name(int level)
+{
+    static const char *names[] = {"L1d", "L2", "L3", "mem"};
+    return level >= 1 && level <= 4 ? names[level - 1] : "?";
+}
+
+#if defined(__x86_64__)
+
+static int
+cpu_has_clflushopt(void)
+{
+    unsigned a, b, c, d;
+    return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1u << 23));
+}
+
+__attribute__((target("clflushopt"))) static void
+flush_opt(const char *p, const char *end)
+{
+    for (; p < end; p += 64)
+        _mm_clflushopt((void *)p);
+}
+
+static void
+flush_legacy(const char *p, const char *end)
+{
+    for (; p < end; p += 64)
+        _mm_clflush(p);
+}
+
+int
+have_flush_lines(void)
+{
+    return 1;
+}
+
+/* clflushopt is weakly ordered, the mfence waits for all of them. */
+void
+flush_lines(const void *p, size_t len)
+{
+    static int opt = -1;
+    if (opt < 0)
+        opt = cpu_has_clflushopt();
+    const char *c = (const char *)((uintptr_t)p & ~(uintptr_t)63);
+    const char *end = (const char *)p + len;
+    if (opt)
+        flush_opt(c, end);
+    else
+        flush_legacy(c, end);
+    _mm_mfence();
+}
+
+#elif defined(__aarch64__)
+
+int
+have_flush_lines(void)
+{
+    return 1;
+}
+
+/* dc civac to the point of coherency, 64-byte lines assumed. */
+void
+flush_lines(const void *p, size_t len)
+{
+    const char *c = (const char *)((uintptr_t)p & ~(uintptr_t)63);
+    const char *end = (const char *)p + len;
+    for (; c < end; c += 64)
+        asm volatile("dc civac, %0" : : "r"(c) : "memory");
+    asm volatile("dsb ish" : : : "memory");
+}
+
+#else
+
+int
+have_flush_lines(void)
+{
+    return 0;
+}
+
+void
+flush_lines(const void *p, size_t len)
+{
+    (void)p;
+    (void)len;
+}
+
+#endif
+
+void
+evict_caches(const struct cache_info *ci)
+{
+    static unsigned char *buf;
+    static size_t len;
+    if (buf == NULL) {
+        size_t largest = ci->l3 ? ci->l3 : ci->l2 ? ci->l2 : ci->l1d;
+        len = largest ? 2 * largest : 64 << 20;
+        buf = malloc(len);
+        if (buf == NULL)
+            die("malloc");
+        memset(buf, 0x5A, len);
+    }
+
+    /* Reads only, so the buffer leaves no dirty lines to write back. */
+    unsigned sum = 0;
+    for (size_t i = 0; i < len; i += ci->line)
+        sum += buf[i];
+    DoNotOptimize(sum);
+}
@@ -0,0 +1,52 @@
+// cache.h - cache hierarchy detection and cold-cache helpers
+#ifndef UU_COPY_CACHE_H
+#define UU_COPY_CACHE_H
+
+#include <stddef.h>
+
+/* Data cache sizes of CPU 0 in bytes, 0 for levels it does not have. */
+struct cache_info {
+    size_t line;
+    size_t l1d;
+    size_t l2;
+    size_t l3;
+};
+
+/* How the copies of a cell are made cold. */
+enum flush_mode {
+    FLUSH_NONE,
+    FLUSH_LINES, /* clflushopt (clflush, dc civac) the lines of the copy */
+    FLUSH_EVICT, /* read an eviction buffer twice the largest cache */
+};
+
+/*
+ * Read the data and unified caches from
+ * /sys/devices/system/cpu/cpu0/cache/index*, falling back to sysconf.
+ */
+void detect_caches(struct cache_info *ci);
+
+/* The smallest level footprint bytes fit in: 1 to 3, or 4 for memory. */
+int cache_level_of(const struct cache_info *ci, size_t footprint);
+
+/* "L1d", "L2", "L3" or "mem". */
+const char *cache_level_name(int level);
+
+/* Size of the given level, 0 for memory or a missing level. */
+size_t cache_level_size(const struct cache_info *ci, int level);
+
+/* Whether flush_lines can write back and invalidate on this CPU. */
+int have_flush_lines(void);
+
+/*
+ * Write back and invalidate every line of [p, p + len) from all cache
+ * levels, and wait until that is done.
+ */
+void flush_lines(const void *p, size_t len);
+
+/*
+ * Read a buffer twice the size of the largest cache, allocated on the
+ * first call, to push everything else out.
+ */
+void evict_caches(const struct cache_info *ci);
+
+#endif
@@ -0,0 +1,145 @@
+// common.c - helpers shared by the uu_copy_bench modes
+#define _GNU_SOURCE
+#include "common.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+void
+die(const char *msg)
+{
+    perror(msg);
+    exit(EXIT_FAILURE);
+}
+
+size_t
+parse_size(const char *s)
+{
+    char *end;
+    errno = 0;
+    unsigned long long val = strtoull(s, &end, 10);
+    if (errno != 0 || end == s) {
+        fprintf(stderr, "Invalid size: %s\n", s);
+        exit(EXIT_FAILURE);
+    }
+
+    switch (*end) {
+    case 'k': case 'K':
+        val *= 1024ULL;
+        break;
+    case 'm': case 'M':
+        val *= 1024ULL * 1024ULL;
+        break;
+    case 'g': case 'G':
+        val *= 1024ULL * 1024ULL * 1024ULL;
+        break;
+    case '\0':
+        break;
+    default:
+        fprintf(stderr, "Unknown size suffix '%c' in \"%s\"\n", *end, s);
+        exit(EXIT_FAILURE);
+    }
+
+    return (size_t)val;
+}
+
+uint64_t
+parse_duration_ns(const char *s)
+{
+    char *end;
+    errno = 0;
+    double val = strtod(s, &end);
+    if (errno != 0 || end == s || val <= 0) {
+        fprintf(stderr, "Invalid duration: %s\n", s);
+        exit(EXIT_FAILURE);
+    }
+
+    if (strcmp(end, "s") == 0)
+        val *= 1e9;
+    else if (strcmp(end, "ms") == 0)
+        val *= 1e6;
+    else if (strcmp(end, "us") == 0)
+        val *= 1e3;
+    else if (strcmp(end, "ns") != 0 && *end != '\0') {
+        fprintf(stderr, "Unknown duration unit \"%s\" in \"%s\"\n", end, s);
+        exit(EXIT_FAILURE);
+    }
+
+    return (uint64_t)val;
+}
+
+int *
+parse_int_list(const char *s, int max, size_t *count)
+{
+    size_t cap = 16, n = 0;
+    int *vals = malloc(cap * sizeof(*vals));
+    if (vals == NULL)
+        die("malloc");
+
+    const char *p = s;
+    for (;;) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p)
+            goto invalid;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p)
+                goto invalid;
+        }
+        if (first < 0 || last < first || last > max)
+            goto invalid;
+        for (long v = first; v <= last; ++v) {
+            if (n == cap) {
+                cap *= 2;
+                vals = realloc(vals, cap * sizeof(*vals));
+                if (vals == NULL)
+                    die("realloc");
+            }
+            vals[n++] = (int)v;
+        }
+        if (*end == '\0')
+            break;
+        if (*end != ',')
+            goto invalid;
+        p = end + 1;
+    }
+
+    *count = n;
+    return vals;
+
+invalid:
+    fprintf(stderr, "Invalid list \"%s\" (values 0..%d, e.g. 0,1,8-15)\n",
+            s, max);
+    exit(EXIT_FAILURE);
+}
+
+uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+        die("clock_gettime");
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+const char *
+format_size(size_t size, char *buf, size_t len)
+{
+    static const char suffix[] = "KMG";
+    int unit = -1;
+    while (size >= 1024 && size % 1024 == 0 && unit < 2) {
+        size /= 1024;
+        ++unit;
+    }
+    if (unit < 0)
+        snprintf(buf, len, "%zu", size);
+    else
+        snprintf(buf, len, "%zu%c", size, suffix[unit]);
+    return buf;
+}
@@ -0,0 +1,38 @@
+// common.h - helpers shared by the uu_copy_bench modes
+#ifndef UU_COPY_COMMON_H
+#define UU_COPY_COMMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DoNotOptimize(value) asm volatile("" : "=r"(value) : "0"(value))
+#define ClobberMemory() asm volatile("" : : : "memory")
+
+void die(const char *msg);
+
+/*
+ * Parse sizes like:
+ *   4096
+ *   64K, 1M, 2G
+ */
+size_t parse_size(const char *s);
+
+/*
+ * Parse durations like 500us, 20ms, 2s; a bare number is in nanoseconds.
+ * Exits on malformed input.
+ */
+uint64_t parse_duration_ns(const char *s);
+
+/*
+ * Parse a list of small non-negative integers like "0,1,8-15" into a newly
+ * allocated array. Values above max are rejected.
+ */
+int *parse_int_list(const char *s, int max, size_t *count);
+
+/* CLOCK_MONOTONIC in nanoseconds. */
+uint64_t now_ns(void);
+
+/* "64K", "1M" for exact binary multiples, plain bytes otherwise. */
+const char *format_size(size_t size, char *buf, size_t len);
+
+#endif
@@ -0,0 +1,358 @@
+// faults.c - copies into freshly mapped memory, and mremap against memcpy
+#define _GNU_SOURCE
+#include "faults.h"
+#include "common.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#define THP_SIZE (2UL << 20) /* PMD size on x86-64 and arm64 with 4K pages */
+
+enum page_kind
+parse_page_kind(const char *s)
+{
+    if (strcmp(s, "normal") == 0 || strcmp(s, "4k") == 0 ||
+        strcmp(s, "4K") == 0)
+        return PAGES_NORMAL;
+    if (strcmp(s, "thp") == 0)
+        return PAGES_THP;
+    if (strcmp(s, "hugetlb") == 0)
+        return PAGES_HUGETLB;
+    fprintf(stderr, "Unknown page kind: %s (normal, thp or hugetlb)\n", s);
+    exit(EXIT_FAILURE);
+}
+
+static const char *
+page_kind_name(enum page_kind pages)
+{
+    switch (pages) {
+    case PAGES_THP:
+        return "thp";
+    case PAGES_HUGETLB:
+        return "hugetlb";
+    default:
+        return "normal";
+    }
+}
+
+/* Hugepagesize from /proc/meminfo, the size MAP_HUGETLB gets by default. */
+static size_t
+hugetlb_page_size(void)
+{
+    char line[128];
+    size_t kb = 0;
+    FILE *f = fopen("/proc/meminfo", "r");
+    if (f == NULL)
+        return THP_SIZE;
+    while (fgets(line, sizeof(line), f) != NULL)
+        if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1)
+            break;
+    fclose(f);
+    return kb > 0 ? kb * 1024 : THP_SIZE;
+}
+
+/* Bytes actually mapped for len, whole pages of the kind. */
+static size_t
+mapped_len(size_t len, enum page_kind pages)
+{
+    static size_t huge;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    if (pages == PAGES_THP) {
+        page = THP_SIZE;
+    } else if (pages == PAGES_HUGETLB) {
+        if (huge == 0)
+            huge = hugetlb_page_size();
+        page = huge;
+    }
+    return (len + page - 1) / page * page;
+}
+
+/*
+ * Map mapped_len(len, pages) bytes. THP mappings are over-allocated by a
+ * huge page and trimmed to an aligned range, so that the result can go to
+ * munmap and mremap as it is.
+ */
+static char *
+map_pages(size_t len, enum page_kind pages, int prot)
+{
+    len = mapped_len(len, pages);
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    if (pages == PAGES_HUGETLB) {
+        void *p = mmap(NULL, len, prot, flags | MAP_HUGETLB, -1, 0);
+        if (p == MAP_FAILED) {
+            fprintf(stderr, "mmap of %zu bytes of huge pages failed: %s (are "
+                    "huge pages reserved in /proc/sys/vm/nr_hugepages?)\n",
+                    len, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        return p;
+    }
+    if (pages == PAGES_NORMAL) {
+        void *p = mmap(NULL, len, prot, flags, -1, 0);
+        if (p == MAP_FAILED)
+            die("mmap");
+        return p;
+    }
+
+    size_t over = len + THP_SIZE;
+    char *map = mmap(NULL, over, prot, flags, -1, 0);
+    if (map == MAP_FAILED)
+        die("mmap");
+    char *base = (char *)(((uintptr_t)map + THP_SIZE - 1) & ~(THP_SIZE - 1));
+    if (base > map)
+        munmap(map, base - map);
+    if (map + over > base + len)
+        munmap(base + len, map + over - (base + len));
+    if (madvise(base, len, MADV_HUGEPAGE) != 0) {
+        static int warned;
+        if (!warned)
+            perror("madvise(MADV_HUGEPAGE)");
+        warned = 1;
+    }
+    return base;
+}
+
+static long
+minor_faults(void)
+{
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0)
+        die("getrusage");
+    return ru.ru_minflt;
+}
+
+struct fresh_row {
+    uint64_t iters;
+    double touched_ns;  /* copy into one destination touched long ago */
+    double fresh_ns;    /* copy into a destination mapped just before */
+    double map_ns;      /* mmap and munmap of the fresh destination */
+    double faults;      /* minor faults per fresh copy */
+};
+
+/*
+ * Each round maps a destination, copies into it and unmaps it, then copies
+ * the same source into a destination that stays mapped, as the baseline.
+ */
+static void
+measure_fresh(const struct faults_config *cfg, size_t size, const char *src,
+              char *touched, struct fresh_row *row)
+{
+    size_t len = mapped_len(size, cfg->pages);
+    uint64_t fresh = 0, map = 0, base = 0, iters = 0, start = now_ns();
+    long faults = 0;
+    do {
+        uint64_t t0 = now_ns();
+        char *dst = map_pages(size, cfg->pages, PROT_READ | PROT_WRITE);
+        long f0 = minor_faults();
+        uint64_t t1 = now_ns();
+        cfg->kernel->copy(dst, src, size);
+        uint64_t t2 = now_ns();
+        long f1 = minor_faults();
+        uint64_t t3 = now_ns();
+        if (munmap(dst, len) != 0)
+            die("munmap");
+        uint64_t t4 = now_ns();
+        cfg->kernel->copy(touched, src, size);
+        uint64_t t5 = now_ns();
+
+        fresh += t2 - t1;
+        map += (t1 - t0) + (t4 - t3);
+        base += t5 - t4;
+        faults += f1 - f0;
+        ++iters;
+    } while (iters < 3 || now_ns() - start < cfg->budget_ns);
+
+    row->iters = iters;
+    row->touched_ns = (double)base / iters;
+    row->fresh_ns = (double)fresh / iters;
+    row->map_ns = (double)map / iters;
+    row->faults = (double)faults / iters;
+}
+
+struct mremap_row {
+    uint64_t iters;
+    double copy_ns;       /* copy to a fresh mapping and unmap the source */
+    double copy_faults;
+    double mremap_ns;     /* mremap the source onto a reserved range */
+    double mremap_faults;
+};
+
+/*
+ * Both halves move a freshly written buffer to another address and leave
+ * nothing at the old one. Mapping and filling the source, and mapping the
+ * destination or the range mremap lands on, are not timed.
+ */
+static void
+measure_mremap(const struct faults_config *cfg, size_t size,
+               struct mremap_row *row)
+{
+    size_t len = mapped_len(size, cfg->pages);
+    uint64_t copy = 0, move = 0, iters = 0, start = now_ns();
+    long copy_faults = 0, move_faults = 0;
+    do {
+        char *src = map_pages(size, cfg->pages, PROT_READ | PROT_WRITE);
+        char *dst = map_pages(size, cfg->pages, PROT_READ | PROT_WRITE);
+        memset(src, 0xA5, size);
+        long f0 = minor_faults();
+        uint64_t t0 = now_ns();
+        cfg->kernel->copy(dst, src, size);
+        if (munmap(src, len) != 0)
+            die("munmap");
+        uint64_t t1 = now_ns();
+        copy_faults += minor_faults() - f0;
+        copy += t1 - t0;
+        if (munmap(dst, len) != 0)
+            die("munmap");
+
+        src = map_pages(size, cfg->pages, PROT_READ | PROT_WRITE);
+        char *hole = map_pages(size, cfg->pages, PROT_NONE);
+        memset(src, 0xA5, size);
+        f0 = minor_faults();
+        t0 = now_ns();
+        char *moved = mremap(src, len, len, MREMAP_MAYMOVE | MREMAP_FIXED,
+                             hole);
+        t1 = now_ns();
+        move_faults += minor_faults() - f0;
+        if (moved == MAP_FAILED)
+            die("mremap");
+        move += t1 - t0;
+        if (moved[size - 1] != (char)0xA5) {
+            fprintf(stderr, "mremap lost the contents of %zu bytes\n", size);
+            exit(EXIT_FAILURE);
+        }
+        if (munmap(moved, len) != 0)
+            die("munmap");
+        ++iters;
+    } while (iters < 3 || now_ns() - start < cfg->budget_ns);
+
+    row->iters = iters;
+    row->copy_ns = (double)copy / iters;
+    row->copy_faults = (double)copy_faults / iters;
+    row->mremap_ns = (double)move / iters;
+    row->mremap_faults = (double)move_faults / iters;
+}
+
+static double
+gib_per_sec(size_t size, double ns)
+{
+    return ns > 0 ? size / ns * 1e9 / (1024.0 * 1024.0 * 1024.0) : 0.0;
+}
+
+static void
+run_fresh(const struct faults_config *cfg)
+{
+    static int csv_header_done;
+    size_t max_size = 0;
+    for (size_t s = 0; s < cfg->nsizes; ++s)
+        if (cfg->sizes[s] > max_size)
+            max_size = cfg->sizes[s];
+    char *src = map_pages(max_size, PAGES_NORMAL, PROT_READ | PROT_WRITE);
+    char *touched = map_pages(max_size, cfg->pages, PROT_READ | PROT_WRITE);
+    memset(src, 0xA5, max_size);
+    memset(touched, 0x00, max_size);
+
+    if (cfg->csv) {
+        if (!csv_header_done)
+            printf("kernel,pages,size,iters,touched_ns,fresh_ns,map_unmap_ns,"
+                   "faults_per_copy\n");
+        csv_header_done = 1;
+    } else {
+        printf("%s into fresh %s pages, %.0f ms per size\n", cfg->kernel->name,
+               page_kind_name(cfg->pages), cfg->budget_ns / 1e6);
+        printf("\n%8s %8s %12s %12s %12s %12s %12s\n", "size", "iters",
+               "touched ns", "fresh ns", "map+unmap ns", "fresh GiB/s",
+               "faults/copy");
+    }
+
+    for (size_t s = 0; s < cfg->nsizes; ++s) {
+        size_t size = cfg->sizes[s];
+        struct fresh_row row;
+        measure_fresh(cfg, size, src, touched, &row);
+        if (cfg->csv) {
+            printf("%s,%s,%zu,%" PRIu64 ",%.1f,%.1f,%.1f,%.2f\n",
+                   cfg->kernel->name, page_kind_name(cfg->pages), size,
+                   row.iters, row.touched_ns, row.fresh_ns, row.map_ns,
+                   row.faults);
+            continue;
+        }
+        char label[32];
+        printf("%8s %8" PRIu64 " %12.0f %12.0f %12.0f %12.2f %12.2f\n",
+               format_size(size, label, sizeof(label)), row.iters,
+               row.touched_ns, row.fresh_ns, row.map_ns,
+               gib_per_sec(size, row.fresh_ns), row.faults);
+    }
+
+    munmap(src, mapped_len(max_size, PAGES_NORMAL));
+    munmap(touched, mapped_len(max_size, cfg->pages));
+}
+
+static void
+run_mremap(const struct faults_config *cfg)
+{
+    static int csv_header_done;
+    if (cfg->csv) {
+        if (!csv_header_done)
+            printf("kernel,pages,size,iters,copy_ns,copy_faults,mremap_ns,"
+                   "mremap_faults\n");
+        csv_header_done = 1;
+    } else {
+        printf("%s vs mremap, %s pages, %.0f ms per size\n", cfg->kernel->name,
+               page_kind_name(cfg->pages), cfg->budget_ns / 1e6);
+        printf("\n%8s %8s %12s %12s %12s %12s %8s\n", "size", "iters",
+               "copy ns", "copy faults", "mremap ns", "mremap flts",
+               "speedup");
+    }
+
+    /* The sizes where mremap takes the lead or loses it. */
+    int *ahead = calloc(cfg->nsizes, sizeof(*ahead));
+    if (ahead == NULL)
+        die("calloc");
+    for (size_t s = 0; s < cfg->nsizes; ++s) {
+        size_t size = cfg->sizes[s];
+        struct mremap_row row;
+        measure_mremap(cfg, size, &row);
+        ahead[s] = row.mremap_ns < row.copy_ns;
+        if (cfg->csv) {
+            printf("%s,%s,%zu,%" PRIu64 ",%.1f,%.2f,%.1f,%.2f\n",
+                   cfg->kernel->name, page_kind_name(cfg->pages), size,
+                   row.iters, row.copy_ns, row.copy_faults, row.mremap_ns,
+                   row.mremap_faults);
+            continue;
+        }
+        char label[32];
+        printf("%8s %8" PRIu64 " %12.0f %12.2f %12.0f %12.2f %7.2fx\n",
+               format_size(size, label, sizeof(label)), row.iters,
+               row.copy_ns, row.copy_faults, row.mremap_ns, row.mremap_faults,
+               row.mremap_ns > 0 ? row.copy_ns / row.mremap_ns : 0.0);
+    }
+
+    FILE *out = cfg->csv ? stderr : stdout;
+    char label[32];
+    fprintf(out, "\nCrossovers\n");
+    fprintf(out, "%8s  mremap %s %s\n",
+            format_size(cfg->sizes[0], label, sizeof(label)),
+            ahead[0] ? "ahead of" : "behind", cfg->kernel->name);
+    for (size_t s = 1; s < cfg->nsizes; ++s)
+        if (ahead[s] != ahead[s - 1])
+            fprintf(out, "%8s  mremap %s %s\n",
+                    format_size(cfg->sizes[s], label, sizeof(label)),
+                    ahead[s] ? "overtakes" : "falls behind",
+                    cfg->kernel->name);
+    free(ahead);
+}
+
+void
+run_faults(const struct faults_config *cfg)
+{
+    if (cfg->mode == FAULT_MREMAP)
+        run_mremap(cfg);
+    else
+        run_fresh(cfg);
+}
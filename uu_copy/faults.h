@@ -0,0 +1,37 @@
+// faults.h - copies into freshly mapped memory, and mremap against memcpy
+#ifndef UU_COPY_FAULTS_H
+#define UU_COPY_FAULTS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kernels.h"
+
+enum page_kind {
+    PAGES_NORMAL,  /* base pages, 4K on x86-64 */
+    PAGES_THP,     /* 2M aligned and madvise(MADV_HUGEPAGE) */
+    PAGES_HUGETLB, /* MAP_HUGETLB, needs reserved huge pages */
+};
+
+enum fault_mode {
+    FAULT_FRESH_DST, /* every copy goes to a newly mapped destination */
+    FAULT_MREMAP,    /* move a buffer by copying or by mremap */
+};
+
+struct faults_config {
+    const struct copy_kernel *kernel;
+    size_t *sizes;
+    size_t nsizes;
+    enum fault_mode mode;
+    enum page_kind pages;  /* of every mapping the mode makes */
+    uint64_t budget_ns;    /* per size, at least three rounds */
+    int csv;
+};
+
+/* Parse "normal" (or "4k"), "thp" or "hugetlb". Exits on anything else. */
+enum page_kind parse_page_kind(const char *s);
+
+/* Run cfg->mode at every size and print one row per size. */
+void run_faults(const struct faults_config *cfg);
+
+#endif
@@ -0,0 +1,526 @@
+// kernels.c - registry of copy implementations
+#define _GNU_SOURCE
+#include "kernels.h"
+#include "common.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifdef __ARM_FEATURE_SVE
+#include <arm_sve.h>
+#endif
+#endif
+
+/*
+ * Copies below the vector width. Both loads happen before the stores and
+ * may overlap each other, so every size takes two moves at most. The fixed
+ * size memcpy calls compile to plain moves.
+ */
+static inline void
+copy_small(char *d, const char *s, size_t n)
+{
+    if (n >= 8) {
+        uint64_t a, b;
+        memcpy(&a, s, 8);
+        memcpy(&b, s + n - 8, 8);
+        memcpy(d, &a, 8);
+        memcpy(d + n - 8, &b, 8);
+    } else if (n >= 4) {
+        uint32_t a, b;
+        memcpy(&a, s, 4);
+        memcpy(&b, s + n - 4, 4);
+        memcpy(d, &a, 4);
+        memcpy(d + n - 4, &b, 4);
+    } else if (n >= 2) {
+        uint16_t a, b;
+        memcpy(&a, s, 2);
+        memcpy(&b, s + n - 2, 2);
+        memcpy(d, &a, 2);
+        memcpy(d + n - 2, &b, 2);
+    } else if (n == 1) {
+        *d = *s;
+    }
+}
+
+static void *
+copy_libc(void *dst, const void *src, size_t n)
+{
+    return memcpy(dst, src, n);
+}
+
+#if defined(__x86_64__)
+
+static int
+cpu_has_erms(void)
+{
+    unsigned a, b, c, d;
+    return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1u << 9));
+}
+
+static int
+cpu_has_fsrm(void)
+{
+    unsigned a, b, c, d;
+    return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (d & (1u << 4));
+}
+
+static int
+cpu_has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+static int
+cpu_has_avx512(void)
+{
+    return __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512bw");
+}
+
+static void *
+copy_rep_movsb(void *dst, const void *src, size_t n)
+{
+    void *d = dst;
+    asm volatile("rep movsb" : "+D"(d), "+S"(src), "+c"(n) : : "memory");
+    return dst;
+}
+
+static void *
+copy_rep_movsq(void *dst, const void *src, size_t n)
+{
+    void *d = dst;
+    size_t quads = n / 8, tail = n % 8;
+    asm volatile("rep movsq" : "+D"(d), "+S"(src), "+c"(quads) : : "memory");
+    asm volatile("rep movsb" : "+D"(d), "+S"(src), "+c"(tail) : : "memory");
+    return dst;
+}
+
+/*
+ * The vector kernels move four vectors per iteration, then single vectors,
+ * and finish with one unaligned vector ending exactly at dst + n, which may
+ * rewrite bytes already copied.
+ */
+static void *
+copy_sse2(void *dst, const void *src, size_t n)
+{
+    char *d = dst;
+    const char *s = src;
+    if (n < 16) {
+        copy_small(d, s, n);
+        return dst;
+    }
+    __m128i tail = _mm_loadu_si128((const __m128i *)(s + n - 16));
+    char *end = d + n - 16;
+    for (; end - d >= 64; d += 64, s += 64) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)s);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i v3 = _mm_loadu_si128((const __m128i *)(s + 48));
+        _mm_storeu_si128((__m128i *)d, v0);
+        _mm_storeu_si128((__m128i *)(d + 16), v1);
+        _mm_storeu_si128((__m128i *)(d + 32), v2);
+        _mm_storeu_si128((__m128i *)(d + 48), v3);
+    }
+    for (; d < end; d += 16, s += 16)
+        _mm_storeu_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+    _mm_storeu_si128((__m128i *)end, tail);
+    return dst;
+}
+
+__attribute__((target("avx2"))) static void *
+copy_avx2(void *dst, const void *src, size_t n)
+{
+    char *d = dst;
+    const char *s = src;
+    if (n < 32) {
+        if (n >= 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)s);
+            __m128i b = _mm_loadu_si128((const __m128i *)(s + n - 16));
+            _mm_storeu_si128((__m128i *)d, a);
+            _mm_storeu_si128((__m128i *)(d + n - 16), b);
+        } else {
+            copy_small(d, s, n);
+        }
+        return dst;
+    }
+    __m256i tail = _mm256_loadu_si256((const __m256i *)(s + n - 32));
+    char *end = d + n - 32;
+    for (; end - d >= 128; d += 128, s += 128) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)s);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(s + 32));
+        __m256i v2 = _mm256_loadu_si256((const __m256i *)(s + 64));
+        __m256i v3 = _mm256_loadu_si256((const __m256i *)(s + 96));
+        _mm256_storeu_si256((__m256i *)d, v0);
+        _mm256_storeu_si256((__m256i *)(d + 32), v1);
+        _mm256_storeu_si256((__m256i *)(d + 64), v2);
+        _mm256_storeu_si256((__m256i *)(d + 96), v3);
+    }
+    for (; d < end; d += 32, s += 32)
+        _mm256_storeu_si256((__m256i *)d,
+                            _mm256_loadu_si256((const __m256i *)s));
+    _mm256_storeu_si256((__m256i *)end, tail);
+    return dst;
+}
+
+/* Below one vector AVX-512 uses a byte masked move instead. */
+__attribute__((target("avx512f,avx512bw"))) static void *
+copy_avx512(void *dst, const void *src, size_t n)
+{
+    char *d = dst;
+    const char *s = src;
+    if (n < 64) {
+        __mmask64 m = n ? ~0ULL >> (64 - n) : 0;
+        _mm512_mask_storeu_epi8(d, m, _mm512_maskz_loadu_epi8(m, s));
+        return dst;
+    }
+    __m512i tail = _mm512_loadu_si512(s + n - 64);
+    char *end = d + n - 64;
+    for (; end - d >= 256; d += 256, s += 256) {
+        __m512i v0 = _mm512_loadu_si512(s);
+        __m512i v1 = _mm512_loadu_si512(s + 64);
+        __m512i v2 = _mm512_loadu_si512(s + 128);
+        __m512i v3 = _mm512_loadu_si512(s + 192);
+        _mm512_storeu_si512(d, v0);
+        _mm512_storeu_si512(d + 64, v1);
+        _mm512_storeu_si512(d + 128, v2);
+        _mm512_storeu_si512(d + 192, v3);
+    }
+    for (; d < end; d += 64, s += 64)
+        _mm512_storeu_si512(d, _mm512_loadu_si512(s));
+    _mm512_storeu_si512(end, tail);
+    return dst;
+}
+
+/*
+ * Non-temporal variants: a regular store of the first vector, streaming
+ * stores from the next aligned destination address on, a regular store of
+ * the last vector, and an sfence so the copy is globally visible on
+ * return like any other memcpy. Too small to align, they fall back to the
+ * plain kernel of the same width.
+ */
+static void *
+copy_nt_sse2(void *dst, const void *src, size_t n)
+{
+    if (n < 2 * 16)
+        return copy_sse2(dst, src, n);
+    char *d = dst;
+    const char *s = src;
+    __m128i head = _mm_loadu_si128((const __m128i *)s);
+    __m128i tail = _mm_loadu_si128((const __m128i *)(s + n - 16));
+    char *end = d + n - 16;
+    size_t skew = 16 - ((uintptr_t)d & 15);
+    _mm_storeu_si128((__m128i *)d, head);
+    d += skew;
+    s += skew;
+    for (; end - d >= 64; d += 64, s += 64) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)s);
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(s + 16));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(s + 32));
+        __m128i v3 = _mm_loadu_si128((const __m128i *)(s + 48));
+        _mm_stream_si128((__m128i *)d, v0);
+        _mm_stream_si128((__m128i *)(d + 16), v1);
+        _mm_stream_si128((__m128i *)(d + 32), v2);
+        _mm_stream_si128((__m128i *)(d + 48), v3);
+    }
+    for (; d < end; d += 16, s += 16)
+        _mm_stream_si128((__m128i *)d, _mm_loadu_si128((const __m128i *)s));
+    _mm_sfence();
+    _mm_storeu_si128((__m128i *)end, tail);
+    return dst;
+}
+
+__attribute__((target("avx2"))) static void *
+copy_nt_avx2(void *dst, const void *src, size_t n)
+{
+    if (n < 2 * 32)
+        return copy_avx2(dst, src, n);
+    char *d = dst;
+    const char *s = src;
+    __m256i head = _mm256_loadu_si256((const __m256i *)s);
+    __m256i tail = _mm256_loadu_si256((const __m256i *)(s + n - 32));
+    char *end = d + n - 32;
+    size_t skew = 32 - ((uintptr_t)d & 31);
+    _mm256_storeu_si256((__m256i *)d, head);
+    d += skew;
+    s += skew;
+    for (; end - d >= 128; d += 128, s += 128) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)s);
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(s + 32));
+        __m256i v2 = _mm256_loadu_si256((const __m256i *)(s + 64));
+        __m256i v3 = _mm256_loadu_si256((const __m256i *)(s + 96));
+        _mm256_stream_si256((__m256i *)d, v0);
+        _mm256_stream_si256((__m256i *)(d + 32), v1);
+        _mm256_stream_si256((__m256i *)(d + 64), v2);
+        _mm256_stream_si256((__m256i *)(d + 96), v3);
+    }
+    for (; d < end; d += 32, s += 32)
+        _mm256_stream_si256((__m256i *)d,
+                            _mm256_loadu_si256((const __m256i *)s));
+    _mm_sfence();
+    _mm256_storeu_si256((__m256i *)end, tail);
+    return dst;
+}
+
+__attribute__((target("avx512f,avx512bw"))) static void *
+copy_nt_avx512(void *dst, const void *src, size_t n)
+{
+    if (n < 2 * 64)
+        return copy_avx512(dst, src, n);
+    char *d = dst;
+    const char *s = src;
+    __m512i head = _mm512_loadu_si512(s);
+    __m512i tail = _mm512_loadu_si512(s + n - 64);
+    char *end = d + n - 64;
+    size_t skew = 64 - ((uintptr_t)d & 63);
+    _mm512_storeu_si512(d, head);
+    d += skew;
+    s += skew;
+    for (; end - d >= 256; d += 256, s += 256) {
+        __m512i v0 = _mm512_loadu_si512(s);
+        __m512i v1 = _mm512_loadu_si512(s + 64);
+        __m512i v2 = _mm512_loadu_si512(s + 128);
+        __m512i v3 = _mm512_loadu_si512(s + 192);
+        _mm512_stream_si512((__m512i *)d, v0);
+        _mm512_stream_si512((__m512i *)(d + 64), v1);
+        _mm512_stream_si512((__m512i *)(d + 128), v2);
+        _mm512_stream_si512((__m512i *)(d + 192), v3);
+    }
+    for (; d < end; d += 64, s += 64)
+        _mm512_stream_si512((__m512i *)d, _mm512_loadu_si512(s));
+    _mm_sfence();
+    _mm512_storeu_si512(end, tail);
+    return dst;
+}
+
+static const struct copy_kernel kernels[] = {
+    {"memcpy", "libc memcpy", copy_libc, NULL},
+    {"rep_movsb", "rep movsb (fast with ERMS/FSRM)", copy_rep_movsb, NULL},
+    {"rep_movsq", "rep movsq, rep movsb for the tail", copy_rep_movsq, NULL},
+    {"sse2", "16-byte loadu/storeu loop", copy_sse2, NULL},
+    {"avx2", "32-byte loadu/storeu loop", copy_avx2, cpu_has_avx2},
+    {"avx512", "64-byte loop, masked tail", copy_avx512, cpu_has_avx512},
+    {"nt_sse2", "movntdq streaming stores + sfence", copy_nt_sse2, NULL},
+    {"nt_avx2", "vmovntdq ymm streaming stores + sfence", copy_nt_avx2,
+     cpu_has_avx2},
+    {"nt_avx512", "vmovntdq zmm streaming stores + sfence", copy_nt_avx512,
+     cpu_has_avx512},
+};
+
+static void
+print_cpu_features(void)
+{
+    printf("CPU features:%s%s%s%s\n", cpu_has_erms() ? " erms" : "",
+           cpu_has_fsrm() ? " fsrm" : "", cpu_has_avx2() ? " avx2" : "",
+           cpu_has_avx512() ? " avx512f+bw" : "");
+}
+
+#elif defined(__aarch64__)
+
+static int
+cpu_has_sve(void)
+{
+#ifdef HWCAP_SVE
+    return (getauxval(AT_HWCAP) & HWCAP_SVE) != 0;
+#else
+    return 0;
+#endif
+}
+
+/* NEON is part of the base aarch64 ISA. */
+static void *
+copy_neon(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    if (n < 16) {
+        copy_small((char *)d, (const char *)s, n);
+        return dst;
+    }
+    uint8x16_t tail = vld1q_u8(s + n - 16);
+    uint8_t *end = d + n - 16;
+    for (; end - d >= 64; d += 64, s += 64) {
+        uint8x16_t v0 = vld1q_u8(s);
+        uint8x16_t v1 = vld1q_u8(s + 16);
+        uint8x16_t v2 = vld1q_u8(s + 32);
+        uint8x16_t v3 = vld1q_u8(s + 48);
+        vst1q_u8(d, v0);
+        vst1q_u8(d + 16, v1);
+        vst1q_u8(d + 32, v2);
+        vst1q_u8(d + 48, v3);
+    }
+    for (; d < end; d += 16, s += 16)
+        vst1q_u8(d, vld1q_u8(s));
+    vst1q_u8(end, tail);
+    return dst;
+}
+
+#ifdef __ARM_FEATURE_SVE
+/* Vector length agnostic: the last iteration is predicated off at n. */
+static void *
+copy_sve(void *dst, const void *src, size_t n)
+{
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    for (uint64_t i = 0; i < n; i += svcntb()) {
+        svbool_t pg = svwhilelt_b8_u64(i, n);
+        svst1_u8(pg, d + i, svld1_u8(pg, s + i));
+    }
+    return dst;
+}
+#endif
+
+static const struct copy_kernel kernels[] = {
+    {"memcpy", "libc memcpy", copy_libc, NULL},
+    {"neon", "16-byte ld1/st1 loop", copy_neon, NULL},
+#ifdef __ARM_FEATURE_SVE
+    {"sve", "predicated whilelt ld1b/st1b loop", copy_sve, cpu_has_sve},
+#endif
+};
+
+static void
+print_cpu_features(void)
+{
+    printf("CPU features:%s\n", cpu_has_sve() ? " sve" : "");
+}
+
+#else
+
+static const struct copy_kernel kernels[] = {
+    {"memcpy", "libc memcpy", copy_libc, NULL},
+};
+
+static void
+print_cpu_features(void)
+{
+    printf("CPU features: (no dispatch on this architecture)\n");
+}
+
+#endif
+
+void
+list_kernels(void)
+{
+    print_cpu_features();
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i)
+        printf("  %-10s %s%s\n", kernels[i].name, kernels[i].desc,
+               kernel_supported(&kernels[i]) ? "" : " (not supported)");
+}
+
+const struct copy_kernel *
+copy_kernels(size_t *count)
+{
+    *count = sizeof(kernels) / sizeof(kernels[0]);
+    return kernels;
+}
+
+const struct copy_kernel *
+find_kernel(const char *name)
+{
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i)
+        if (strcmp(kernels[i].name, name) == 0)
+            return &kernels[i];
+    return NULL;
+}
+
+int
+kernel_supported(const struct copy_kernel *k)
+{
+    return k->supported == NULL || k->supported();
+}
+
+const struct copy_kernel **
+parse_kernel_list(const char *s, size_t *count)
+{
+    size_t nall;
+    const struct copy_kernel *all = copy_kernels(&nall);
+    const struct copy_kernel **list = malloc(nall * sizeof(*list));
+    if (list == NULL)
+        die("malloc");
+    size_t n = 0;
+
+    if (strcmp(s, "all") == 0) {
+        for (size_t i = 0; i < nall; ++i)
+            if (kernel_supported(&all[i]))
+                list[n++] = &all[i];
+        *count = n;
+        return list;
+    }
+
+    char *names = strdup(s);
+    if (names == NULL)
+        die("strdup");
+    for (char *name = strtok(names, ","); name; name = strtok(NULL, ",")) {
+        const struct copy_kernel *k = find_kernel(name);
+        if (k == NULL) {
+            fprintf(stderr, "Unknown copy kernel: %s (see --list-impls)\n",
+                    name);
+            exit(EXIT_FAILURE);
+        }
+        if (!kernel_supported(k)) {
+            fprintf(stderr, "Copy kernel %s is not supported by this CPU\n",
+                    name);
+            exit(EXIT_FAILURE);
+        }
+        int dup = 0;
+        for (size_t i = 0; i < n; ++i)
+            dup |= list[i] == k;
+        if (!dup)
+            list[n++] = k;
+    }
+    free(names);
+    *count = n;
+    return list;
+}
+
+int
+verify_kernel(const struct copy_kernel *k)
+{
+    static const size_t large[] = {1000, 4095, 4096, 4097, 65536 + 13,
+                                   (1 << 20) + 3};
+    static const int src_offs[] = {0, 1, 7, 31, 63};
+    static const int dst_offs[] = {0, 5, 32, 63};
+    const size_t guard = 64, max = (1 << 20) + 3;
+    size_t len = max + 2 * guard + 64;
+
+    unsigned char *src = malloc(len), *dst = malloc(len), *want = malloc(len);
+    if (src == NULL || dst == NULL || want == NULL)
+        die("malloc");
+    for (size_t i = 0; i < len; ++i)
+        src[i] = (unsigned char)(i * 131 + 7);
+
+    int ok = 1;
+    size_t nlarge = sizeof(large) / sizeof(large[0]);
+    for (size_t t = 0; ok && t < 521 + nlarge; ++t) {
+        size_t n = t < 521 ? t : large[t - 521];
+        for (size_t i = 0; ok && i < sizeof(src_offs) / sizeof(int); ++i) {
+            for (size_t j = 0; ok && j < sizeof(dst_offs) / sizeof(int); ++j) {
+                const unsigned char *s = src + guard + src_offs[i];
+                unsigned char *d = dst + guard + dst_offs[j];
+                size_t span = guard + dst_offs[j] + n + guard;
+                memset(dst, 0xEE, span);
+                memset(want, 0xEE, span);
+                memcpy(want + guard + dst_offs[j], s, n);
+                void *ret = k->copy(d, s, n);
+                if (ret != d || memcmp(dst, want, span) != 0) {
+                    fprintf(stderr, "Copy kernel %s is wrong for size %zu, "
+                            "src offset %d, dst offset %d\n", k->name, n,
+                            src_offs[i], dst_offs[j]);
+                    ok = 0;
+                }
+            }
+        }
+    }
+
+    free(src);
+    free(dst);
+    free(want);
+    return ok;
+}
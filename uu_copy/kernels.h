@@ -0,0 +1,39 @@
+// kernels.h - registry of copy implementations
+#ifndef UU_COPY_KERNELS_H
+#define UU_COPY_KERNELS_H
+
+#include <stddef.h>
+
+typedef void *(*copy_fn)(void *dst, const void *src, size_t n);
+
+struct copy_kernel {
+    const char *name;
+    const char *desc;
+    copy_fn copy;
+    int (*supported)(void); /* NULL if every CPU of the arch can run it */
+};
+
+/* Every kernel compiled for this architecture, libc memcpy first. */
+const struct copy_kernel *copy_kernels(size_t *count);
+
+const struct copy_kernel *find_kernel(const char *name);
+
+int kernel_supported(const struct copy_kernel *k);
+
+/*
+ * Parse a comma separated list of kernel names, or "all" for every kernel
+ * this CPU supports. Exits on unknown or unsupported names.
+ */
+const struct copy_kernel **parse_kernel_list(const char *s, size_t *count);
+
+/*
+ * Check k against libc memcpy over small and large sizes and misaligned
+ * ends, including that no byte outside the destination is written. Prints
+ * the first mismatch and returns 0 on failure.
+ */
+int verify_kernel(const struct copy_kernel *k);
+
+/* Print the kernels with their CPU support, and the CPU features used. */
+void list_kernels(void);
+
+#endif
@@ -0,0 +1,108 @@
+// latency.c - per-copy latency distribution
+#define _GNU_SOURCE
+#include "latency.h"
+#include "common.h"
+#include "timer.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int
+by_value(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest rank: the smallest sample with at least p of them at or below. */
+static uint64_t
+percentile(const uint64_t *sorted, uint64_t n, double p)
+{
+    uint64_t rank = (uint64_t)(p * n + 0.999999);
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void
+write_samples(const struct latency_config *cfg, const uint64_t *samples)
+{
+    static int header_done;
+    FILE *f = fopen(cfg->samples_path, header_done ? "a" : "w");
+    if (f == NULL)
+        die(cfg->samples_path);
+    if (!header_done)
+        fprintf(f, "kernel,size,iter,ticks,ns\n");
+    header_done = 1;
+    for (uint64_t i = 0; i < cfg->iters; ++i)
+        fprintf(f, "%s,%zu,%" PRIu64 ",%" PRIu64 ",%.1f\n", cfg->kernel->name,
+                cfg->size, i, samples[i], ticks_to_ns(samples[i]));
+    if (fclose(f) != 0)
+        die(cfg->samples_path);
+}
+
+static void
+print_stat(const char *name, double ticks)
+{
+    printf("  %-8s %12.0f %12.1f\n", name, ticks, ticks / timer_ticks_per_ns());
+}
+
+void
+run_latency(const struct latency_config *cfg)
+{
+    size_t size = cfg->size;
+    uint64_t n = cfg->iters;
+    void *src = NULL, *dst = NULL;
+    if (posix_memalign(&src, 64, size) != 0)
+        die("posix_memalign(src)");
+    if (posix_memalign(&dst, 64, size) != 0)
+        die("posix_memalign(dst)");
+    uint64_t *samples = malloc(n * sizeof(*samples));
+    if (samples == NULL)
+        die("malloc");
+    /* Fault the samples in too, so the loop below stores to mapped pages. */
+    memset(samples, 0, n * sizeof(*samples));
+    memset(src, 0xA5, size);
+    memset(dst, 0x00, size);
+    for (int i = 0; i < 10; ++i)
+        cfg->kernel->copy(dst, src, size);
+
+    uint64_t overhead = timer_overhead();
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t t0 = timer_begin();
+        void *p = cfg->kernel->copy(dst, src, size);
+        DoNotOptimize(p);
+        ClobberMemory();
+        uint64_t t = timer_end() - t0;
+        samples[i] = t > overhead ? t - overhead : 0;
+    }
+
+    if (cfg->samples_path != NULL)
+        write_samples(cfg, samples);
+
+    double sum = 0.0;
+    for (uint64_t i = 0; i < n; ++i)
+        sum += samples[i];
+    qsort(samples, n, sizeof(*samples), by_value);
+    uint64_t median = percentile(samples, n, 0.5), slow = 0;
+    for (uint64_t i = 0; i < n; ++i)
+        slow += samples[i] > 2 * median;
+
+    printf("%s latency:\n", cfg->kernel->name);
+    printf("  size       = %zu bytes\n", size);
+    printf("  iterations = %" PRIu64 "\n", n);
+    printf("  timer      = %s, %.3f ticks/ns, overhead %" PRIu64
+           " ticks subtracted\n", timer_name, timer_ticks_per_ns(), overhead);
+    printf("\n  %-8s %12s %12s\n", "", "ticks", "ns");
+    print_stat("min", samples[0]);
+    print_stat("median", median);
+    print_stat("mean", sum / n);
+    print_stat("p99", percentile(samples, n, 0.99));
+    print_stat("max", samples[n - 1]);
+    printf("\n  %" PRIu64 " copies (%.2f%%) over twice the median\n", slow,
+           100.0 * slow / n);
+
+    free(samples);
+    free(src);
+    free(dst);
+}
@@ -0,0 +1,24 @@
+// latency.h - per-copy latency distribution
+#ifndef UU_COPY_LATENCY_H
+#define UU_COPY_LATENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kernels.h"
+
+struct latency_config {
+    const struct copy_kernel *kernel;
+    size_t size;
+    uint64_t iters;
+    const char *samples_path; /* raw ticks of every copy, NULL for none */
+};
+
+/*
+ * Copy the same src/dst pair iters times, timing every copy alone with the
+ * serialized cycle counter less its overhead, and print min, median, mean,
+ * p99 and max. Several kernels append to one samples file.
+ */
+void run_latency(const struct latency_config *cfg);
+
+#endif
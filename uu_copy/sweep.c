@@ -0,0 +1,603 @@
+// sweep.c - size x misalignment x overlap x kernel sweep
+#define _GNU_SOURCE
+#include "sweep.h"
+#include "common.h"
+#include "timer.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+size_t *
+parse_size_sweep(const char *s, size_t *count)
+{
+    char *spec = strdup(s);
+    if (spec == NULL)
+        die("strdup");
+
+    double factor = 2.0;
+    char *max_str = strchr(spec, ':');
+    if (max_str == NULL)
+        goto invalid;
+    *max_str++ = '\0';
+    char *step = strchr(max_str, ':');
+    if (step != NULL) {
+        *step++ = '\0';
+        char *end;
+        if (*step != 'x')
+            goto invalid;
+        factor = strtod(step + 1, &end);
+        if (end == step + 1 || *end != '\0' || factor <= 1.0)
+            goto invalid;
+    }
+
+    size_t min = parse_size(spec);
+    size_t max = parse_size(max_str);
+    if (min == 0 || max < min)
+        goto invalid;
+
+    size_t cap = 64, n = 0;
+    size_t *sizes = malloc(cap * sizeof(*sizes));
+    if (sizes == NULL)
+        die("malloc");
+    for (double v = (double)min; v <= (double)max * 1.000001; v *= factor) {
+        size_t size = (size_t)(v + 0.5);
+        if (n > 0 && sizes[n - 1] == size)
+            continue;
+        if (n == cap) {
+            cap *= 2;
+            sizes = realloc(sizes, cap * sizeof(*sizes));
+            if (sizes == NULL)
+                die("realloc");
+        }
+        sizes[n++] = size;
+    }
+
+    free(spec);
+    *count = n;
+    return sizes;
+
+invalid:
+    fprintf(stderr, "Invalid size sweep \"%s\" (MIN:MAX[:xF], e.g. 1:1G:x2)\n",
+            s);
+    exit(EXIT_FAILURE);
+}
+
+int64_t *
+parse_overlap_list(const char *s, size_t *count)
+{
+    size_t n = 1;
+    for (const char *p = s; *p; ++p)
+        n += *p == ',';
+    int64_t *vals = malloc(n * sizeof(*vals));
+    if (vals == NULL)
+        die("malloc");
+
+    const char *p = s;
+    for (size_t i = 0; i < n; ++i) {
+        char *end;
+        if (strncmp(p, "none", 4) == 0) {
+            vals[i] = OVERLAP_NONE;
+            end = (char *)p + 4;
+        } else {
+            errno = 0;
+            vals[i] = strtoll(p, &end, 10);
+            if (errno != 0 || end == p || vals[i] == 0) {
+                fprintf(stderr, "Invalid overlap \"%s\" (none or a non-zero "
+                        "dst - src distance)\n", s);
+                exit(EXIT_FAILURE);
+            }
+        }
+        if (*end != (i + 1 < n ? ',' : '\0')) {
+            fprintf(stderr, "Invalid overlap list \"%s\"\n", s);
+            exit(EXIT_FAILURE);
+        }
+        p = end + 1;
+    }
+
+    *count = n;
+    return vals;
+}
+
+/*
+ * Where the copies of one cell go: pair i is dst/src + i * stride, visited
+ * in the order order[next], order[next + 1], ... wrapping around. next
+ * carries over between runs, so the growing runs keep moving through the
+ * working set instead of starting over on pairs the last run left hot.
+ */
+struct working_set {
+    char *dst;
+    const char *src;
+    size_t stride;
+    size_t npairs;
+    const uint32_t *order;
+    size_t next;
+    enum flush_mode flush;
+    const struct cache_info *caches;
+};
+
+static uint64_t
+time_copies(copy_fn copy, struct working_set *ws, size_t size,
+            uint64_t iters)
+{
+    if (ws->npairs == 1) {
+        uint64_t t0 = now_ns();
+        for (uint64_t i = 0; i < iters; ++i) {
+            void *p = copy(ws->dst, ws->src, size);
+            DoNotOptimize(p);
+            ClobberMemory();
+        }
+        return now_ns() - t0;
+    }
+
+    size_t next = ws->next;
+    uint64_t t0 = now_ns();
+    for (uint64_t i = 0; i < iters; ++i) {
+        size_t off = ws->order[next] * ws->stride;
+        void *p = copy(ws->dst + off, ws->src + off, size);
+        DoNotOptimize(p);
+        ClobberMemory();
+        if (++next == ws->npairs)
+            next = 0;
+    }
+    uint64_t t = now_ns() - t0;
+    ws->next = next;
+    return t;
+}
+
+static void
+set_rate(struct sweep_cell *cell, uint64_t iters, uint64_t t)
+{
+    if (t == 0)
+        t = 1;
+    cell->iters = iters;
+    cell->ns_per_copy = (double)t / iters;
+    cell->gib_per_sec = (double)cell->size * iters / (t / 1e9) /
+                        (1024.0 * 1024.0 * 1024.0);
+}
+
+/*
+ * Cold copies: flush before every copy and time each one alone with the
+ * cycle counter, less its overhead. Runs until the copies add up to the
+ * budget, or until the flushes have stretched the cell to ten budgets of
+ * wall time.
+ */
+static void
+measure_cell_flushed(copy_fn copy, struct working_set *ws, uint64_t budget_ns,
+                     struct sweep_cell *cell)
+{
+    uint64_t total = 0, iters = 0, start = now_ns();
+    uint64_t overhead = timer_overhead();
+    do {
+        size_t off = ws->order[ws->next] * ws->stride;
+        if (++ws->next == ws->npairs)
+            ws->next = 0;
+        char *dst = ws->dst + off;
+        const char *src = ws->src + off;
+        if (ws->flush == FLUSH_LINES) {
+            flush_lines(src, cell->size);
+            flush_lines(dst, cell->size);
+        } else {
+            evict_caches(ws->caches);
+        }
+
+        uint64_t t0 = timer_begin();
+        void *p = copy(dst, src, cell->size);
+        DoNotOptimize(p);
+        ClobberMemory();
+        uint64_t t = timer_end() - t0;
+        total += t > overhead ? t - overhead : 0;
+        ++iters;
+    } while (ticks_to_ns(total) < budget_ns &&
+             now_ns() - start < 10 * budget_ns);
+
+    set_rate(cell, iters, (uint64_t)ticks_to_ns(total));
+}
+
+/*
+ * Grow the iteration count until a run takes a tenth of the budget, then
+ * scale it up to fill the budget. The first single copy doubles as warmup;
+ * copies that take longer than the whole budget are reported from it.
+ */
+static void
+measure_cell(copy_fn copy, struct working_set *ws, uint64_t budget_ns,
+             struct sweep_cell *cell)
+{
+    if (ws->flush != FLUSH_NONE) {
+        measure_cell_flushed(copy, ws, budget_ns, cell);
+        return;
+    }
+
+    uint64_t iters = 1;
+    uint64_t t = time_copies(copy, ws, cell->size, iters);
+    while (t < budget_ns / 10) {
+        uint64_t grow = t > 0 ? budget_ns / 10 / t + 1 : 10;
+        if (grow < 2)
+            grow = 2;
+        if (grow > 10)
+            grow = 10;
+        iters *= grow;
+        t = time_copies(copy, ws, cell->size, iters);
+    }
+    if (t < budget_ns) {
+        iters = (uint64_t)((double)iters * budget_ns / t);
+        t = time_copies(copy, ws, cell->size, iters);
+    }
+
+    set_rate(cell, iters, t);
+}
+
+/*
+ * Working-set pairs of one size: whole lines with room for the largest
+ * offset and overlap distance, plus a spare line so neighbouring pairs
+ * never share one.
+ */
+static size_t
+pair_stride(size_t size, size_t max_dist)
+{
+    return (size + max_dist + 63) / 64 * 64 + 64;
+}
+
+/*
+ * Identity, or a fixed-seed Fisher-Yates shuffle so every kernel of a size
+ * visits the pairs in the same order.
+ */
+static void
+fill_order(uint32_t *order, size_t n, enum ws_order how)
+{
+    for (size_t i = 0; i < n; ++i)
+        order[i] = (uint32_t)i;
+    if (how != WS_RANDOM)
+        return;
+    uint64_t x = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = n - 1; i > 0; --i) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        size_t j = x % (i + 1);
+        uint32_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+}
+
+/* Columns of one heat map row: src/dst pairs, or src alone with overlap. */
+static size_t
+columns_of(const struct sweep_config *cfg, int64_t overlap)
+{
+    return overlap == OVERLAP_NONE ? cfg->nsrc * cfg->ndst : cfg->nsrc;
+}
+
+/* Kernels run for one overlap value: the selection, or libc memmove. */
+static size_t
+kernels_of(const struct sweep_config *cfg, int64_t overlap)
+{
+    return overlap == OVERLAP_NONE ? cfg->nkernels : 1;
+}
+
+static void
+print_overlap(int64_t overlap, FILE *out)
+{
+    if (overlap == OVERLAP_NONE)
+        fprintf(out, "none");
+    else
+        fprintf(out, "%" PRId64, overlap);
+}
+
+static void
+print_csv(const struct sweep_cell *cells, size_t ncells)
+{
+    printf("kernel,size,src_offset,dst_offset,overlap,iters,ns_per_copy,"
+           "gib_per_s,footprint,cache_level\n");
+    for (size_t i = 0; i < ncells; ++i) {
+        const struct sweep_cell *c = &cells[i];
+        printf("%s,%zu,%d,%d,", c->kernel, c->size, c->src_offset,
+               c->dst_offset);
+        print_overlap(c->overlap, stdout);
+        printf(",%" PRIu64 ",%.3f,%.3f,%zu,%s\n", c->iters, c->ns_per_copy,
+               c->gib_per_sec, c->footprint, cache_level_name(c->cache_level));
+    }
+}
+
+/*
+ * One table per overlap value, kernel and metric: a row per size, a column
+ * per offset combination. Meant for a handful of offsets; use CSV for the
+ * full 64x64 grid. A rule goes above the first size whose footprint no
+ * longer fits the cache level of the row before.
+ */
+static void
+print_heatmap(const struct sweep_config *cfg, const struct sweep_cell *cells,
+              const struct cache_info *ci)
+{
+    static const char *metrics[] = {"GiB/s", "ns/copy"};
+    const struct sweep_cell *block = cells;
+
+    for (size_t o = 0; o < cfg->noverlaps; ++o) {
+        int64_t overlap = cfg->overlaps[o];
+        size_t ncols = columns_of(cfg, overlap);
+
+        for (size_t k = 0; k < kernels_of(cfg, overlap); ++k) {
+            for (int m = 0; m < 2; ++m) {
+                printf("\n%s, %s, overlap ", metrics[m], block->kernel);
+                print_overlap(overlap, stdout);
+                printf(", columns src/dst offset\n");
+                printf("%8s", "size");
+                for (size_t c = 0; c < ncols; ++c) {
+                    char label[32];
+                    snprintf(label, sizeof(label), "%d/%d",
+                             block[c].src_offset, block[c].dst_offset);
+                    printf(" %10s", label);
+                }
+                printf("\n");
+
+                for (size_t s = 0; s < cfg->nsizes; ++s) {
+                    char size[32];
+                    int level = block[s * ncols].cache_level;
+                    int prev = s > 0 ? block[(s - 1) * ncols].cache_level : 0;
+                    if (s > 0 && level > prev)
+                        printf("%8s  -- footprint > %s %s --\n", "",
+                               cache_level_name(prev),
+                               format_size(cache_level_size(ci, prev), size,
+                                           sizeof(size)));
+                    printf("%8s",
+                           format_size(cfg->sizes[s], size, sizeof(size)));
+                    for (size_t c = 0; c < ncols; ++c) {
+                        const struct sweep_cell *cell = &block[s * ncols + c];
+                        if (m == 0)
+                            printf(" %10.2f", cell->gib_per_sec);
+                        else
+                            printf(" %10.1f", cell->ns_per_copy);
+                    }
+                    printf("\n");
+                }
+            }
+            block += cfg->nsizes * ncols;
+        }
+    }
+}
+
+static const double *rank_scores;
+
+static int
+by_score_desc(const void *a, const void *b)
+{
+    double x = rank_scores[*(const size_t *)a];
+    double y = rank_scores[*(const size_t *)b];
+    return (x < y) - (x > y);
+}
+
+/*
+ * Ranks the kernels of the non-overlapping block at every size by their
+ * mean GiB/s over the offset columns, then lists the sizes where the
+ * fastest kernel changes and where each kernel overtakes or falls behind
+ * the baseline: libc memcpy if selected, the first kernel otherwise.
+ */
+static void
+print_ranking(const struct sweep_config *cfg, const struct sweep_cell *cells,
+              FILE *out)
+{
+    size_t nk = cfg->nkernels, ns = cfg->nsizes;
+    size_t ncols = columns_of(cfg, OVERLAP_NONE);
+    const struct sweep_cell *block = cells;
+    size_t o = 0;
+    for (; o < cfg->noverlaps && cfg->overlaps[o] != OVERLAP_NONE; ++o)
+        block += cfg->nsizes * columns_of(cfg, cfg->overlaps[o]);
+    if (nk < 2 || o == cfg->noverlaps)
+        return;
+
+    /* mean[k * ns + s]: kernel k at size s */
+    double *mean = calloc(nk * ns, sizeof(*mean));
+    size_t *order = malloc(nk * ns * sizeof(*order));
+    double *scores = malloc(nk * sizeof(*scores));
+    if (mean == NULL || order == NULL || scores == NULL)
+        die("malloc");
+    for (size_t k = 0; k < nk; ++k)
+        for (size_t s = 0; s < ns; ++s) {
+            const struct sweep_cell *row = &block[(k * ns + s) * ncols];
+            for (size_t c = 0; c < ncols; ++c)
+                mean[k * ns + s] += row[c].gib_per_sec / ncols;
+        }
+
+    char size[32];
+    fprintf(out, "\nRanking by mean GiB/s over offsets, overlap none\n");
+    for (size_t s = 0; s < ns; ++s) {
+        size_t *rank = &order[s * nk];
+        for (size_t k = 0; k < nk; ++k) {
+            rank[k] = k;
+            scores[k] = mean[k * ns + s];
+        }
+        rank_scores = scores;
+        qsort(rank, nk, sizeof(*rank), by_score_desc);
+        fprintf(out, "%8s", format_size(cfg->sizes[s], size, sizeof(size)));
+        for (size_t r = 0; r < nk; ++r)
+            fprintf(out, "  %zu. %s %.2f", r + 1, cfg->kernels[rank[r]]->name,
+                    scores[rank[r]]);
+        fprintf(out, "\n");
+    }
+
+    size_t base = 0;
+    for (size_t k = 0; k < nk; ++k)
+        if (strcmp(cfg->kernels[k]->name, "memcpy") == 0)
+            base = k;
+    const char *base_name = cfg->kernels[base]->name;
+
+    fprintf(out, "\nCrossovers\n");
+    fprintf(out, "%8s  fastest: %s\n",
+            format_size(cfg->sizes[0], size, sizeof(size)),
+            cfg->kernels[order[0]]->name);
+    for (size_t s = 1; s < ns; ++s)
+        if (order[s * nk] != order[(s - 1) * nk])
+            fprintf(out, "%8s  fastest: %s (was %s)\n",
+                    format_size(cfg->sizes[s], size, sizeof(size)),
+                    cfg->kernels[order[s * nk]]->name,
+                    cfg->kernels[order[(s - 1) * nk]]->name);
+    for (size_t k = 0; k < nk; ++k) {
+        if (k == base)
+            continue;
+        const char *name = cfg->kernels[k]->name;
+        int ahead = mean[k * ns] > mean[base * ns];
+        fprintf(out, "%8s  %s %s %s\n",
+                format_size(cfg->sizes[0], size, sizeof(size)), name,
+                ahead ? "ahead of" : "behind", base_name);
+        for (size_t s = 1; s < ns; ++s) {
+            int now = mean[k * ns + s] > mean[base * ns + s];
+            if (now != ahead)
+                fprintf(out, "%8s  %s %s %s\n",
+                        format_size(cfg->sizes[s], size, sizeof(size)), name,
+                        now ? "overtakes" : "falls behind", base_name);
+            ahead = now;
+        }
+    }
+
+    free(mean);
+    free(order);
+    free(scores);
+}
+
+void
+run_sweep(const struct sweep_config *cfg)
+{
+    size_t max_size = 0;
+    for (size_t s = 0; s < cfg->nsizes; ++s)
+        if (cfg->sizes[s] > max_size)
+            max_size = cfg->sizes[s];
+    size_t max_dist = 0, ncells = 0;
+    for (size_t o = 0; o < cfg->noverlaps; ++o) {
+        int64_t d = cfg->overlaps[o];
+        if (d != OVERLAP_NONE && (size_t)llabs(d) > max_dist)
+            max_dist = (size_t)llabs(d);
+        ncells += kernels_of(cfg, d) * cfg->nsizes * columns_of(cfg, d);
+    }
+
+    /*
+     * Offsets count from page aligned bases. Overlapping copies move within
+     * src_buf, which leaves room for the largest distance either way. A
+     * working set splits its bytes between the two buffers, one pair of
+     * stride bytes after another.
+     */
+    size_t src_len = max_size + 64 + max_dist;
+    size_t dst_len = max_size + 64;
+    if (cfg->working_set > 0) {
+        src_len = pair_stride(max_size, max_dist);
+        if (cfg->working_set / 2 > src_len)
+            src_len = cfg->working_set / 2;
+        dst_len = src_len;
+    }
+    void *src_buf = NULL, *dst_buf = NULL;
+    if (posix_memalign(&src_buf, 4096, src_len) != 0)
+        die("posix_memalign(src)");
+    if (posix_memalign(&dst_buf, 4096, dst_len) != 0)
+        die("posix_memalign(dst)");
+    memset(src_buf, 0xA5, src_len);
+    memset(dst_buf, 0x00, dst_len);
+
+    size_t max_pairs = 1;
+    if (cfg->working_set > 0) {
+        max_pairs = src_len / pair_stride(1, max_dist);
+        if (max_pairs > UINT32_MAX)
+            max_pairs = UINT32_MAX;
+    }
+    uint32_t *order = malloc(max_pairs * sizeof(*order));
+    struct sweep_cell *cells = calloc(ncells, sizeof(*cells));
+    if (order == NULL || cells == NULL)
+        die("malloc");
+
+    struct cache_info ci;
+    detect_caches(&ci);
+    if (cfg->flush != FLUSH_NONE)
+        timer_init();
+    char l1[32], l2[32], l3[32], ws_size[32];
+    fprintf(stderr, "Caches: L1d %s, L2 %s, L3 %s\n",
+            format_size(ci.l1d, l1, sizeof(l1)),
+            format_size(ci.l2, l2, sizeof(l2)),
+            format_size(ci.l3, l3, sizeof(l3)));
+    if (cfg->working_set > 0)
+        fprintf(stderr, "Working set %s, pairs visited %s\n",
+                format_size(cfg->working_set, ws_size, sizeof(ws_size)),
+                cfg->order == WS_RANDOM ? "randomly" : "round-robin");
+    if (cfg->flush == FLUSH_EVICT)
+        evict_caches(&ci); /* allocates the buffer outside the first cell */
+    if (cfg->flush != FLUSH_NONE)
+        fprintf(stderr, "Flushing with %s before every copy\n",
+                cfg->flush == FLUSH_LINES ? "clflush" : "an eviction buffer");
+    fprintf(stderr, "Sweeping %zu cells, %.1f ms each\n", ncells,
+            cfg->budget_ns / 1e6);
+
+    struct sweep_cell *cell = cells;
+    for (size_t o = 0; o < cfg->noverlaps; ++o) {
+        int64_t d = cfg->overlaps[o];
+        size_t dist = d == OVERLAP_NONE ? SIZE_MAX : (size_t)llabs(d);
+        for (size_t k = 0; k < kernels_of(cfg, d); ++k) {
+            for (size_t s = 0; s < cfg->nsizes; ++s) {
+                size_t size = cfg->sizes[s];
+                struct working_set ws = {
+                    .stride = pair_stride(size, max_dist),
+                    .npairs = 1,
+                    .order = order,
+                    .flush = cfg->flush,
+                    .caches = &ci,
+                };
+                if (cfg->working_set > 0) {
+                    ws.npairs = src_len / ws.stride;
+                    if (ws.npairs > max_pairs)
+                        ws.npairs = max_pairs;
+                }
+                fill_order(order, ws.npairs, cfg->order);
+                /* src and dst bytes of one pair, shared ones counted once */
+                size_t footprint = ws.npairs * (size + (dist < size ? dist
+                                                                    : size));
+
+                for (size_t i = 0; i < cfg->nsrc; ++i) {
+                    int src_off = cfg->src_offsets[i];
+                    if (d != OVERLAP_NONE) {
+                        char *src =
+                            (char *)src_buf + src_off + (d < 0 ? -d : 0);
+                        ws.src = src;
+                        ws.dst = src + d;
+                        ws.next = 0;
+                        cell->kernel = "memmove";
+                        cell->size = size;
+                        cell->src_offset = src_off;
+                        cell->dst_offset = (int)((uintptr_t)ws.dst & 63);
+                        cell->overlap = d;
+                        cell->footprint = footprint;
+                        cell->cache_level = cache_level_of(&ci, footprint);
+                        measure_cell(memmove, &ws, cfg->budget_ns, cell);
+                        ++cell;
+                        continue;
+                    }
+                    for (size_t j = 0; j < cfg->ndst; ++j, ++cell) {
+                        cell->kernel = cfg->kernels[k]->name;
+                        cell->size = size;
+                        cell->src_offset = src_off;
+                        cell->dst_offset = cfg->dst_offsets[j];
+                        cell->overlap = d;
+                        cell->footprint = footprint;
+                        cell->cache_level = cache_level_of(&ci, footprint);
+                        ws.src = (char *)src_buf + src_off;
+                        ws.dst = (char *)dst_buf + cell->dst_offset;
+                        ws.next = 0;
+                        measure_cell(cfg->kernels[k]->copy, &ws,
+                                     cfg->budget_ns, cell);
+                    }
+                }
+            }
+        }
+    }
+
+    /* CSV stays one table; the ranking goes to stderr next to it. */
+    if (cfg->format == SWEEP_CSV) {
+        print_csv(cells, ncells);
+        print_ranking(cfg, cells, stderr);
+    } else {
+        print_heatmap(cfg, cells, &ci);
+        print_ranking(cfg, cells, stdout);
+    }
+
+    free(order);
+    free(cells);
+    free(src_buf);
+    free(dst_buf);
+}
@@ -0,0 +1,72 @@
+// sweep.h - size x misalignment x overlap x kernel sweep
+#ifndef UU_COPY_SWEEP_H
+#define UU_COPY_SWEEP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cache.h"
+#include "kernels.h"
+
+/* Overlap value meaning "separate buffers, copied by the kernels". */
+#define OVERLAP_NONE INT64_MIN
+
+/* Order in which the copies of a cell visit the working-set pairs. */
+enum ws_order {
+    WS_ROUND_ROBIN,
+    WS_RANDOM,     /* a fixed-seed shuffle, visited once before repeating */
+};
+
+enum sweep_format {
+    SWEEP_HEATMAP, /* one size x offset table per overlap value and metric */
+    SWEEP_CSV,     /* one row per cell */
+};
+
+struct sweep_config {
+    const struct copy_kernel **kernels; /* libc memmove for overlaps */
+    size_t nkernels;
+    size_t *sizes;
+    size_t nsizes;
+    int *src_offsets;      /* bytes past a 64-byte boundary */
+    size_t nsrc;
+    int *dst_offsets;      /* ignored for overlapping copies */
+    size_t ndst;
+    int64_t *overlaps;     /* dst - src for memmove, or OVERLAP_NONE */
+    size_t noverlaps;
+    uint64_t budget_ns;    /* timed run length of every cell */
+    enum sweep_format format;
+    size_t working_set;    /* 0: one src/dst pair, else bytes of pairs */
+    enum ws_order order;
+    enum flush_mode flush; /* before every copy, which is timed alone */
+};
+
+/* One measured combination. */
+struct sweep_cell {
+    const char *kernel;
+    size_t size;
+    int src_offset;
+    int dst_offset;
+    int64_t overlap;
+    uint64_t iters;
+    double ns_per_copy;
+    double gib_per_sec;
+    size_t footprint;      /* bytes the copies touch over all pairs */
+    int cache_level;       /* smallest level the footprint fits in */
+};
+
+/*
+ * Parse "MIN:MAX[:xF]" into sizes MIN, MIN*F, ... up to MAX (F defaults to
+ * 2), rounded to whole bytes and deduplicated.
+ */
+size_t *parse_size_sweep(const char *s, size_t *count);
+
+/* Parse "none,-64,64" style overlap lists. */
+int64_t *parse_overlap_list(const char *s, size_t *count);
+
+/*
+ * Measure every cell of cfg and print the results to stdout. With more than
+ * one kernel, also rank them per size and list where the ranking changes.
+ */
+void run_sweep(const struct sweep_config *cfg);
+
+#endif
@@ -0,0 +1,285 @@
+// threads.c - multi-threaded copy bandwidth
+#define _GNU_SOURCE
+#include "threads.h"
+#include "common.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+struct worker {
+    const struct threads_config *cfg;
+    pthread_barrier_t *start;
+    atomic_int *stop;
+    int cpu;
+    int node;        /* of the CPU, after pinning */
+    int buf_node;    /* the buffers were bound to, -1 for first touch */
+    uint64_t copies;
+    uint64_t elapsed_ns;
+    pthread_t tid;
+};
+
+int *
+allowed_cpus(size_t *count)
+{
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        die("sched_getaffinity");
+    int *cpus = malloc(CPU_SETSIZE * sizeof(*cpus));
+    if (cpus == NULL)
+        die("malloc");
+    size_t n = 0;
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+        if (CPU_ISSET(c, &set))
+            cpus[n++] = c;
+    *count = n;
+    return cpus;
+}
+
+static int
+current_node(void)
+{
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+        return 0;
+    return (int)node;
+}
+
+/* The next node with memory after node, node itself if there is none. */
+static int
+remote_node(int node)
+{
+    char list[256] = "";
+    FILE *f = fopen("/sys/devices/system/node/has_memory", "r");
+    if (f != NULL) {
+        if (fgets(list, sizeof(list), f) == NULL)
+            list[0] = '\0';
+        fclose(f);
+    }
+    list[strcspn(list, "\n")] = '\0';
+    if (list[0] == '\0')
+        return node;
+
+    size_t n;
+    int *nodes = parse_int_list(list, 4095, &n);
+    int remote = node;
+    for (size_t i = 0; i < n; ++i) {
+        if (nodes[i] != node)
+            continue;
+        for (size_t j = 1; j < n && remote == node; ++j)
+            remote = nodes[(i + j) % n];
+    }
+    free(nodes);
+    return remote;
+}
+
+static void
+bind_to_node(void *addr, size_t len, int node)
+{
+    unsigned long mask[64] = {0};
+    const int bits = sizeof(unsigned long) * 8;
+    mask[node / bits] = 1UL << (node % bits);
+    /* The kernel drops the last bit of maxnode, hence the + 1. */
+    if (syscall(SYS_mbind, addr, len, MPOL_BIND, mask, 64 * bits + 1,
+                MPOL_MF_STRICT | MPOL_MF_MOVE) != 0)
+        perror("mbind");
+}
+
+static void *
+map_buffer(size_t len, int node)
+{
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        die("mmap");
+    if (node >= 0)
+        bind_to_node(p, len, node);
+    return p;
+}
+
+static void *
+worker_main(void *arg)
+{
+    struct worker *w = arg;
+    const struct threads_config *cfg = w->cfg;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(w->cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0)
+        fprintf(stderr, "Cannot pin to CPU %d: %s\n", w->cpu, strerror(err));
+    w->node = current_node();
+
+    w->buf_node = -1;
+    if (cfg->numa == NUMA_LOCAL)
+        w->buf_node = w->node;
+    else if (cfg->numa == NUMA_REMOTE)
+        w->buf_node = remote_node(w->node);
+
+    /* Touched after pinning, so first touch also lands on the local node. */
+    char *src = map_buffer(cfg->size, w->buf_node);
+    char *dst = map_buffer(cfg->size, w->buf_node);
+    memset(src, 0xA5, cfg->size);
+    memset(dst, 0x00, cfg->size);
+    cfg->kernel->copy(dst, src, cfg->size);
+
+    pthread_barrier_wait(w->start);
+    uint64_t t0 = now_ns(), copies = 0;
+    do {
+        void *p = cfg->kernel->copy(dst, src, cfg->size);
+        DoNotOptimize(p);
+        ClobberMemory();
+        ++copies;
+    } while (!atomic_load_explicit(w->stop, memory_order_relaxed));
+    w->elapsed_ns = now_ns() - t0;
+    w->copies = copies;
+
+    munmap(src, cfg->size);
+    munmap(dst, cfg->size);
+    return NULL;
+}
+
+static double
+worker_gib_per_sec(const struct worker *w, size_t size)
+{
+    if (w->elapsed_ns == 0)
+        return 0.0;
+    return (double)size * w->copies / (w->elapsed_ns / 1e9) /
+           (1024.0 * 1024.0 * 1024.0);
+}
+
+/* Runs n threads for one window and returns their aggregate GiB/s. */
+static double
+run_step(const struct threads_config *cfg, int n, struct worker *workers)
+{
+    pthread_barrier_t start;
+    atomic_int stop = 0;
+    if (pthread_barrier_init(&start, NULL, n + 1) != 0)
+        die("pthread_barrier_init");
+
+    for (int i = 0; i < n; ++i) {
+        workers[i] = (struct worker){
+            .cfg = cfg,
+            .start = &start,
+            .stop = &stop,
+            .cpu = cfg->cpus[i % cfg->ncpus],
+        };
+        int err = pthread_create(&workers[i].tid, NULL, worker_main,
+                                 &workers[i]);
+        if (err != 0) {
+            errno = err;
+            die("pthread_create");
+        }
+    }
+
+    pthread_barrier_wait(&start);
+    struct timespec window = {
+        .tv_sec = cfg->duration_ns / 1000000000ULL,
+        .tv_nsec = cfg->duration_ns % 1000000000ULL,
+    };
+    while (nanosleep(&window, &window) != 0 && errno == EINTR)
+        ;
+    atomic_store(&stop, 1);
+
+    double aggregate = 0.0;
+    for (int i = 0; i < n; ++i) {
+        pthread_join(workers[i].tid, NULL);
+        aggregate += worker_gib_per_sec(&workers[i], cfg->size);
+    }
+    pthread_barrier_destroy(&start);
+    return aggregate;
+}
+
+static const char *
+numa_name(enum numa_placement numa)
+{
+    switch (numa) {
+    case NUMA_LOCAL:
+        return "local";
+    case NUMA_REMOTE:
+        return "remote";
+    default:
+        return "first-touch";
+    }
+}
+
+void
+run_threads(const struct threads_config *cfg)
+{
+    struct worker *workers = calloc(cfg->threads, sizeof(*workers));
+    if (workers == NULL)
+        die("calloc");
+
+    /* Several kernels append to one CSV table. */
+    static int csv_header_done;
+    if (cfg->csv) {
+        if (!csv_header_done)
+            printf("kernel,threads,thread,cpu,node,buffer_node,copies,"
+                   "gib_per_s,aggregate_gib_per_s\n");
+        csv_header_done = 1;
+    } else {
+        printf("%s copy threads: size = %zu bytes, window = %.0f ms, "
+               "numa = %s\n", cfg->kernel->name, cfg->size,
+               cfg->duration_ns / 1e6, numa_name(cfg->numa));
+        printf("\n%8s %12s %12s %12s %12s %8s\n", "threads", "aggregate",
+               "min", "mean", "max", "scaling");
+    }
+
+    double single = 0.0;
+    for (int n = cfg->sweep ? 1 : cfg->threads; n <= cfg->threads; ++n) {
+        double aggregate = run_step(cfg, n, workers);
+        if (n == 1)
+            single = aggregate;
+
+        if (cfg->csv) {
+            for (int i = 0; i < n; ++i) {
+                const struct worker *w = &workers[i];
+                printf("%s,%d,%d,%d,%d,%d,%" PRIu64 ",%.3f,%.3f\n",
+                       cfg->kernel->name, n, i, w->cpu, w->node, w->buf_node,
+                       w->copies, worker_gib_per_sec(w, cfg->size), aggregate);
+            }
+            continue;
+        }
+
+        double min = 0.0, max = 0.0;
+        for (int i = 0; i < n; ++i) {
+            double g = worker_gib_per_sec(&workers[i], cfg->size);
+            if (i == 0 || g < min)
+                min = g;
+            if (g > max)
+                max = g;
+        }
+        printf("%8d %12.2f %12.2f %12.2f %12.2f", n, aggregate, min,
+               aggregate / n, max);
+        /* Aggregate over n times the single thread rate, when measured. */
+        if (single > 0.0)
+            printf(" %7.0f%%", 100.0 * aggregate / (n * single));
+        printf("\n");
+    }
+
+    if (cfg->numa == NUMA_REMOTE && workers[0].buf_node == workers[0].node)
+        fprintf(stderr, "No remote NUMA node with memory, buffers were "
+                "bound to the local node\n");
+    if (!cfg->csv) {
+        printf("\nPer thread, %d threads\n", cfg->threads);
+        printf("%8s %6s %6s %9s %12s\n", "thread", "cpu", "node", "buf_node",
+               "GiB/s");
+        for (int i = 0; i < cfg->threads; ++i) {
+            const struct worker *w = &workers[i];
+            printf("%8d %6d %6d %9d %12.2f\n", i, w->cpu, w->node,
+                   w->buf_node, worker_gib_per_sec(w, cfg->size));
+        }
+    }
+    free(workers);
+}
@@ -0,0 +1,39 @@
+// threads.h - multi-threaded copy bandwidth
+#ifndef UU_COPY_THREADS_H
+#define UU_COPY_THREADS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kernels.h"
+
+/* Where every thread's buffers live relative to the CPU it runs on. */
+enum numa_placement {
+    NUMA_FIRST_TOUCH, /* no binding, the pinned thread touches them first */
+    NUMA_LOCAL,       /* mbind to the node of the thread's CPU */
+    NUMA_REMOTE,      /* mbind to the next node with memory */
+};
+
+struct threads_config {
+    const struct copy_kernel *kernel;
+    size_t size;           /* bytes per copy, each thread has its own pair */
+    int threads;           /* threads of the run, or the last sweep step */
+    int sweep;             /* run every count from 1 to threads */
+    int *cpus;             /* thread i runs on cpus[i % ncpus] */
+    size_t ncpus;
+    enum numa_placement numa;
+    uint64_t duration_ns;  /* copy window of every step */
+    int csv;               /* one row per thread and step */
+};
+
+/* CPUs this process may run on, in ascending order. */
+int *allowed_cpus(size_t *count);
+
+/*
+ * Run cfg->threads copy threads (or every count up to it) that start
+ * together on a barrier and copy for the same window, and print per-thread
+ * and aggregate GiB/s.
+ */
+void run_threads(const struct threads_config *cfg);
+
+#endif
@@ -0,0 +1,50 @@
+// timer.c - serialized cycle counter for timing single copies
+#include "timer.h"
+
+#if defined(__x86_64__)
+const char *timer_name = "TSC";
+#elif defined(__aarch64__)
+const char *timer_name = "cntvct";
+#else
+const char *timer_name = "ns";
+#endif
+
+static double ticks_per_ns = 1.0;
+static uint64_t overhead;
+
+void
+timer_init(void)
+{
+#if defined(__aarch64__)
+    uint64_t freq;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    ticks_per_ns = freq / 1e9;
+#elif defined(__x86_64__)
+    /* The TSC rate is fixed, a 50 ms spin pins it to a few ppm. */
+    uint64_t t0 = now_ns(), c0 = timer_begin();
+    while (now_ns() - t0 < 50000000ULL)
+        ;
+    uint64_t c1 = timer_end(), t1 = now_ns();
+    ticks_per_ns = (double)(c1 - c0) / (t1 - t0);
+#endif
+
+    overhead = UINT64_MAX;
+    for (int i = 0; i < 10000; ++i) {
+        uint64_t c = timer_begin();
+        uint64_t t = timer_end() - c;
+        if (t < overhead)
+            overhead = t;
+    }
+}
+
+double
+timer_ticks_per_ns(void)
+{
+    return ticks_per_ns;
+}
+
+uint64_t
+timer_overhead(void)
+{
+    return overhead;
+}
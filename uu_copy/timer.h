@@ -0,0 +1,94 @@
+// timer.h - serialized cycle counter for timing single copies
+#ifndef UU_COPY_TIMER_H
+#define UU_COPY_TIMER_H
+
+#include <stdint.h>
+
+#include "common.h"
+
+/*
+ * Ticks of the constant-rate counter: the TSC on x86-64 (reference cycles,
+ * not core cycles), the generic timer cntvct_el0 on aarch64, and
+ * CLOCK_MONOTONIC nanoseconds elsewhere.
+ *
+ * timer_begin() waits for earlier instructions before reading the counter
+ * and timer_end() for the timed ones, so only the code in between is
+ * counted. Stores may still drain after timer_end(), like for any caller
+ * that returns from a copy.
+ */
+#if defined(__x86_64__)
+
+static inline uint64_t
+timer_begin(void)
+{
+    uint32_t lo, hi;
+    asm volatile("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t
+timer_end(void)
+{
+    uint32_t lo, hi, aux;
+    asm volatile("rdtscp\n\tlfence" : "=a"(lo), "=d"(hi), "=c"(aux)
+                 : : "memory");
+    return ((uint64_t)hi << 32) | lo;
+}
+
+#elif defined(__aarch64__)
+
+static inline uint64_t
+timer_begin(void)
+{
+    uint64_t t;
+    asm volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(t) : : "memory");
+    return t;
+}
+
+static inline uint64_t
+timer_end(void)
+{
+    uint64_t t;
+    asm volatile("isb\n\tmrs %0, cntvct_el0\n\tisb" : "=r"(t) : : "memory");
+    return t;
+}
+
+#else
+
+static inline uint64_t
+timer_begin(void)
+{
+    return now_ns();
+}
+
+static inline uint64_t
+timer_end(void)
+{
+    return now_ns();
+}
+
+#endif
+
+/* "TSC", "cntvct" or "ns", for output headers. */
+extern const char *timer_name;
+
+/*
+ * Measure the tick rate against CLOCK_MONOTONIC (read cntfrq_el0 on
+ * aarch64) and the cost of an empty timer_begin()/timer_end() pair. Call
+ * once before the accessors below.
+ */
+void timer_init(void);
+
+/* Ticks per nanosecond. */
+double timer_ticks_per_ns(void);
+
+/* The smallest empty begin/end difference, to subtract from samples. */
+uint64_t timer_overhead(void);
+
+static inline double
+ticks_to_ns(uint64_t ticks)
+{
+    return ticks / timer_ticks_per_ns();
+}
+
+#endif
@@ -6,51 +6,17 @@
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <getopt.h>
+#include <sched.h>
 
-#define DoNotOptimize(value) asm volatile("" : "=r"(value) : "0"(value))
-
-static void
-die(const char *msg)
-{
-    perror(msg);
-    exit(EXIT_FAILURE);
-}
-
-/*
- * Parse sizes like:
- *   4096
- *   64K, 1M, 2G
- */
-static size_t
-parse_size(const char *s)
-{
-    char *end;
-    errno = 0;
-    unsigned long long val = strtoull(s, &end, 10);
-    if (errno != 0 || end == s) {
-        fprintf(stderr, "Invalid size: %s\n", s);
-        exit(EXIT_FAILURE);
-    }
-
-    switch (*end) {
-    case 'k': case 'K':
-        val *= 1024ULL;
-        break;
-    case 'm': case 'M':
-        val *= 1024ULL * 1024ULL;
-        break;
-    case 'g': case 'G':
-        val *= 1024ULL * 1024ULL * 1024ULL;
-        break;
-    case '\0':
-        break;
-    default:
-        fprintf(stderr, "Unknown size suffix '%c' in \"%s\"\n", *end, s);
-        exit(EXIT_FAILURE);
-    }
-
-    return (size_t)val;
-}
+#include "cache.h"
+#include "common.h"
+#include "faults.h"
+#include "kernels.h"
+#include "latency.h"
+#include "sweep.h"
+#include "threads.h"
+#include "timer.h"
 
 static double
 timespec_diff_sec(const struct timespec *start, const struct timespec *end)
@@ -69,50 +35,95 @@ usage(const char *prog)
 {
     fprintf(stderr,
         "Usage: %s <size> [iterations]\n"
+        "       %s --sweep [sweep options]\n"
+        "       %s --threads N [thread options] <size>\n"
+        "       %s --latency [--samples FILE] <size> [iterations]\n"
+        "       %s --fresh-dst | --mremap [page fault options]\n"
         "\n"
         "  <size>       bytes per memcpy, allow K/M/G suffix, e.g. 64K, 1M, 256M\n"
         "  [iterations] number of memcpy calls (default: 100000)\n"
         "\n"
+        "  --impl LIST           copy kernels to run, comma separated, or all\n"
+        "                        supported ones (default: memcpy); every one\n"
+        "                        is checked against memcpy first\n"
+        "  --list-impls          list the copy kernels and CPU features\n"
+        "  --latency             time every copy alone with rdtscp (cntvct_el0\n"
+        "                        on arm64) and print min/median/mean/p99/max\n"
+        "  --samples FILE        also write every copy's ticks to FILE as CSV;\n"
+        "                        implies --latency\n"
+        "\n"
+        "Sweep options (any of them implies --sweep):\n"
+        "  --sizes MIN:MAX[:xF]  log-spaced sizes (default: 1:1G:x2)\n"
+        "  --src-align LIST      source offsets past a 64-byte boundary,\n"
+        "                        e.g. 0,1,8-15 (default: 0)\n"
+        "  --dst-align LIST      destination offsets (default: 0)\n"
+        "  --overlap LIST        none for separate buffers (memcpy) or dst - src\n"
+        "                        distances copied with memmove, e.g. none,-64,64\n"
+        "                        (default: none)\n"
+        "  --working-set SIZE    spread the copies over src/dst pairs filling\n"
+        "                        SIZE bytes, e.g. 1G, so they miss the caches\n"
+        "                        (default: one pair, copied over and over)\n"
+        "  --order ORDER         visit the pairs random or rr (round-robin)\n"
+        "                        (default: random)\n"
+        "  --flush MODE          before every copy: none, clflush (flush its\n"
+        "                        lines) or evict (read 2x the LLC); each copy\n"
+        "                        is then timed alone (default: none)\n"
+        "  --budget TIME         timed run per cell, e.g. 20ms (default: 20ms)\n"
+        "  --format FMT          heatmap or csv (default: heatmap); rows are\n"
+        "                        marked where the footprint leaves a cache level\n"
+        "\n"
+        "Thread options, each thread copying its own <size> buffers:\n"
+        "  --threads N           copy threads (default: all allowed CPUs)\n"
+        "  --thread-sweep        run every thread count from 1 to N\n"
+        "  --cpus LIST           thread i runs on the i-th CPU of the list,\n"
+        "                        e.g. 0-7,16-23 (default: allowed CPUs)\n"
+        "  --numa MODE           buffer placement: first-touch, local or remote\n"
+        "                        node of each thread's CPU (default: first-touch)\n"
+        "  --budget TIME         copy window per thread count (default: 200ms)\n"
+        "  --format FMT          table or csv (default: table)\n"
+        "\n"
+        "Page fault options, minor faults counted per copy:\n"
+        "  --fresh-dst           copy into a newly mapped destination every\n"
+        "                        time, against one that stays mapped\n"
+        "  --mremap              move a buffer by copying to a fresh mapping\n"
+        "                        or by mremap, and show where mremap wins\n"
+        "  --pages KIND          pages of the mappings: normal (4K), thp or\n"
+        "                        hugetlb (default: normal)\n"
+        "  --sizes MIN:MAX[:xF]  sizes (default: 4K:256M:x4)\n"
+        "  --budget TIME         time per size, three rounds at least\n"
+        "                        (default: 100ms)\n"
+        "  --format FMT          table or csv (default: table)\n"
+        "\n"
         "Example:\n"
-        "  %s 1M 200000\n",
-        prog, prog);
+        "  %s 1M 200000\n"
+        "  %s --sizes 1:64K:x4 --src-align 0,1,7 --dst-align 0,32\n"
+        "  %s --sizes 64:64M:x4 --impl all\n"
+        "  %s --sizes 64:1M:x4 --working-set 1G --order rr\n"
+        "  %s --thread-sweep --numa remote 64M\n"
+        "  %s --latency --samples lat.csv 4K 100000\n"
+        "  %s --mremap --pages thp --sizes 64K:1G:x4\n",
+        prog, prog, prog, prog, prog, prog, prog, prog, prog, prog, prog,
+        prog);
 }
 
 /*
- * Simple memcpy microbenchmark.
+ * Simple copy microbenchmark.
  *
  * - Allocates two aligned buffers (64-byte aligned).
  * - Touches them to fault in pages.
  * - Does a few warmup copies.
- * - Times a tight loop of memcpy(dst, src, size).
+ * - Times a tight loop of k->copy(dst, src, size), libc memcpy by default.
  * - Prints total bytes, elapsed seconds, and GB/s.
  */
-int
-main(int argc, char **argv)
+static int
+run_single(const struct copy_kernel *k, size_t size, unsigned long long iters)
 {
-    if (argc < 2 || argc > 3) {
-        usage(argv[0]);
-        return EXIT_FAILURE;
-    }
-
-    size_t size = parse_size(argv[1]);
-    unsigned long long iters = 100000ULL;
-    if (argc == 3) {
-        char *end;
-        errno = 0;
-        iters = strtoull(argv[2], &end, 10);
-        if (errno != 0 || end == argv[2] || *end != '\0' || iters == 0) {
-            fprintf(stderr, "Invalid iteration count: %s\n", argv[2]);
-            return EXIT_FAILURE;
-        }
-    }
-
     if (size == 0) {
         fprintf(stderr, "Size must be > 0\n");
         return EXIT_FAILURE;
     }
 
-    printf("memcpy benchmark:\n");
+    printf("%s benchmark:\n", k->name);
     printf("  size       = %zu bytes\n", size);
     printf("  iterations = %llu\n", iters);
 
@@ -131,7 +142,7 @@ main(int argc, char **argv)
 
     // Warmup (avoid cold start artifacts).
     for (int i = 0; i < 10; ++i) {
-        memcpy(dst, src, size);
+        k->copy(dst, src, size);
     }
 
     struct timespec t0, t1;
@@ -140,7 +151,7 @@ main(int argc, char **argv)
 
     // Main timed loop.
     for (unsigned long long i = 0; i < iters; ++i) {
-        char* p = memcpy(dst, src, size);
+        char* p = k->copy(dst, src, size);
 	DoNotOptimize(p);
     }
 
@@ -167,3 +178,326 @@ main(int argc, char **argv)
     return 0;
 }
 
+static int zero_offset[] = {0};
+static int64_t no_overlap[] = {OVERLAP_NONE};
+
+enum {
+    OPT_SWEEP = 256,
+    OPT_SIZES,
+    OPT_SRC_ALIGN,
+    OPT_DST_ALIGN,
+    OPT_OVERLAP,
+    OPT_WORKING_SET,
+    OPT_ORDER,
+    OPT_FLUSH,
+    OPT_BUDGET,
+    OPT_FORMAT,
+    OPT_IMPL,
+    OPT_LIST_IMPLS,
+    OPT_THREADS,
+    OPT_THREAD_SWEEP,
+    OPT_CPUS,
+    OPT_NUMA,
+    OPT_LATENCY,
+    OPT_SAMPLES,
+    OPT_FRESH_DST,
+    OPT_MREMAP,
+    OPT_PAGES,
+};
+
+int
+main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        {"sweep",     no_argument,       NULL, OPT_SWEEP},
+        {"sizes",     required_argument, NULL, OPT_SIZES},
+        {"src-align", required_argument, NULL, OPT_SRC_ALIGN},
+        {"dst-align", required_argument, NULL, OPT_DST_ALIGN},
+        {"overlap",   required_argument, NULL, OPT_OVERLAP},
+        {"working-set", required_argument, NULL, OPT_WORKING_SET},
+        {"order",     required_argument, NULL, OPT_ORDER},
+        {"flush",     required_argument, NULL, OPT_FLUSH},
+        {"budget",    required_argument, NULL, OPT_BUDGET},
+        {"format",    required_argument, NULL, OPT_FORMAT},
+        {"impl",      required_argument, NULL, OPT_IMPL},
+        {"list-impls", no_argument,      NULL, OPT_LIST_IMPLS},
+        {"threads",   required_argument, NULL, OPT_THREADS},
+        {"thread-sweep", no_argument,    NULL, OPT_THREAD_SWEEP},
+        {"cpus",      required_argument, NULL, OPT_CPUS},
+        {"numa",      required_argument, NULL, OPT_NUMA},
+        {"latency",   no_argument,       NULL, OPT_LATENCY},
+        {"samples",   required_argument, NULL, OPT_SAMPLES},
+        {"fresh-dst", no_argument,       NULL, OPT_FRESH_DST},
+        {"mremap",    no_argument,       NULL, OPT_MREMAP},
+        {"pages",     required_argument, NULL, OPT_PAGES},
+        {"help",      no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    struct sweep_config sweep = {
+        .src_offsets = zero_offset,
+        .nsrc = 1,
+        .dst_offsets = zero_offset,
+        .ndst = 1,
+        .overlaps = no_overlap,
+        .noverlaps = 1,
+        .budget_ns = 20000000ULL,
+        .format = SWEEP_HEATMAP,
+        .order = WS_RANDOM,
+        .flush = FLUSH_NONE,
+    };
+    struct threads_config threads = {
+        .numa = NUMA_FIRST_TOUCH,
+        .duration_ns = 200000000ULL,
+    };
+    struct latency_config latency = {0};
+    struct faults_config faults = {
+        .mode = FAULT_FRESH_DST,
+        .pages = PAGES_NORMAL,
+        .budget_ns = 100000000ULL,
+    };
+    int sweeping = 0, threading = 0, timing = 0, faulting = 0;
+    int budget_set = 0, format_set = 0;
+    const struct copy_kernel *libc = find_kernel("memcpy");
+    const struct copy_kernel **kernels = &libc;
+    size_t nkernels = 1;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_options, NULL)) != -1) {
+        /* --sizes also sets the sizes of the fault modes. */
+        if (opt >= OPT_SWEEP && opt <= OPT_FLUSH && opt != OPT_SIZES)
+            sweeping = 1;
+        if (opt >= OPT_THREADS && opt <= OPT_NUMA)
+            threading = 1;
+        if (opt == OPT_LATENCY || opt == OPT_SAMPLES)
+            timing = 1;
+        if (opt >= OPT_FRESH_DST && opt <= OPT_PAGES)
+            faulting = 1;
+        switch (opt) {
+        case OPT_SWEEP:
+            break;
+        case OPT_SIZES:
+            sweep.sizes = parse_size_sweep(optarg, &sweep.nsizes);
+            break;
+        case OPT_SRC_ALIGN:
+            sweep.src_offsets = parse_int_list(optarg, 63, &sweep.nsrc);
+            break;
+        case OPT_DST_ALIGN:
+            sweep.dst_offsets = parse_int_list(optarg, 63, &sweep.ndst);
+            break;
+        case OPT_OVERLAP:
+            sweep.overlaps = parse_overlap_list(optarg, &sweep.noverlaps);
+            break;
+        case OPT_WORKING_SET:
+            sweep.working_set = parse_size(optarg);
+            break;
+        case OPT_ORDER:
+            if (strcmp(optarg, "rr") == 0) {
+                sweep.order = WS_ROUND_ROBIN;
+            } else if (strcmp(optarg, "random") == 0) {
+                sweep.order = WS_RANDOM;
+            } else {
+                fprintf(stderr, "Unknown working-set order: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_FLUSH:
+            if (strcmp(optarg, "none") == 0) {
+                sweep.flush = FLUSH_NONE;
+            } else if (strcmp(optarg, "clflush") == 0 && have_flush_lines()) {
+                sweep.flush = FLUSH_LINES;
+            } else if (strcmp(optarg, "evict") == 0) {
+                sweep.flush = FLUSH_EVICT;
+            } else {
+                fprintf(stderr, "Unknown or unsupported flush mode: %s\n",
+                        optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_BUDGET:
+            sweep.budget_ns = parse_duration_ns(optarg);
+            threads.duration_ns = sweep.budget_ns;
+            faults.budget_ns = sweep.budget_ns;
+            budget_set = 1;
+            break;
+        case OPT_FORMAT:
+            format_set = 1;
+            if (strcmp(optarg, "csv") == 0) {
+                sweep.format = SWEEP_CSV;
+                threads.csv = 1;
+                faults.csv = 1;
+            } else if (strcmp(optarg, "heatmap") == 0 ||
+                       strcmp(optarg, "table") == 0) {
+                sweep.format = SWEEP_HEATMAP;
+            } else {
+                fprintf(stderr, "Unknown format: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_IMPL:
+            kernels = parse_kernel_list(optarg, &nkernels);
+            break;
+        case OPT_LIST_IMPLS:
+            list_kernels();
+            return 0;
+        case OPT_THREADS:
+            threads.threads = atoi(optarg);
+            if (threads.threads <= 0) {
+                fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_THREAD_SWEEP:
+            threads.sweep = 1;
+            break;
+        case OPT_CPUS:
+            threads.cpus = parse_int_list(optarg, CPU_SETSIZE - 1,
+                                          &threads.ncpus);
+            break;
+        case OPT_NUMA:
+            if (strcmp(optarg, "first-touch") == 0) {
+                threads.numa = NUMA_FIRST_TOUCH;
+            } else if (strcmp(optarg, "local") == 0) {
+                threads.numa = NUMA_LOCAL;
+            } else if (strcmp(optarg, "remote") == 0) {
+                threads.numa = NUMA_REMOTE;
+            } else {
+                fprintf(stderr, "Unknown NUMA placement: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_LATENCY:
+            break;
+        case OPT_SAMPLES:
+            latency.samples_path = optarg;
+            break;
+        case OPT_FRESH_DST:
+            faults.mode = FAULT_FRESH_DST;
+            break;
+        case OPT_MREMAP:
+            faults.mode = FAULT_MREMAP;
+            break;
+        case OPT_PAGES:
+            faults.pages = parse_page_kind(optarg);
+            break;
+        case 'h':
+            usage(argv[0]);
+            return 0;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (sweep.sizes != NULL && !faulting)
+        sweeping = 1;
+    if (sweeping + threading + faulting > 1) {
+        fprintf(stderr, "Sweep, thread and page fault options can't be "
+                "combined\n");
+        return EXIT_FAILURE;
+    }
+    if (timing && (sweeping || threading || faulting || budget_set ||
+                   format_set)) {
+        fprintf(stderr, "Latency options only apply to a single size\n");
+        return EXIT_FAILURE;
+    }
+    if (!threading && !faulting && (budget_set || format_set))
+        sweeping = 1;
+
+    for (size_t i = 0; i < nkernels; ++i)
+        if (kernels[i] != libc && !verify_kernel(kernels[i]))
+            return EXIT_FAILURE;
+
+    if (threading) {
+        if (argc - optind != 1) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        threads.size = parse_size(argv[optind]);
+        if (threads.size == 0) {
+            fprintf(stderr, "Size must be > 0\n");
+            return EXIT_FAILURE;
+        }
+        if (threads.cpus == NULL)
+            threads.cpus = allowed_cpus(&threads.ncpus);
+        if (threads.threads == 0)
+            threads.threads = (int)threads.ncpus;
+        for (size_t i = 0; i < nkernels; ++i) {
+            if (i > 0 && !threads.csv)
+                printf("\n");
+            threads.kernel = kernels[i];
+            run_threads(&threads);
+        }
+        return 0;
+    }
+
+    if (faulting) {
+        if (optind != argc) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        faults.sizes = sweep.sizes;
+        faults.nsizes = sweep.nsizes;
+        if (faults.sizes == NULL)
+            faults.sizes = parse_size_sweep("4K:256M:x4", &faults.nsizes);
+        for (size_t i = 0; i < nkernels; ++i) {
+            if (i > 0 && !faults.csv)
+                printf("\n");
+            faults.kernel = kernels[i];
+            run_faults(&faults);
+        }
+        return 0;
+    }
+
+    if (sweeping) {
+        if (optind != argc) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        sweep.kernels = kernels;
+        sweep.nkernels = nkernels;
+        if (sweep.sizes == NULL)
+            sweep.sizes = parse_size_sweep("1:1G:x2", &sweep.nsizes);
+        run_sweep(&sweep);
+        return 0;
+    }
+
+    if (argc - optind < 1 || argc - optind > 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    size_t size = parse_size(argv[optind]);
+    unsigned long long iters = 100000ULL;
+    if (argc - optind == 2) {
+        const char *arg = argv[optind + 1];
+        char *end;
+        errno = 0;
+        iters = strtoull(arg, &end, 10);
+        if (errno != 0 || end == arg || *end != '\0' || iters == 0) {
+            fprintf(stderr, "Invalid iteration count: %s\n", arg);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (timing) {
+        if (size == 0) {
+            fprintf(stderr, "Size must be > 0\n");
+            return EXIT_FAILURE;
+        }
+        timer_init();
+        latency.size = size;
+        latency.iters = iters;
+    }
+    for (size_t i = 0; i < nkernels; ++i) {
+        if (i > 0)
+            printf("\n");
+        if (timing) {
+            latency.kernel = kernels[i];
+            run_latency(&latency);
+        } else if (run_single(kernels[i], size, iters) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    return 0;
+}
+